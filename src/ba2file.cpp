@@ -6,26 +6,30 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#if defined(_WIN32) || defined(_WIN64)
+#  include <process.h>
+#else
+#  include <unistd.h>
+#endif
 
 inline BA2File::FileDeclaration::FileDeclaration()
-  : fileData((unsigned char *) 0),
+  : dataOffset(0),
     packedSize(0),
     unpackedSize(0),
     archiveType(0),
-    archiveFile(0)
+    archiveFile(0),
+    nameOffset(0),
+    nameHash(0)
 {
 }
 
-BA2File::FileDeclaration * BA2File::addPackedFile(const std::string& fileName)
+bool BA2File::checkFileName(const std::string& fileName) const
 {
   bool    nameMatches = false;
-  if (fileNamesPtr && fileNamesPtr->begin() != fileNamesPtr->end())
-  {
-    nameMatches = (fileNamesPtr->find(fileName) != fileNamesPtr->end());
-  }
-  if (includePatternsPtr && includePatternsPtr->size() > 0 && !nameMatches)
+  if (fileNames.begin() != fileNames.end())
+    nameMatches = (fileNames.find(fileName) != fileNames.end());
+  if (includePatterns.size() > 0 && !nameMatches)
   {
-    const std::vector< std::string >& includePatterns = *includePatternsPtr;
     for (size_t i = 0; i < includePatterns.size(); i++)
     {
       if (fileName.find(includePatterns[i]) != std::string::npos)
@@ -35,25 +39,77 @@ BA2File::FileDeclaration * BA2File::addPackedFile(const std::string& fileName)
       }
     }
   }
-  else if (!(fileNamesPtr && fileNamesPtr->begin() != fileNamesPtr->end()))
+  else if (fileNames.begin() == fileNames.end())
   {
     nameMatches = true;
   }
   if (!nameMatches)
+    return false;
+  for (size_t i = 0; i < excludePatterns.size(); i++)
+  {
+    if (fileName.find(excludePatterns[i]) != std::string::npos)
+      return false;
+  }
+  return true;
+}
+
+BA2File::FileDeclaration * BA2File::addPackedFile(const std::string& fileName)
+{
+  if (!(indexCacheMode || checkFileName(fileName)))
     return (FileDeclaration *) 0;
-  if (excludePatternsPtr && excludePatternsPtr->size() > 0)
+  std::uint32_t h = hashFileName(fileName.c_str(), fileName.length());
+  std::uint32_t i = h & fileHashMask;
+  for ( ; fileHashTableBuf[i]; i = (i + 1U) & fileHashMask)
   {
-    const std::vector< std::string >& excludePatterns = *excludePatternsPtr;
-    for (size_t i = 0; i < excludePatterns.size(); i++)
+    FileDeclaration&  fd = fileDeclBuf[fileHashTableBuf[i] - 1U];
+    if (fd.nameHash == h &&
+        std::strcmp(&(fileNameBuf.front()) + fd.nameOffset,
+                    fileName.c_str()) == 0)
     {
-      if (fileName.find(excludePatterns[i]) != std::string::npos)
-        return (FileDeclaration *) 0;
+      return &fd;
     }
   }
-  FileDeclaration&  fd = fileMap[fileName];
+  if (fileNameBuf.size() + fileName.length() >= 0xFFFFFFFFU)
+    errorMessage("too many files in archives");
+  fileDeclBuf.resize(fileDeclBuf.size() + 1);
+  FileDeclaration&  fd = fileDeclBuf[fileDeclBuf.size() - 1];
+  fd.nameOffset = std::uint32_t(fileNameBuf.size());
+  fd.nameHash = h;
+  const char  *s = fileName.c_str();
+  fileNameBuf.insert(fileNameBuf.end(), s, s + (fileName.length() + 1));
+  fileHashTableBuf[i] = std::uint32_t(fileDeclBuf.size());
+  if ((fileDeclBuf.size() * 2) > fileHashMask)
+    resizeHashTable((size_t(fileHashMask) + 1) * 2);
   return &fd;
 }
 
+void BA2File::resizeHashTable(size_t n)
+{
+  fileHashTableBuf.clear();
+  fileHashTableBuf.resize(n, 0U);
+  fileHashMask = std::uint32_t(n - 1);
+  for (size_t i = 0; i < fileDeclBuf.size(); i++)
+  {
+    std::uint32_t j = fileDeclBuf[i].nameHash & fileHashMask;
+    while (fileHashTableBuf[j])
+      j = (j + 1U) & fileHashMask;
+    fileHashTableBuf[j] = std::uint32_t(i + 1);
+  }
+}
+
+void BA2File::updateFileTablePointers()
+{
+  fileDeclTable = (FileDeclaration *) 0;
+  fileNameData = (char *) 0;
+  if (fileDeclBuf.size() > 0)
+  {
+    fileDeclTable = &(fileDeclBuf.front());
+    fileNameData = &(fileNameBuf.front());
+  }
+  fileHashTable = &(fileHashTableBuf.front());
+  fileDeclCnt = fileDeclBuf.size();
+}
+
 void BA2File::loadBA2General(FileBuffer& buf, size_t archiveFile)
 {
   size_t  fileCnt = buf.readUInt32();
@@ -61,6 +117,7 @@ void BA2File::loadBA2General(FileBuffer& buf, size_t archiveFile)
   if (nameOffs > buf.size() || (fileCnt * 36ULL + 24U) > nameOffs)
     errorMessage("invalid BA2 file header");
   std::vector< FileDeclaration * >  fileDecls(fileCnt, (FileDeclaration *) 0);
+  fileDeclBuf.reserve(fileDeclBuf.size() + fileCnt);
   buf.setPosition(nameOffs);
   std::string fileName;
   for (size_t i = 0; i < fileCnt; i++)
@@ -83,7 +140,7 @@ void BA2File::loadBA2General(FileBuffer& buf, size_t archiveFile)
     (void) buf.readUInt32Fast();        // extension
     (void) buf.readUInt32Fast();        // unknown
     (void) buf.readUInt32Fast();        // flags
-    fileDecl.fileData = buf.getDataPtr() + buf.readUInt64();
+    fileDecl.dataOffset = buf.readUInt64();
     fileDecl.packedSize = buf.readUInt32Fast();
     fileDecl.unpackedSize = buf.readUInt32Fast();
     fileDecl.archiveType = 0;
@@ -99,6 +156,7 @@ void BA2File::loadBA2Textures(FileBuffer& buf, size_t archiveFile)
   if (nameOffs > buf.size() || (fileCnt * 48ULL + 24U) > nameOffs)
     errorMessage("invalid BA2 file header");
   std::vector< FileDeclaration * >  fileDecls(fileCnt, (FileDeclaration *) 0);
+  fileDeclBuf.reserve(fileDeclBuf.size() + fileCnt);
   buf.setPosition(nameOffs);
   std::string fileName;
   for (size_t i = 0; i < fileCnt; i++)
@@ -120,7 +178,7 @@ void BA2File::loadBA2Textures(FileBuffer& buf, size_t archiveFile)
     (void) buf.readUInt32Fast();        // extension ("dds\0")
     (void) buf.readUInt32Fast();        // unknown
     (void) buf.readUInt8Fast();         // unknown
-    const unsigned char *fileData = buf.getDataPtr() + buf.getPosition();
+    size_t  dataOffset = buf.getPosition();
     size_t  chunkCnt = buf.readUInt8Fast();
     (void) buf.readUInt16Fast();        // chunk header size
     (void) buf.readUInt16Fast();        // texture width
@@ -144,7 +202,7 @@ void BA2File::loadBA2Textures(FileBuffer& buf, size_t archiveFile)
     if (fileDecls[i])
     {
       FileDeclaration&  fileDecl = *(fileDecls[i]);
-      fileDecl.fileData = fileData;
+      fileDecl.dataOffset = dataOffset;
       fileDecl.packedSize = packedSize;
       fileDecl.unpackedSize = unpackedSize;
       fileDecl.archiveType = 1;
@@ -214,7 +272,7 @@ void BA2File::loadBSAFile(FileBuffer& buf, size_t archiveFile, int archiveType)
       FileDeclaration *fileDecl = addPackedFile(fileName);
       if (fileDecl)
       {
-        fileDecl->fileData = buf.getDataPtr() + size_t(fileDecls[n] >> 32);
+        fileDecl->dataOffset = fileDecls[n] >> 32;
         fileDecl->packedSize = 0;
         fileDecl->unpackedSize = (unsigned int) (fileDecls[n] & 0x7FFFFFFFU);
         fileDecl->archiveType =
@@ -269,14 +327,15 @@ void BA2File::loadFile(FileBuffer& buf, size_t archiveFile,
   FileDeclaration *fileDecl = addPackedFile(fileName2);
   if (!fileDecl)
     return;
-  fileDecl->fileData = buf.getDataPtr();
+  fileDecl->dataOffset = 0;
   fileDecl->packedSize = 0;
   fileDecl->unpackedSize = (unsigned int) buf.size();
   fileDecl->archiveType = 0;
   fileDecl->archiveFile = (unsigned int) archiveFile;
 }
 
-void BA2File::loadArchivesFromDir(const char *pathName)
+void BA2File::findArchivesInDir(std::vector< ArchiveFileInfo >& archives,
+                                const char *pathName)
 {
   DIR     *d = opendir(pathName);
   if (!d)
@@ -355,12 +414,12 @@ void BA2File::loadArchivesFromDir(const char *pathName)
     for (std::set< std::string >::iterator i = archiveNames1.begin();
          i != archiveNames1.end(); i++)
     {
-      loadArchiveFile(i->c_str());
+      findArchives(archives, i->c_str());
     }
     for (std::set< std::string >::iterator i = archiveNames2.begin();
          i != archiveNames2.end(); i++)
     {
-      loadArchiveFile(i->c_str());
+      findArchives(archives, i->c_str());
     }
   }
   catch (...)
@@ -371,44 +430,51 @@ void BA2File::loadArchivesFromDir(const char *pathName)
   }
 }
 
-void BA2File::loadArchiveFile(const char *fileName)
+void BA2File::findArchives(std::vector< ArchiveFileInfo >& archives,
+                           const char *pathName)
 {
+  if (BRANCH_UNLIKELY(!pathName || *pathName == '\0'))
   {
-    if (BRANCH_UNLIKELY(!fileName || *fileName == '\0'))
-    {
-      std::string dataPath;
-      if (!FileBuffer::getDefaultDataPath(dataPath))
-        errorMessage("empty input file name");
-      loadArchivesFromDir(dataPath.c_str());
-      return;
-    }
+    std::string dataPath;
+    if (!FileBuffer::getDefaultDataPath(dataPath))
+      errorMessage("empty input file name");
+    findArchivesInDir(archives, dataPath.c_str());
+    return;
+  }
 #if defined(_WIN32) || defined(_WIN64)
-    char    c = fileName[std::strlen(fileName) - 1];
-    if (c == '/' || c == '\\')
-    {
-      loadArchivesFromDir(fileName);
-      return;
-    }
-    struct __stat64 st;
-    if (_stat64(fileName, &st) != 0)
+  char    c = pathName[std::strlen(pathName) - 1];
+  if (c == '/' || c == '\\')
+  {
+    findArchivesInDir(archives, pathName);
+    return;
+  }
+  struct __stat64 st;
+  if (_stat64(pathName, &st) != 0)
 #else
-    struct stat st;
-    if (stat(fileName, &st) != 0)
+  struct stat st;
+  if (stat(pathName, &st) != 0)
 #endif
-    {
-      errorMessage("error opening archive file or directory");
-    }
+  {
+    errorMessage("error opening archive file or directory");
+  }
 #if defined(_WIN32) || defined(_WIN64)
-    if ((st.st_mode & _S_IFMT) == _S_IFDIR)
+  if ((st.st_mode & _S_IFMT) == _S_IFDIR)
 #else
-    if ((st.st_mode & S_IFMT) == S_IFDIR)
+  if ((st.st_mode & S_IFMT) == S_IFDIR)
 #endif
-    {
-      loadArchivesFromDir(fileName);
-      return;
-    }
+  {
+    findArchivesInDir(archives, pathName);
+    return;
   }
+  archives.resize(archives.size() + 1);
+  ArchiveFileInfo&  a = archives[archives.size() - 1];
+  a.fileName = pathName;
+  a.fileSize = std::uint64_t(st.st_size);
+  a.modTime = std::int64_t(st.st_mtime);
+}
 
+void BA2File::loadArchiveFile(const char *fileName)
+{
   FileBuffer  *bufp = new FileBuffer(fileName);
   try
   {
@@ -446,14 +512,313 @@ void BA2File::loadArchiveFile(const char *fileName)
   }
 }
 
+bool BA2File::getIndexCacheFileName(
+    std::string& cacheFileName, const std::vector< ArchiveFileInfo >& archives)
+{
+  if (!FileBuffer::getCachePath(cacheFileName))
+    return false;
+  // FNV-1a hash of the archive path names
+  std::uint64_t h = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < archives.size(); i++)
+  {
+    const std::string&  s = archives[i].fileName;
+    for (size_t j = 0; j <= s.length(); j++)
+    {
+      h = h ^ (unsigned char) s.c_str()[j];
+      h = h * 0x00000100000001B3ULL;
+    }
+  }
+  char    tmpBuf[32];
+  std::snprintf(tmpBuf, 32, "/ba2i%016llx.bin", (unsigned long long) h);
+  cacheFileName += tmpBuf;
+  return true;
+}
+
+// Index cache file format (all integers are little endian):
+//   0:  "BA2I"
+//   4:  version (indexCacheVersion)
+//   8:  number of archives (A)
+//  12:  number of files (F)
+//  16:  hash table size (H, power of two)
+//  20:  size of name data in bytes (N)
+//  24:  reserved (8 bytes)
+//  32:  A * 24 bytes: archive file size (64-bit), modification time
+//       (64-bit), offset of archive name in the name data (32-bit), padding
+//  32 + A * 24:  F * 32 bytes: FileDeclaration table
+//  32 + A * 24 + F * 32:  H * 4 bytes: hash table
+//  32 + A * 24 + F * 32 + H * 4:  N bytes of '\0' terminated names
+
+bool BA2File::loadIndexCache(const char *cacheFileName,
+                             const std::vector< ArchiveFileInfo >& archives)
+{
+  FileBuffer  *bufp = (FileBuffer *) 0;
+  try
+  {
+    bufp = new FileBuffer(cacheFileName);
+  }
+  catch (FO76UtilsError&)
+  {
+    return false;
+  }
+  try
+  {
+    FileBuffer& buf = *bufp;
+    if (buf.size() < 33 || buf.readUInt32Fast() != 0x49324142 ||       // "BA2I"
+        buf.readUInt32Fast() != indexCacheVersion ||
+        buf.readUInt32Fast() != archives.size() || buf[buf.size() - 1] != 0)
+    {
+      delete bufp;
+      return false;
+    }
+    size_t  fileCnt = buf.readUInt32Fast();
+    size_t  hashTableSize = buf.readUInt32Fast();
+    size_t  namesSize = buf.readUInt32Fast();
+    size_t  declsOffs = archives.size() * 24 + 32;
+    size_t  hashTableOffs = declsOffs + fileCnt * sizeof(FileDeclaration);
+    size_t  namesOffs = hashTableOffs + hashTableSize * sizeof(std::uint32_t);
+    if (sizeof(FileDeclaration) != 32 ||
+        hashTableSize < 2 || (hashTableSize & (hashTableSize - 1)) ||
+        fileCnt >= hashTableSize || (namesOffs + namesSize) != buf.size())
+    {
+      delete bufp;
+      return false;
+    }
+    const char  *names =
+        reinterpret_cast< const char * >(buf.getDataPtr() + namesOffs);
+    for (size_t i = 0; i < archives.size(); i++)
+    {
+      buf.setPosition(i * 24 + 32);
+      std::uint64_t fileSize = buf.readUInt64();
+      std::int64_t  modTime = std::int64_t(buf.readUInt64());
+      size_t  nameOffs = buf.readUInt32Fast();
+      if (fileSize != archives[i].fileSize || modTime != archives[i].modTime ||
+          nameOffs >= namesSize ||
+          std::strcmp(names + nameOffs, archives[i].fileName.c_str()) != 0)
+      {
+        delete bufp;
+        return false;
+      }
+    }
+    for (size_t i = 0; i < archives.size(); i++)
+    {
+      archiveFiles.push_back((FileBuffer *) 0);
+      archiveFiles[i] = new FileBuffer(archives[i].fileName.c_str());
+    }
+    const FileDeclaration *fileDecls =
+        reinterpret_cast< const FileDeclaration * >(buf.getDataPtr()
+                                                    + declsOffs);
+    const std::uint32_t *hashTable =
+        reinterpret_cast< const std::uint32_t * >(buf.getDataPtr()
+                                                  + hashTableOffs);
+    for (size_t i = 0; i < fileCnt; i++)
+    {
+      const FileDeclaration&  fd = fileDecls[i];
+      if (fd.archiveFile >= archiveFiles.size() || fd.nameOffset >= namesSize)
+        throw FO76UtilsError("invalid archive index cache file");
+      // an empty file stored last may start at the end of the archive
+      std::uint64_t archiveSize = archiveFiles[fd.archiveFile]->size();
+      if (fd.dataOffset > archiveSize ||
+          (fd.dataOffset == archiveSize && (fd.packedSize | fd.unpackedSize)))
+      {
+        throw FO76UtilsError("invalid archive index cache file");
+      }
+    }
+    for (size_t i = 0; i < hashTableSize; i++)
+    {
+      if (hashTable[i] > fileCnt)
+        throw FO76UtilsError("invalid archive index cache file");
+    }
+    indexBuf = bufp;
+    fileDeclTable = fileDecls;
+    fileHashTable = hashTable;
+    fileNameData = names;
+    fileDeclCnt = fileCnt;
+    fileHashMask = std::uint32_t(hashTableSize - 1);
+  }
+  catch (...)
+  {
+    for (size_t i = 0; i < archiveFiles.size(); i++)
+    {
+      if (archiveFiles[i])
+        delete archiveFiles[i];
+    }
+    archiveFiles.clear();
+    delete bufp;
+    return false;
+  }
+  return true;
+}
+
+static inline void writeIndexUInt32(std::vector< unsigned char >& buf,
+                                    std::uint32_t n)
+{
+  buf.push_back((unsigned char) (n & 0xFF));
+  buf.push_back((unsigned char) ((n >> 8) & 0xFF));
+  buf.push_back((unsigned char) ((n >> 16) & 0xFF));
+  buf.push_back((unsigned char) ((n >> 24) & 0xFF));
+}
+
+void BA2File::saveIndexCache(
+    const char *cacheFileName,
+    const std::vector< ArchiveFileInfo >& archives) const
+{
+  std::vector< unsigned char >  buf;
+  std::string archiveNames;
+  for (size_t i = 0; i < archives.size(); i++)
+  {
+    archiveNames += archives[i].fileName;
+    archiveNames += '\0';
+  }
+  if ((fileNameBuf.size() + archiveNames.length()) >= 0xFFFFFFFFU)
+    return;
+  buf.reserve(archives.size() * 24 + fileDeclCnt * sizeof(FileDeclaration)
+              + (size_t(fileHashMask) + 1) * sizeof(std::uint32_t) + 32);
+  writeIndexUInt32(buf, 0x49324142);    // "BA2I"
+  writeIndexUInt32(buf, indexCacheVersion);
+  writeIndexUInt32(buf, std::uint32_t(archives.size()));
+  writeIndexUInt32(buf, std::uint32_t(fileDeclCnt));
+  writeIndexUInt32(buf, fileHashMask + 1U);
+  writeIndexUInt32(buf, std::uint32_t(fileNameBuf.size()
+                                      + archiveNames.length()));
+  writeIndexUInt32(buf, 0U);
+  writeIndexUInt32(buf, 0U);
+  for (size_t i = 0, n = fileNameBuf.size(); i < archives.size(); i++)
+  {
+    writeIndexUInt32(buf, std::uint32_t(archives[i].fileSize));
+    writeIndexUInt32(buf, std::uint32_t(archives[i].fileSize >> 32));
+    writeIndexUInt32(buf, std::uint32_t(archives[i].modTime));
+    writeIndexUInt32(buf, std::uint32_t(std::uint64_t(archives[i].modTime)
+                                        >> 32));
+    writeIndexUInt32(buf, std::uint32_t(n));
+    writeIndexUInt32(buf, 0U);
+    n = n + archives[i].fileName.length() + 1;
+  }
+  for (size_t i = 0; i < fileDeclCnt; i++)
+  {
+    const FileDeclaration&  fd = fileDeclTable[i];
+    writeIndexUInt32(buf, std::uint32_t(fd.dataOffset));
+    writeIndexUInt32(buf, std::uint32_t(fd.dataOffset >> 32));
+    writeIndexUInt32(buf, fd.packedSize);
+    writeIndexUInt32(buf, fd.unpackedSize);
+    writeIndexUInt32(buf, std::uint32_t(fd.archiveType));
+    writeIndexUInt32(buf, fd.archiveFile);
+    writeIndexUInt32(buf, fd.nameOffset);
+    writeIndexUInt32(buf, fd.nameHash);
+  }
+  for (size_t i = 0; i <= size_t(fileHashMask); i++)
+    writeIndexUInt32(buf, fileHashTable[i]);
+  // write to a temporary file first, so that other processes never see
+  // an incomplete index
+  std::string tmpFileName(cacheFileName);
+  {
+    char    tmpBuf[32];
+#if defined(_WIN32) || defined(_WIN64)
+    std::snprintf(tmpBuf, 32, ".%d.tmp", int(_getpid()));
+#else
+    std::snprintf(tmpBuf, 32, ".%d.tmp", int(getpid()));
+#endif
+    tmpFileName += tmpBuf;
+  }
+  try
+  {
+    {
+      OutputFile  f(tmpFileName.c_str(), 0);
+      f.writeData(&(buf.front()), buf.size());
+      if (fileNameBuf.size() > 0)
+        f.writeData(&(fileNameBuf.front()), fileNameBuf.size());
+      f.writeData(archiveNames.c_str(), archiveNames.length());
+    }
+    if (std::rename(tmpFileName.c_str(), cacheFileName) != 0)
+    {
+      (void) std::remove(cacheFileName);
+      if (std::rename(tmpFileName.c_str(), cacheFileName) != 0)
+        (void) std::remove(tmpFileName.c_str());
+    }
+  }
+  catch (FO76UtilsError&)
+  {
+    // the cache is optional, ignore errors
+    (void) std::remove(tmpFileName.c_str());
+  }
+}
+
+void BA2File::loadArchives(const std::vector< std::string >& pathNames)
+{
+  std::vector< ArchiveFileInfo >  archives;
+  for (size_t i = 0; i < pathNames.size(); i++)
+    findArchives(archives, pathNames[i].c_str());
+  std::string cacheFileName;
+  indexCacheMode = getIndexCacheFileName(cacheFileName, archives);
+  if (indexCacheMode)
+  {
+    if (loadIndexCache(cacheFileName.c_str(), archives))
+    {
+      applyFileNameFilter();
+      return;
+    }
+  }
+  resizeHashTable(1024);
+  for (size_t i = 0; i < archives.size(); i++)
+    loadArchiveFile(archives[i].fileName.c_str());
+  updateFileTablePointers();
+  if (indexCacheMode && archives.size() > 0)
+    saveIndexCache(cacheFileName.c_str(), archives);
+  if (indexCacheMode)
+    applyFileNameFilter();
+}
+
+void BA2File::applyFileNameFilter()
+{
+  fileNameFilter.clear();
+  if (!(includePatterns.size() > 0 || excludePatterns.size() > 0 ||
+        fileNames.begin() != fileNames.end()))
+  {
+    return;
+  }
+  fileNameFilter.resize(fileDeclCnt);
+  std::string fileName;
+  for (size_t i = 0; i < fileDeclCnt; i++)
+  {
+    fileName = getFileName(fileDeclTable[i]);
+    fileNameFilter[i] = (unsigned char) checkFileName(fileName);
+  }
+}
+
+const BA2File::FileDeclaration * BA2File::findFile(
+    const char *fileName, size_t nameLen) const
+{
+  std::uint32_t h = hashFileName(fileName, nameLen);
+  for (std::uint32_t i = h & fileHashMask; fileHashTable[i];
+       i = (i + 1U) & fileHashMask)
+  {
+    const FileDeclaration&  fd = fileDeclTable[fileHashTable[i] - 1U];
+    if (fd.nameHash == h)
+    {
+      const char  *s = getFileName(fd);
+      if (std::strncmp(s, fileName, nameLen) == 0 && s[nameLen] == '\0')
+      {
+        if (fileNameFilter.size() > 0 && !fileNameFilter[fileHashTable[i] - 1U])
+          return (FileDeclaration *) 0;
+        return &fd;
+      }
+    }
+  }
+  return (FileDeclaration *) 0;
+}
+
 unsigned int BA2File::getBSAUnpackedSize(const unsigned char*& dataPtr,
                                          const FileDeclaration& fd) const
 {
   const FileBuffer& buf = *(archiveFiles[fd.archiveFile]);
   size_t  offs = size_t(dataPtr - buf.getDataPtr());
-  if (fd.archiveType & 0x00000100)
-    offs = offs + (size_t(buf.readUInt8(offs)) + 1);
   unsigned int  unpackedSize = fd.unpackedSize;
+  if (fd.archiveType & 0x00000100)
+  {
+    // the size of uncompressed files includes the name prefix
+    unsigned int  nameLen = (unsigned int) buf.readUInt8(offs) + 1U;
+    offs = offs + nameLen;
+    unpackedSize = (unpackedSize > nameLen ? unpackedSize - nameLen : 0U);
+  }
   if (fd.archiveType & 0x40000000)
   {
     unpackedSize = buf.readUInt32(offs);
@@ -467,34 +832,57 @@ BA2File::BA2File(const char *pathName,
                  const std::vector< std::string > *includePatterns,
                  const std::vector< std::string > *excludePatterns,
                  const std::set< std::string > *fileNames)
-  : includePatternsPtr(includePatterns),
-    excludePatternsPtr(excludePatterns),
-    fileNamesPtr(fileNames)
+  : indexCacheMode(false),
+    indexBuf((FileBuffer *) 0),
+    fileDeclTable((FileDeclaration *) 0),
+    fileHashTable((std::uint32_t *) 0),
+    fileNameData((char *) 0),
+    fileDeclCnt(0),
+    fileHashMask(0U)
 {
-  loadArchiveFile(pathName);
+  if (includePatterns)
+    this->includePatterns = *includePatterns;
+  if (excludePatterns)
+    this->excludePatterns = *excludePatterns;
+  if (fileNames)
+    this->fileNames = *fileNames;
+  std::vector< std::string >  pathNames(1, std::string());
+  if (pathName)
+    pathNames[0] = pathName;
+  loadArchives(pathNames);
 }
 
 BA2File::BA2File(const std::vector< std::string >& pathNames,
                  const std::vector< std::string > *includePatterns,
                  const std::vector< std::string > *excludePatterns,
                  const std::set< std::string > *fileNames)
-  : includePatternsPtr(includePatterns),
-    excludePatternsPtr(excludePatterns),
-    fileNamesPtr(fileNames)
+  : indexCacheMode(false),
+    indexBuf((FileBuffer *) 0),
+    fileDeclTable((FileDeclaration *) 0),
+    fileHashTable((std::uint32_t *) 0),
+    fileNameData((char *) 0),
+    fileDeclCnt(0),
+    fileHashMask(0U)
 {
-  for (size_t i = 0; i < pathNames.size(); i++)
-    loadArchiveFile(pathNames[i].c_str());
+  if (includePatterns)
+    this->includePatterns = *includePatterns;
+  if (excludePatterns)
+    this->excludePatterns = *excludePatterns;
+  if (fileNames)
+    this->fileNames = *fileNames;
+  loadArchives(pathNames);
 }
 
 BA2File::BA2File(const char *pathName, const char *includePatterns,
                  const char *excludePatterns, const char *fileNames)
-  : includePatternsPtr((std::vector< std::string > *) 0),
-    excludePatternsPtr((std::vector< std::string > *) 0),
-    fileNamesPtr((std::set< std::string > *) 0)
+  : indexCacheMode(false),
+    indexBuf((FileBuffer *) 0),
+    fileDeclTable((FileDeclaration *) 0),
+    fileHashTable((std::uint32_t *) 0),
+    fileNameData((char *) 0),
+    fileDeclCnt(0),
+    fileHashMask(0U)
 {
-  std::vector< std::string >  tmpIncludePatterns;
-  std::vector< std::string >  tmpExcludePatterns;
-  std::set< std::string > tmpFileNames;
   std::string tmp;
   for (int i = 0; i < 3; i++)
   {
@@ -513,11 +901,11 @@ BA2File::BA2File(const char *pathName, const char *includePatterns,
         if (!tmp.empty())
         {
           if (i == 0)
-            tmpIncludePatterns.push_back(tmp);
+            this->includePatterns.push_back(tmp);
           else if (i == 1)
-            tmpExcludePatterns.push_back(tmp);
+            this->excludePatterns.push_back(tmp);
           else
-            tmpFileNames.insert(tmp);
+            this->fileNames.insert(tmp);
           tmp.clear();
         }
         if (!c)
@@ -529,62 +917,66 @@ BA2File::BA2File(const char *pathName, const char *includePatterns,
       }
     }
   }
-  if (tmpIncludePatterns.size() > 0)
-    includePatternsPtr = &tmpIncludePatterns;
-  if (tmpExcludePatterns.size() > 0)
-    excludePatternsPtr = &tmpExcludePatterns;
-  if (tmpFileNames.begin() != tmpFileNames.end())
-    fileNamesPtr = &tmpFileNames;
-  loadArchiveFile(pathName);
+  std::vector< std::string >  pathNames(1, std::string());
+  if (pathName)
+    pathNames[0] = pathName;
+  loadArchives(pathNames);
 }
 
 BA2File::~BA2File()
 {
   for (size_t i = 0; i < archiveFiles.size(); i++)
     delete archiveFiles[i];
+  if (indexBuf)
+    delete indexBuf;
 }
 
 void BA2File::getFileList(std::vector< std::string >& fileList) const
 {
   fileList.clear();
-  for (std::map< std::string, FileDeclaration >::const_iterator
-           i = fileMap.begin(); i != fileMap.end(); i++)
+  std::string fileName;
+  for (size_t i = 0; i < fileDeclCnt; i++)
   {
-    fileList.push_back(i->first);
+    if (fileNameFilter.size() > 0 && !fileNameFilter[i])
+      continue;
+    fileName = getFileName(fileDeclTable[i]);
+    fileList.push_back(fileName);
   }
+  std::sort(fileList.begin(), fileList.end());
 }
 
-long BA2File::getFileSize(const std::string& fileName, bool packedSize) const
+long BA2File::getFileSize(const char *fileName, size_t nameLen,
+                          bool packedSize) const
 {
-  std::map< std::string, FileDeclaration >::const_iterator  i =
-      fileMap.find(fileName);
-  if (i == fileMap.end())
+  const FileDeclaration *fd = findFile(fileName, nameLen);
+  if (!fd)
     return -1L;
-  const FileDeclaration&  fd = i->second;
-  if (packedSize && fd.packedSize)
-    return long(fd.packedSize);
-  if (fd.archiveType & 0x40000000)      // compressed BSA
+  if (packedSize && fd->packedSize)
+    return long(fd->packedSize);
+  if (fd->archiveType & 0x40000100)     // BSA with compression or full names
   {
-    const unsigned char *p = fd.fileData;
-    return long(getBSAUnpackedSize(p, fd));
+    const unsigned char *p = getFileData(*fd);
+    return long(getBSAUnpackedSize(p, *fd));
   }
-  return long(fd.unpackedSize);
+  return long(fd->unpackedSize);
 }
 
-int BA2File::extractBA2Texture(std::vector< unsigned char >& buf,
-                               const FileDeclaration& fileDecl,
-                               int mipOffset) const
+int BA2File::getBA2TextureBlocks(std::vector< DataBlock >& dataBlocks,
+                                 unsigned char *ddsHeader,
+                                 const FileDeclaration& fileDecl,
+                                 int mipOffset) const
 {
   FileBuffer  fileBuf(archiveFiles[fileDecl.archiveFile]->getDataPtr(),
                       archiveFiles[fileDecl.archiveFile]->size());
-  const unsigned char *p = fileDecl.fileData;
+  const unsigned char *p = getFileData(fileDecl);
   size_t  chunkCnt = p[0];
   unsigned int  width = ((unsigned int) p[6] << 8) | p[5];
   unsigned int  height = ((unsigned int) p[4] << 8) | p[3];
   int     mipCnt = p[7];
   unsigned char dxgiFormat = p[8];
+  bool    isCubeMap = bool(p[9] & 1);
+  int     blockSize = getDXGIBlockSize(dxgiFormat);
   size_t  offs = size_t(p - fileBuf.getDataPtr()) + 11;
-  buf.resize(148);
   for ( ; chunkCnt-- > 0; offs = offs + 24)
   {
     fileBuf.setPosition(offs);
@@ -593,8 +985,7 @@ int BA2File::extractBA2Texture(std::vector< unsigned char >& buf,
     size_t  chunkSizeUnpacked = fileBuf.readUInt32Fast();
     int     chunkMipCnt = fileBuf.readUInt16Fast();
     chunkMipCnt = int(fileBuf.readUInt16Fast()) + 1 - chunkMipCnt;
-    if (chunkMipCnt > 0 &&
-        (chunkMipCnt < mipOffset || (chunkMipCnt == mipOffset && chunkCnt > 0)))
+    if (chunkMipCnt > 0 && chunkMipCnt <= mipOffset && chunkCnt > 0)
     {
       do
       {
@@ -607,35 +998,50 @@ int BA2File::extractBA2Texture(std::vector< unsigned char >& buf,
     }
     else
     {
-      extractBlock(buf, chunkSizeUnpacked, fileDecl,
-                   fileBuf.getDataPtr() + chunkOffset, chunkSizePacked);
+      // mip levels at the beginning of the chunk can be discarded while
+      // decompressing it, at least one level is kept
+      size_t  skipSize = 0;
+      for ( ; mipOffset > 0 && chunkMipCnt > 1 && blockSize && !isCubeMap;
+            mipOffset--, chunkMipCnt--)
+      {
+        skipSize = skipSize + getMipLevelSize(width, height, blockSize);
+        width = (width + 1) >> 1;
+        height = (height + 1) >> 1;
+        mipCnt--;
+      }
+      if (skipSize >= chunkSizeUnpacked && skipSize > 0)
+        errorMessage("invalid BA2 texture chunk size");
+      dataBlocks.push_back(DataBlock(fileBuf.getDataPtr() + chunkOffset,
+                                     (unsigned int) chunkSizePacked,
+                                     (unsigned int) chunkSizeUnpacked,
+                                     (unsigned int) skipSize));
     }
   }
-  // write DDS header
-  unsigned int  pitch = width;
-  bool    compressedTexture = true;
+  writeDDSHeader(ddsHeader, width, height, mipCnt, dxgiFormat);
+  // return the remaining number of mip levels to be skipped
+  return mipOffset;
+}
+
+int BA2File::getDXGIBlockSize(unsigned char dxgiFormat)
+{
   switch (dxgiFormat)
   {
     case 0x3D:                  // DXGI_FORMAT_R8_UNORM
-      compressedTexture = false;
-      break;
+      return -1;
     case 0x1B:                  // DXGI_FORMAT_R8G8B8A8_TYPELESS
     case 0x1C:                  // DXGI_FORMAT_R8G8B8A8_UNORM
     case 0x1D:                  // DXGI_FORMAT_R8G8B8A8_UNORM_SRGB
     case 0x57:                  // DXGI_FORMAT_B8G8R8A8_UNORM
     case 0x5A:                  // DXGI_FORMAT_B8G8R8A8_TYPELESS
     case 0x5B:                  // DXGI_FORMAT_B8G8R8A8_UNORM_SRGB
-      pitch = width << 2;
-      compressedTexture = false;
-      break;
+      return -4;
     case 0x46:                  // DXGI_FORMAT_BC1_TYPELESS
     case 0x47:                  // DXGI_FORMAT_BC1_UNORM
     case 0x48:                  // DXGI_FORMAT_BC1_UNORM_SRGB
     case 0x4F:                  // DXGI_FORMAT_BC4_TYPELESS
     case 0x50:                  // DXGI_FORMAT_BC4_UNORM
     case 0x51:                  // DXGI_FORMAT_BC4_SNORM
-      pitch = (((width + 3) >> 2) * ((height + 3) >> 2)) << 3;
-      break;
+      return 8;
     case 0x49:                  // DXGI_FORMAT_BC2_TYPELESS
     case 0x4A:                  // DXGI_FORMAT_BC2_UNORM
     case 0x4B:                  // DXGI_FORMAT_BC2_UNORM_SRGB
@@ -651,12 +1057,26 @@ int BA2File::extractBA2Texture(std::vector< unsigned char >& buf,
     case 0x61:                  // DXGI_FORMAT_BC7_TYPELESS
     case 0x62:                  // DXGI_FORMAT_BC7_UNORM
     case 0x63:                  // DXGI_FORMAT_BC7_UNORM_SRGB
-      pitch = (((width + 3) >> 2) * ((height + 3) >> 2)) << 4;
-      break;
-    default:
-      throw FO76UtilsError("unsupported DXGI_FORMAT 0x%02X",
-                           (unsigned int) dxgiFormat);
+      return 16;
+  }
+  return 0;
+}
+
+void BA2File::writeDDSHeader(unsigned char *buf,
+                             unsigned int width, unsigned int height,
+                             int mipCnt, unsigned char dxgiFormat)
+{
+  int     blockSize = getDXGIBlockSize(dxgiFormat);
+  if (!blockSize)
+  {
+    throw FO76UtilsError("unsupported DXGI_FORMAT 0x%02X",
+                         (unsigned int) dxgiFormat);
   }
+  bool    compressedTexture = (blockSize > 0);
+  unsigned int  pitch = width * (unsigned int) (-blockSize);
+  if (compressedTexture)
+    pitch = (unsigned int) getMipLevelSize(width, height, blockSize);
+  std::memset(buf, 0, 148);
   buf[0] = 0x44;                // 'D'
   buf[1] = 0x44;                // 'D'
   buf[2] = 0x53;                // 'S'
@@ -691,6 +1111,22 @@ int BA2File::extractBA2Texture(std::vector< unsigned char >& buf,
   buf[110] = 0x40;              // DDSCAPS_MIPMAP
   buf[128] = dxgiFormat;        // DXGI_FORMAT
   buf[132] = 3;                 // D3D10_RESOURCE_DIMENSION_TEXTURE2D
+}
+
+int BA2File::extractBA2Texture(std::vector< unsigned char >& buf,
+                               const FileDeclaration& fileDecl,
+                               int mipOffset) const
+{
+  std::vector< DataBlock >  dataBlocks;
+  buf.resize(148);
+  mipOffset = getBA2TextureBlocks(dataBlocks, &(buf.front()),
+                                  fileDecl, mipOffset);
+  for (size_t i = 0; i < dataBlocks.size(); i++)
+  {
+    extractBlock(buf, dataBlocks[i].unpackedSize, fileDecl,
+                 dataBlocks[i].p, dataBlocks[i].packedSize,
+                 dataBlocks[i].skipSize);
+  }
   // return the remaining number of mip levels to be skipped
   return mipOffset;
 }
@@ -698,87 +1134,450 @@ int BA2File::extractBA2Texture(std::vector< unsigned char >& buf,
 void BA2File::extractBlock(
     std::vector< unsigned char >& buf, unsigned int unpackedSize,
     const FileDeclaration& fileDecl,
-    const unsigned char *p, unsigned int packedSize) const
+    const unsigned char *p, unsigned int packedSize,
+    unsigned int skipSize) const
 {
   size_t  n = buf.size();
-  buf.resize(n + unpackedSize);
+  buf.resize(n + (unpackedSize - skipSize));
   const FileBuffer& fileBuf = *(archiveFiles[fileDecl.archiveFile]);
   size_t  offs = size_t(p - fileBuf.getDataPtr());
   if (!packedSize)
   {
     if (offs >= fileBuf.size() || (offs + unpackedSize) > fileBuf.size())
       errorMessage("invalid packed data offset or size");
-    std::memcpy(&(buf.front()) + n, p, unpackedSize);
+    std::memcpy(&(buf.front()) + n, p + skipSize, unpackedSize - skipSize);
   }
   else
   {
     if (offs >= fileBuf.size() || (offs + packedSize) > fileBuf.size())
       errorMessage("invalid packed data offset or size");
-    if (ZLibDecompressor::decompressData(&(buf.front()) + n, unpackedSize,
-                                         p, packedSize) != unpackedSize)
+    if (!skipSize)
+    {
+      if (ZLibDecompressor::decompressData(&(buf.front()) + n, unpackedSize,
+                                           p, packedSize) != unpackedSize)
+      {
+        errorMessage("invalid or corrupt ZLib compressed data");
+      }
+      return;
+    }
+    // decompress incrementally, and store only the data after skipSize
+    ZLibStreamDecompressor  zlibStream(p, packedSize, unpackedSize);
+    const unsigned char *dataPtr = (unsigned char *) 0;
+    size_t  bytesLeft = unpackedSize;
+    size_t  len;
+    while ((len = zlibStream.decompressChunk(dataPtr)) > 0)
     {
+      bytesLeft = bytesLeft - len;
+      if (skipSize >= len)
+      {
+        skipSize = skipSize - (unsigned int) len;
+        continue;
+      }
+      std::memcpy(&(buf.front()) + n, dataPtr + skipSize, len - skipSize);
+      n = n + (len - skipSize);
+      skipSize = 0;
+    }
+    if (bytesLeft)
       errorMessage("invalid or corrupt ZLib compressed data");
+  }
+}
+
+size_t BA2File::skipDDSMipLevels(unsigned char *hdr, size_t hdrSize,
+                                 size_t dataSize, int& mipOffset)
+{
+  if (FileBuffer::readUInt32Fast(hdr) != 0x20534444U ||         // "DDS "
+      FileBuffer::readUInt32Fast(hdr + 4) != 124U)
+  {
+    return 0;
+  }
+  unsigned int  flags = FileBuffer::readUInt32Fast(hdr + 8);
+  unsigned int  height = FileBuffer::readUInt32Fast(hdr + 12);
+  unsigned int  width = FileBuffer::readUInt32Fast(hdr + 16);
+  unsigned int  mipCnt = FileBuffer::readUInt32Fast(hdr + 28);
+  unsigned int  formatFlags = FileBuffer::readUInt32Fast(hdr + 80);
+  unsigned int  fourCC = FileBuffer::readUInt32Fast(hdr + 84);
+  if (!(flags & 0x00020000) || mipCnt < 2 || mipCnt > 16 ||
+      width < 1 || width > 32768 || height < 1 || height > 32768 ||
+      (FileBuffer::readUInt32Fast(hdr + 112) & 0x0200))  // cube map
+  {
+    return 0;
+  }
+  int     blockSize = 0;
+  size_t  dataOffs = 128;
+  if (!(formatFlags & 0x04))            // DDPF_FOURCC
+  {
+    unsigned int  bitCnt = FileBuffer::readUInt32Fast(hdr + 88);
+    if ((formatFlags & 0x40) && (bitCnt == 8 || bitCnt == 16 ||
+                                 bitCnt == 24 || bitCnt == 32))
+    {
+      blockSize = -int(bitCnt >> 3);
     }
   }
+  else if (FileBuffer::checkType(fourCC, "DX10"))
+  {
+    dataOffs = 148;
+    if (FileBuffer::readUInt32Fast(hdr + 132) == 3 &&   // TEXTURE2D
+        !(FileBuffer::readUInt32Fast(hdr + 136) & 4) && // not a cube map
+        FileBuffer::readUInt32Fast(hdr + 140) <= 1)     // array size
+    {
+      unsigned int  dxgiFormat = FileBuffer::readUInt32Fast(hdr + 128);
+      if (dxgiFormat < 256U)
+        blockSize = getDXGIBlockSize((unsigned char) dxgiFormat);
+    }
+  }
+  else if (FileBuffer::checkType(fourCC, "DXT1") ||
+           FileBuffer::checkType(fourCC, "BC4U") ||
+           FileBuffer::checkType(fourCC, "BC4S"))
+  {
+    blockSize = 8;
+  }
+  else if (FileBuffer::checkType(fourCC, "DXT2") ||
+           FileBuffer::checkType(fourCC, "DXT3") ||
+           FileBuffer::checkType(fourCC, "DXT4") ||
+           FileBuffer::checkType(fourCC, "DXT5") ||
+           FileBuffer::checkType(fourCC, "BC5U") ||
+           FileBuffer::checkType(fourCC, "BC5S"))
+  {
+    blockSize = 16;
+  }
+  if (!blockSize || dataOffs != hdrSize)
+    return 0;
+  size_t  skipSize = 0;
+  for ( ; mipOffset > 0 && mipCnt > 1; mipOffset--, mipCnt--)
+  {
+    size_t  n = skipSize + getMipLevelSize(width, height, blockSize);
+    // the file cannot be shorter than a DX10 header
+    if ((dataSize - std::min(n, dataSize)) < (148 - hdrSize))
+      break;
+    skipSize = n;
+    width = (width + 1) >> 1;
+    height = (height + 1) >> 1;
+  }
+  // update the header for the remaining mip levels
+  unsigned int  pitch = width * (unsigned int) (-blockSize);
+  if (blockSize > 0)
+    pitch = (unsigned int) getMipLevelSize(width, height, blockSize);
+  for (int i = 0; i < 4; i++)
+  {
+    hdr[i + 12] = (unsigned char) ((height >> (i << 3)) & 0xFF);
+    hdr[i + 16] = (unsigned char) ((width >> (i << 3)) & 0xFF);
+    hdr[i + 28] = (unsigned char) ((mipCnt >> (i << 3)) & 0xFF);
+    if (flags & 0x00080008)             // DDSD_PITCH or DDSD_LINEARSIZE
+      hdr[i + 20] = (unsigned char) ((pitch >> (i << 3)) & 0xFF);
+  }
+  return skipSize;
 }
 
-void BA2File::extractFile(std::vector< unsigned char >& buf,
-                          const std::string& fileName) const
+int BA2File::extractDDSTexture(std::vector< unsigned char >& buf,
+                               const FileDeclaration& fileDecl,
+                               const unsigned char *p, unsigned int packedSize,
+                               unsigned int unpackedSize, int mipOffset) const
+{
+  const FileBuffer& fileBuf = *(archiveFiles[fileDecl.archiveFile]);
+  size_t  offs = size_t(p - fileBuf.getDataPtr());
+  if (offs >= fileBuf.size() || (offs + packedSize) > fileBuf.size())
+    errorMessage("invalid packed data offset or size");
+  ZLibStreamDecompressor  zlibStream(p, packedSize, unpackedSize);
+  buf.resize(unpackedSize);
+  unsigned char *wp = &(buf.front());
+  // the mip levels to be skipped are at [skipStart, skipStart + skipSize)
+  // in the uncompressed data, skipStart is the size of the DDS header
+  size_t  skipStart = 128;
+  size_t  skipSize = 0;
+  bool    haveHeader = false;
+  size_t  inPos = 0;
+  size_t  outPos = 0;
+  const unsigned char *dataPtr = (unsigned char *) 0;
+  size_t  len;
+  while ((len = zlibStream.decompressChunk(dataPtr)) > 0)
+  {
+    for (size_t endPos = inPos + len; inPos < endPos; )
+    {
+      size_t  n = endPos - inPos;
+      if (inPos < skipStart)
+      {
+        n = std::min(n, skipStart - inPos);
+        std::memcpy(wp + outPos, dataPtr, n);
+        outPos = outPos + n;
+        if ((inPos + n) == skipStart && !haveHeader)
+        {
+          if (skipStart == 128 &&
+              FileBuffer::checkType(FileBuffer::readUInt32Fast(wp + 84),
+                                    "DX10"))
+          {
+            skipStart = 148;
+          }
+          else
+          {
+            skipSize = skipDDSMipLevels(wp, skipStart,
+                                        unpackedSize - skipStart, mipOffset);
+            haveHeader = true;
+          }
+        }
+      }
+      else if (inPos < (skipStart + skipSize))
+      {
+        n = std::min(n, (skipStart + skipSize) - inPos);
+      }
+      else
+      {
+        std::memcpy(wp + outPos, dataPtr, n);
+        outPos = outPos + n;
+      }
+      inPos = inPos + n;
+      dataPtr = dataPtr + n;
+    }
+  }
+  if (inPos != unpackedSize)
+    errorMessage("invalid or corrupt ZLib compressed data");
+  buf.resize(outPos);
+  return mipOffset;
+}
+
+int BA2File::extractFileData(std::vector< unsigned char >& buf,
+                             const FileDeclaration& fileDecl,
+                             int mipOffset) const
 {
   buf.clear();
-  std::map< std::string, FileDeclaration >::const_iterator  i =
-      fileMap.find(fileName);
-  if (i == fileMap.end())
-    throw FO76UtilsError("file %s not found in archive", fileName.c_str());
-  const FileDeclaration&  fileDecl = i->second;
-  const unsigned char *p = fileDecl.fileData;
+  const unsigned char *p = getFileData(fileDecl);
   unsigned int  packedSize = fileDecl.packedSize;
   unsigned int  unpackedSize = fileDecl.unpackedSize;
   int     archiveType = fileDecl.archiveType;
   if (archiveType & 0x40000100)         // BSA with compression or full names
   {
     unpackedSize = getBSAUnpackedSize(p, fileDecl);
-    packedSize = packedSize - (unsigned int) (p - fileDecl.fileData);
+    if (packedSize)
+      packedSize = packedSize - (unsigned int) (p - getFileData(fileDecl));
   }
   if (!unpackedSize)
-    return;
+    return mipOffset;
   buf.reserve(unpackedSize);
 
   if (archiveType == 1)
+    return extractBA2Texture(buf, fileDecl, mipOffset);
+  if (mipOffset > 0 && packedSize && unpackedSize > 148U)
   {
-    (void) extractBA2Texture(buf, fileDecl);
-    return;
+    return extractDDSTexture(buf, fileDecl, p, packedSize, unpackedSize,
+                             mipOffset);
   }
 
   extractBlock(buf, unpackedSize, fileDecl, p, packedSize);
+  return mipOffset;
+}
+
+const unsigned char * BA2File::getUncompressedFileData(
+    size_t& fileSize, const FileDeclaration& fileDecl) const
+{
+  if (fileDecl.archiveType == 1 || fileDecl.packedSize)
+    return (unsigned char *) 0;
+  const unsigned char *p = getFileData(fileDecl);
+  unsigned int  unpackedSize = getBSAUnpackedSize(p, fileDecl);
+  const FileBuffer& fileBuf = *(archiveFiles[fileDecl.archiveFile]);
+  size_t  offs = size_t(p - fileBuf.getDataPtr());
+  if (offs > fileBuf.size() || (offs + unpackedSize) > fileBuf.size())
+    errorMessage("invalid packed data offset or size");
+  fileSize = unpackedSize;
+  return p;
+}
+
+void BA2File::extractFile(std::vector< unsigned char >& buf,
+                          const char *fileName, size_t nameLen) const
+{
+  const FileDeclaration *fd = findFile(fileName, nameLen);
+  if (!fd)
+  {
+    throw FO76UtilsError("file %s not found in archive",
+                         std::string(fileName, nameLen).c_str());
+  }
+  (void) extractFileData(buf, *fd, 0);
 }
 
 int BA2File::extractTexture(std::vector< unsigned char >& buf,
-                            const std::string& fileName, int mipOffset) const
+                            const char *fileName, size_t nameLen,
+                            int mipOffset) const
 {
-  buf.clear();
-  std::map< std::string, FileDeclaration >::const_iterator  i =
-      fileMap.find(fileName);
-  if (i == fileMap.end())
-    throw FO76UtilsError("file %s not found in archive", fileName.c_str());
-  const FileDeclaration&  fileDecl = i->second;
-  const unsigned char *p = fileDecl.fileData;
-  unsigned int  packedSize = fileDecl.packedSize;
-  unsigned int  unpackedSize = fileDecl.unpackedSize;
-  int     archiveType = fileDecl.archiveType;
-  if (archiveType & 0x40000100)         // BSA with compression or full names
+  const FileDeclaration *fd = findFile(fileName, nameLen);
+  if (!fd)
   {
-    unpackedSize = getBSAUnpackedSize(p, fileDecl);
-    packedSize = packedSize - (unsigned int) (p - fileDecl.fileData);
+    throw FO76UtilsError("file %s not found in archive",
+                         std::string(fileName, nameLen).c_str());
   }
-  if (!unpackedSize)
+  return extractFileData(buf, *fd, mipOffset);
+}
+
+size_t BA2File::extractFile(const unsigned char*& fileData,
+                            std::vector< unsigned char >& buf,
+                            const char *fileName, size_t nameLen) const
+{
+  const FileDeclaration *fd = findFile(fileName, nameLen);
+  if (!fd)
+  {
+    throw FO76UtilsError("file %s not found in archive",
+                         std::string(fileName, nameLen).c_str());
+  }
+  size_t  fileSize = 0;
+  fileData = getUncompressedFileData(fileSize, *fd);
+  if (fileData)
+    return fileSize;
+  (void) extractFileData(buf, *fd, 0);
+  if (buf.size() > 0)
+    fileData = &(buf.front());
+  return buf.size();
+}
+
+int BA2File::extractTexture(const unsigned char*& fileData, size_t& fileSize,
+                            std::vector< unsigned char >& buf,
+                            const char *fileName, size_t nameLen,
+                            int mipOffset) const
+{
+  const FileDeclaration *fd = findFile(fileName, nameLen);
+  if (!fd)
+  {
+    throw FO76UtilsError("file %s not found in archive",
+                         std::string(fileName, nameLen).c_str());
+  }
+  fileSize = 0;
+  fileData = getUncompressedFileData(fileSize, *fd);
+  if (fileData)
     return mipOffset;
-  buf.reserve(unpackedSize);
+  mipOffset = extractFileData(buf, *fd, mipOffset);
+  if (buf.size() > 0)
+    fileData = &(buf.front());
+  fileSize = buf.size();
+  return mipOffset;
+}
 
+void BA2File::FileReader::openFile(const char *fileName, size_t nameLen)
+{
+  fileDecl = ba2File.findFile(fileName, nameLen);
+  if (!fileDecl)
+  {
+    throw FO76UtilsError("file %s not found in archive",
+                         std::string(fileName, nameLen).c_str());
+  }
+  const unsigned char *p = ba2File.getFileData(*fileDecl);
+  unsigned int  packedSize = fileDecl->packedSize;
+  unsigned int  unpackedSize = fileDecl->unpackedSize;
+  int     archiveType = fileDecl->archiveType;
+  if (archiveType & 0x40000100)         // BSA with compression or full names
+  {
+    unpackedSize = ba2File.getBSAUnpackedSize(p, *fileDecl);
+    if (packedSize)
+    {
+      packedSize = packedSize
+                   - (unsigned int) (p - ba2File.getFileData(*fileDecl));
+    }
+  }
+  if (!unpackedSize)
+    return;
   if (archiveType == 1)
-    return extractBA2Texture(buf, fileDecl, mipOffset);
+  {
+    mipOffset = ba2File.getBA2TextureBlocks(dataBlocks, ddsHeader,
+                                            *fileDecl, mipOffset);
+    headerSize = 148;
+  }
+  else
+  {
+    dataBlocks.push_back(DataBlock(p, packedSize, unpackedSize));
+  }
+  const FileBuffer& fileBuf = *(ba2File.archiveFiles[fileDecl->archiveFile]);
+  fileSize = headerSize;
+  for (size_t i = 0; i < dataBlocks.size(); i++)
+  {
+    size_t  offs = size_t(dataBlocks[i].p - fileBuf.getDataPtr());
+    size_t  n = dataBlocks[i].packedSize;
+    if (!n)
+      n = dataBlocks[i].unpackedSize;
+    if (offs >= fileBuf.size() || (offs + n) > fileBuf.size())
+      errorMessage("invalid packed data offset or size");
+    fileSize = fileSize
+               + (dataBlocks[i].unpackedSize - dataBlocks[i].skipSize);
+  }
+}
 
-  extractBlock(buf, unpackedSize, fileDecl, p, packedSize);
-  return mipOffset;
+BA2File::FileReader::FileReader(const BA2File& archive,
+                                const char *fileName, size_t nameLen,
+                                int mipOffset)
+  : ba2File(archive),
+    fileDecl((FileDeclaration *) 0),
+    blockIndex(0),
+    fileSize(0),
+    blockBytesLeft(0),
+    skipSize(0),
+    zlibStream((ZLibStreamDecompressor *) 0),
+    headerSize(0),
+    mipOffset(mipOffset)
+{
+  openFile(fileName, nameLen);
 }
 
+BA2File::FileReader::FileReader(const BA2File& archive,
+                                const std::string& fileName, int mipOffset)
+  : ba2File(archive),
+    fileDecl((FileDeclaration *) 0),
+    blockIndex(0),
+    fileSize(0),
+    blockBytesLeft(0),
+    skipSize(0),
+    zlibStream((ZLibStreamDecompressor *) 0),
+    headerSize(0),
+    mipOffset(mipOffset)
+{
+  openFile(fileName.c_str(), fileName.length());
+}
+
+BA2File::FileReader::~FileReader()
+{
+  if (zlibStream)
+    delete zlibStream;
+}
+
+size_t BA2File::FileReader::readChunk(const unsigned char*& dataPtr)
+{
+  while (true)
+  {
+    if (zlibStream)
+    {
+      size_t  n = zlibStream->decompressChunk(dataPtr);
+      if (n)
+      {
+        blockBytesLeft = blockBytesLeft - n;
+        if (skipSize >= n)
+        {
+          skipSize = skipSize - n;
+          continue;
+        }
+        dataPtr = dataPtr + skipSize;
+        n = n - skipSize;
+        skipSize = 0;
+        return n;
+      }
+      delete zlibStream;
+      zlibStream = (ZLibStreamDecompressor *) 0;
+      if (blockBytesLeft)
+        errorMessage("invalid or corrupt ZLib compressed data");
+    }
+    if (headerSize)
+    {
+      size_t  n = headerSize;
+      headerSize = 0;
+      dataPtr = ddsHeader;
+      return n;
+    }
+    if (blockIndex >= dataBlocks.size())
+      break;
+    const DataBlock&  b = dataBlocks[blockIndex];
+    blockIndex++;
+    if (!b.unpackedSize)
+      continue;
+    if (!b.packedSize)
+    {
+      dataPtr = b.p + b.skipSize;
+      return (b.unpackedSize - b.skipSize);
+    }
+    zlibStream = new ZLibStreamDecompressor(b.p, b.packedSize, b.unpackedSize);
+    blockBytesLeft = b.unpackedSize;
+    skipSize = b.skipSize;
+  }
+  return 0;
+}
@@ -5,25 +5,57 @@
 #include "common.hpp"
 #include "filebuf.hpp"
 
+class ZLibStreamDecompressor;
+
 class BA2File
 {
  protected:
   struct FileDeclaration
   {
-    const unsigned char *fileData;
+    // offset of the file data (or BA2 texture header) in the archive
+    std::uint64_t dataOffset;
     unsigned int  packedSize;
     unsigned int  unpackedSize;
     // 0: BA2 general, 1: BA2 textures,
     // >= 103: BSA (version + flags, 0x40000000: compressed, 0x0100: full name)
     int           archiveType;
     unsigned int  archiveFile;
+    // offset of the '\0' terminated file name in the name buffer
+    std::uint32_t nameOffset;
+    std::uint32_t nameHash;
     inline FileDeclaration();
   };
-  std::map< std::string, FileDeclaration >  fileMap;
+  struct ArchiveFileInfo
+  {
+    std::string   fileName;
+    std::uint64_t fileSize;
+    std::int64_t  modTime;
+  };
+  // file declarations and names are stored in flat arrays, and looked up
+  // with an open addressing hash table of (fileDeclTable index + 1) values
+  std::vector< FileDeclaration >    fileDeclBuf;
+  std::vector< std::uint32_t >      fileHashTableBuf;
+  std::vector< char >   fileNameBuf;
   std::vector< FileBuffer * >       archiveFiles;
-  const std::vector< std::string >  *includePatternsPtr;
-  const std::vector< std::string >  *excludePatternsPtr;
-  const std::set< std::string > *fileNamesPtr;
+  std::vector< std::string >        includePatterns;
+  std::vector< std::string >        excludePatterns;
+  std::set< std::string >           fileNames;
+  // if true, the file list is not filtered while loading the archives,
+  // and the name patterns are checked once after loading instead, storing
+  // the results in fileNameFilter
+  bool          indexCacheMode;
+  // 1 for each file in fileDeclTable that matches the name patterns,
+  // empty if all files are included
+  std::vector< unsigned char >      fileNameFilter;
+  // memory mapped index cache, NULL if not used
+  FileBuffer    *indexBuf;
+  // pointers to either the data in the buffers above, or in indexBuf
+  const FileDeclaration *fileDeclTable;
+  const std::uint32_t   *fileHashTable;
+  const char    *fileNameData;
+  size_t        fileDeclCnt;
+  std::uint32_t fileHashMask;
+  static const std::uint32_t  indexCacheVersion = 2U;
   static inline char fixNameCharacter(unsigned char c)
   {
     if (c >= 'A' && c <= 'Z')
@@ -34,16 +66,57 @@ class BA2File
       return '/';
     return char(c);
   }
+  inline const unsigned char *getFileData(const FileDeclaration& fd) const
+  {
+    return (archiveFiles[fd.archiveFile]->getDataPtr() + fd.dataOffset);
+  }
+  static inline std::uint32_t hashFileName(const char *s, size_t n)
+  {
+    // FNV-1a
+    std::uint32_t h = 0x811C9DC5U;
+    for ( ; n-- > 0; s++)
+      h = (h ^ (unsigned char) *s) * 0x01000193U;
+    return h;
+  }
+  inline const char *getFileName(const FileDeclaration& fd) const
+  {
+    return (fileNameData + fd.nameOffset);
+  }
+  // returns true if fileName matches the include and exclude patterns
+  bool checkFileName(const std::string& fileName) const;
+  // the returned pointer is invalidated by the next call if fileDeclBuf
+  // needs to be reallocated
   FileDeclaration *addPackedFile(const std::string& fileName);
+  void resizeHashTable(size_t n);
+  void updateFileTablePointers();
   void loadBA2General(FileBuffer& buf, size_t archiveFile);
   void loadBA2Textures(FileBuffer& buf, size_t archiveFile);
   void loadBSAFile(FileBuffer& buf, size_t archiveFile, int archiveType);
   void loadFile(FileBuffer& buf, size_t archiveFile, const char *fileName);
-  void loadArchivesFromDir(const char *pathName);
+  void findArchivesInDir(std::vector< ArchiveFileInfo >& archives,
+                         const char *pathName);
+  void findArchives(std::vector< ArchiveFileInfo >& archives,
+                    const char *pathName);
   void loadArchiveFile(const char *fileName);
+  static bool getIndexCacheFileName(
+      std::string& cacheFileName,
+      const std::vector< ArchiveFileInfo >& archives);
+  // returns false if the cache file is missing or out of date
+  bool loadIndexCache(const char *cacheFileName,
+                      const std::vector< ArchiveFileInfo >& archives);
+  void saveIndexCache(const char *cacheFileName,
+                      const std::vector< ArchiveFileInfo >& archives) const;
+  // create fileNameFilter in index cache mode
+  void applyFileNameFilter();
+  void loadArchives(const std::vector< std::string >& pathNames);
+  // returns NULL if the file is not found
+  const FileDeclaration *findFile(const char *fileName, size_t nameLen) const;
   unsigned int getBSAUnpackedSize(const unsigned char*& dataPtr,
                                   const FileDeclaration& fd) const;
  public:
+  // If the environment variable FO76UTILS_CACHEPATH is set to a directory,
+  // the archive index is stored there, and is reused by later instances
+  // as long as the size and modification time of all archives match.
   BA2File(const char *pathName,
           const std::vector< std::string > *includePatterns = 0,
           const std::vector< std::string > *excludePatterns = 0,
@@ -56,23 +129,170 @@ class BA2File
   BA2File(const char *pathName, const char *includePatterns,
           const char *excludePatterns = 0, const char *fileNames = 0);
   virtual ~BA2File();
+  // the list is sorted by name
   void getFileList(std::vector< std::string >& fileList) const;
+  // The functions taking a name pointer and length look up the file without
+  // allocating memory, names are case sensitive and must use '/' separators.
   // returns -1 if the file is not found
-  long getFileSize(const std::string& fileName, bool packedSize = false) const;
+  long getFileSize(const char *fileName, size_t nameLen,
+                   bool packedSize = false) const;
+  inline long getFileSize(const std::string& fileName,
+                          bool packedSize = false) const
+  {
+    return getFileSize(fileName.c_str(), fileName.length(), packedSize);
+  }
  protected:
+  struct DataBlock
+  {
+    const unsigned char *p;
+    unsigned int  packedSize;           // 0 if not compressed
+    unsigned int  unpackedSize;
+    // number of bytes at the beginning of the uncompressed data to discard
+    unsigned int  skipSize;
+    DataBlock(const unsigned char *dataPtr,
+              unsigned int packedSize_, unsigned int unpackedSize_,
+              unsigned int skipSize_ = 0U)
+      : p(dataPtr),
+        packedSize(packedSize_),
+        unpackedSize(unpackedSize_),
+        skipSize(skipSize_)
+    {
+    }
+  };
+  // stores the chunks of a BA2 texture in dataBlocks and the 148 byte DDS
+  // header in ddsHeader, returns the remaining number of mip levels to skip
+  int getBA2TextureBlocks(std::vector< DataBlock >& dataBlocks,
+                          unsigned char *ddsHeader,
+                          const FileDeclaration& fileDecl,
+                          int mipOffset) const;
+  // returns the number of bytes per 4x4 block for compressed formats,
+  // -(bytes per pixel) for uncompressed formats, or 0 if not supported
+  static int getDXGIBlockSize(unsigned char dxgiFormat);
+  static inline size_t getMipLevelSize(unsigned int width, unsigned int height,
+                                       int blockSize)
+  {
+    if (blockSize < 0)
+      return (size_t(width) * height * size_t(-blockSize));
+    return (size_t((width + 3) >> 2) * ((height + 3) >> 2) * size_t(blockSize));
+  }
+  static void writeDDSHeader(unsigned char *buf,
+                             unsigned int width, unsigned int height,
+                             int mipCnt, unsigned char dxgiFormat);
   int extractBA2Texture(std::vector< unsigned char >& buf,
                         const FileDeclaration& fileDecl,
                         int mipOffset = 0) const;
   void extractBlock(std::vector< unsigned char >& buf,
                     unsigned int unpackedSize,
                     const FileDeclaration& fileDecl,
-                    const unsigned char *p, unsigned int packedSize) const;
+                    const unsigned char *p, unsigned int packedSize,
+                    unsigned int skipSize = 0U) const;
+  // Updates the DDS header in hdr (hdrSize = 128 or 148 bytes) for skipping
+  // up to mipOffset mip levels of dataSize bytes of texture data, and returns
+  // the number of bytes to be skipped, or 0 if the format is not supported
+  // or the texture is a cube map or array. mipOffset is decremented by the
+  // number of levels skipped.
+  static size_t skipDDSMipLevels(unsigned char *hdr, size_t hdrSize,
+                                 size_t dataSize, int& mipOffset);
+  // extracts a compressed DDS file from a BSA or BA2 general archive,
+  // without storing the mip levels to be skipped
+  int extractDDSTexture(std::vector< unsigned char >& buf,
+                        const FileDeclaration& fileDecl,
+                        const unsigned char *p, unsigned int packedSize,
+                        unsigned int unpackedSize, int mipOffset) const;
+  int extractFileData(std::vector< unsigned char >& buf,
+                      const FileDeclaration& fileDecl, int mipOffset) const;
+  // returns NULL if the file is compressed, or is a BA2 texture
+  const unsigned char *getUncompressedFileData(
+      size_t& fileSize, const FileDeclaration& fileDecl) const;
  public:
   void extractFile(std::vector< unsigned char >& buf,
-                   const std::string& fileName) const;
+                   const char *fileName, size_t nameLen) const;
+  inline void extractFile(std::vector< unsigned char >& buf,
+                          const std::string& fileName) const
+  {
+    extractFile(buf, fileName.c_str(), fileName.length());
+  }
   // returns the remaining number of mip levels to be skipped
   int extractTexture(std::vector< unsigned char >& buf,
-                     const std::string& fileName, int mipOffset = 0) const;
+                     const char *fileName, size_t nameLen,
+                     int mipOffset = 0) const;
+  inline int extractTexture(std::vector< unsigned char >& buf,
+                            const std::string& fileName,
+                            int mipOffset = 0) const
+  {
+    return extractTexture(buf, fileName.c_str(), fileName.length(), mipOffset);
+  }
+  // Zero-copy versions of extractFile() and extractTexture(): if the file is
+  // stored without compression, fileData is set to point to it in the memory
+  // mapped archive, which remains valid until the BA2File object is
+  // destroyed. Otherwise, the file is extracted to buf, and fileData is set
+  // to &(buf.front()).
+  // returns the size of the file
+  size_t extractFile(const unsigned char*& fileData,
+                     std::vector< unsigned char >& buf,
+                     const char *fileName, size_t nameLen) const;
+  inline size_t extractFile(const unsigned char*& fileData,
+                            std::vector< unsigned char >& buf,
+                            const std::string& fileName) const
+  {
+    return extractFile(fileData, buf, fileName.c_str(), fileName.length());
+  }
+  // returns the remaining number of mip levels to be skipped
+  int extractTexture(const unsigned char*& fileData, size_t& fileSize,
+                     std::vector< unsigned char >& buf,
+                     const char *fileName, size_t nameLen,
+                     int mipOffset = 0) const;
+  inline int extractTexture(const unsigned char*& fileData, size_t& fileSize,
+                            std::vector< unsigned char >& buf,
+                            const std::string& fileName,
+                            int mipOffset = 0) const
+  {
+    return extractTexture(fileData, fileSize, buf,
+                          fileName.c_str(), fileName.length(), mipOffset);
+  }
+  // Reads a file incrementally, without extracting all of it to memory.
+  // Compressed data is decompressed in chunks of up to 32 KB, uncompressed
+  // data is returned directly from the memory mapped archive.
+  class FileReader
+  {
+   protected:
+    const BA2File&  ba2File;
+    const FileDeclaration *fileDecl;
+    std::vector< DataBlock >  dataBlocks;
+    size_t  blockIndex;
+    size_t  fileSize;
+    // number of bytes not yet returned from the current compressed block
+    size_t  blockBytesLeft;
+    // number of bytes still to be discarded from the current block
+    size_t  skipSize;
+    ZLibStreamDecompressor  *zlibStream;
+    size_t  headerSize;
+    int     mipOffset;
+    unsigned char ddsHeader[148];
+    void openFile(const char *fileName, size_t nameLen);
+   public:
+    // mipOffset is the number of mip levels to skip if the file is a BA2
+    // texture, other files are always returned unmodified
+    FileReader(const BA2File& archive, const char *fileName, size_t nameLen,
+               int mipOffset = 0);
+    FileReader(const BA2File& archive, const std::string& fileName,
+               int mipOffset = 0);
+    virtual ~FileReader();
+    // returns the total size of the data that readChunk() will return
+    inline size_t size() const
+    {
+      return fileSize;
+    }
+    // returns the remaining number of mip levels to be skipped
+    inline int getMipOffset() const
+    {
+      return mipOffset;
+    }
+    // Sets dataPtr to the next part of the file, and returns its size, or 0
+    // at the end of the file. The data remains valid until the next call or
+    // the FileReader is destroyed. Reading can be stopped at any time.
+    size_t readChunk(const unsigned char*& dataPtr);
+  };
 };
 
 #endif
@@ -3,6 +3,9 @@
 #include "filebuf.hpp"
 #include "ba2file.hpp"
 
+#include <thread>
+#include <mutex>
+
 #if defined(_WIN32) || defined(_WIN64)
 #  include <direct.h>
 #else
@@ -52,7 +55,7 @@ static void loadFileList(std::set< std::string >& fileNames,
 }
 
 static void writeFileWithPath(const char *fileName,
-                              const std::vector< unsigned char >& buf)
+                              BA2File::FileReader& fileReader)
 {
   OutputFile  *f = (OutputFile *) 0;
   try
@@ -81,7 +84,11 @@ static void writeFileWithPath(const char *fileName,
   }
   try
   {
-    f->writeData(&(buf.front()), sizeof(unsigned char) * buf.size());
+    // large files are decompressed and written in chunks
+    const unsigned char *buf = (unsigned char *) 0;
+    size_t  bufSize;
+    while ((bufSize = fileReader.readChunk(buf)) > 0)
+      f->writeData(buf, sizeof(unsigned char) * bufSize);
   }
   catch (...)
   {
@@ -91,6 +98,86 @@ static void writeFileWithPath(const char *fileName,
   delete f;
 }
 
+struct UnpackQueue
+{
+  const BA2File *ba2File;
+  const std::vector< std::string >  *fileList;
+  // index of the next file to be extracted, or fileList->size() on error
+  size_t      nextFile;
+  std::mutex  queueMutex;
+};
+
+static void unpackFilesThread(UnpackQueue *q, std::string *errMsg)
+{
+  try
+  {
+    while (true)
+    {
+      size_t  n;
+      {
+        // file names are printed in the order of the list
+        std::lock_guard< std::mutex > queueLock(q->queueMutex);
+        n = q->nextFile;
+        if (n >= q->fileList->size())
+          break;
+        q->nextFile++;
+        std::printf("%s\t%8u bytes\n",
+                    (*(q->fileList))[n].c_str(),
+                    (unsigned int) q->ba2File->getFileSize(
+                                       (*(q->fileList))[n]));
+      }
+      const std::string&  fileName = (*(q->fileList))[n];
+      BA2File::FileReader fileReader(*(q->ba2File), fileName);
+      writeFileWithPath(fileName.c_str(), fileReader);
+    }
+  }
+  catch (std::exception& e)
+  {
+    *errMsg = std::string(e.what());
+    std::lock_guard< std::mutex > queueLock(q->queueMutex);
+    q->nextFile = q->fileList->size();
+  }
+}
+
+static void unpackFiles(const BA2File& ba2File,
+                        const std::vector< std::string >& fileList,
+                        int threadCnt)
+{
+  UnpackQueue q;
+  q.ba2File = &ba2File;
+  q.fileList = &fileList;
+  q.nextFile = 0;
+  std::vector< std::thread * >  threads(threadCnt, (std::thread *) 0);
+  std::vector< std::string >    errMsgs(threadCnt);
+  for (int i = 1; i < threadCnt; i++)
+  {
+    try
+    {
+      threads[i] = new std::thread(unpackFilesThread,
+                                   &q, &(errMsgs.front()) + i);
+    }
+    catch (std::exception& e)
+    {
+      errMsgs[i] = std::string(e.what());
+      break;
+    }
+  }
+  unpackFilesThread(&q, &(errMsgs.front()));
+  for (int i = 1; i < threadCnt; i++)
+  {
+    if (threads[i])
+    {
+      threads[i]->join();
+      delete threads[i];
+    }
+  }
+  for (int i = 0; i < threadCnt; i++)
+  {
+    if (!errMsgs[i].empty())
+      throw FO76UtilsError(1, errMsgs[i].c_str());
+  }
+}
+
 int main(int argc, char **argv)
 {
   try
@@ -99,16 +186,28 @@ int main(int argc, char **argv)
     std::set< std::string > namesFound;
     std::vector< std::string >  includePatterns;
     std::vector< std::string >  excludePatterns;
+    int     threadCnt = 1;
     int     archiveCnt = argc - 1;
     bool    extractingFiles = false;
     bool    listPackedSizes = false;
-    for (int i = 1; i < argc; i++)
+    int     firstArchive = 1;
+    while (firstArchive < argc &&
+           std::strcmp(argv[firstArchive], "-threads") == 0)
+    {
+      if (++firstArchive >= argc)
+        errorMessage("missing argument for -threads");
+      threadCnt = int(parseInteger(argv[firstArchive], 10,
+                                   "invalid thread count", 1, 64));
+      firstArchive++;
+      archiveCnt = argc - firstArchive;
+    }
+    for (int i = firstArchive; i < argc; i++)
     {
       if (std::strcmp(argv[i], "--") == 0 ||
           std::strcmp(argv[i], "--list") == 0 ||
           std::strcmp(argv[i], "--list-packed") == 0)
       {
-        archiveCnt = i - 1;
+        archiveCnt = i - firstArchive;
         extractingFiles = (argv[i][2] == '\0');
         if (!extractingFiles)
           listPackedSizes = (argv[i][6] != '\0');
@@ -169,12 +268,15 @@ int main(int argc, char **argv)
                            "any string not including\n");
       std::fprintf(stderr, "    at least one /, \\, or . character "
                            "is ignored\n");
+      std::fprintf(stderr, "%s -threads N ARCHIVES... -- ...\n", argv[0]);
+      std::fprintf(stderr, "    Extract files using N threads "
+                           "(default: 1, maximum: 64)\n");
       return 1;
     }
 
     if (!extractingFiles)
     {
-      for (int i = 1; i <= archiveCnt; i++)
+      for (int i = firstArchive; i < (firstArchive + archiveCnt); i++)
       {
         BA2File ba2File(argv[i],
                         &includePatterns, &excludePatterns, &fileNames);
@@ -196,23 +298,18 @@ int main(int argc, char **argv)
     else
     {
       std::vector< std::string >  archivePaths;
-      for (int i = archiveCnt; i >= 1; i--)
+      for (int i = firstArchive + archiveCnt; i-- > firstArchive; )
         archivePaths.push_back(std::string(argv[i]));
       BA2File ba2File(archivePaths,
                       &includePatterns, &excludePatterns, &fileNames);
       std::vector< std::string >  fileList;
       ba2File.getFileList(fileList);
-      std::vector< unsigned char >  outBuf;
       for (size_t i = 0; i < fileList.size(); i++)
       {
         if (fileNames.find(fileList[i]) != fileNames.end())
           namesFound.insert(fileList[i]);
-        std::printf("%s\t%8u bytes\n",
-                    fileList[i].c_str(),
-                    (unsigned int) ba2File.getFileSize(fileList[i]));
-        ba2File.extractFile(outBuf, fileList[i]);
-        writeFileWithPath(fileList[i].c_str(), outBuf);
       }
+      unpackFiles(ba2File, fileList, threadCnt);
     }
     if (namesFound.size() != fileNames.size())
     {
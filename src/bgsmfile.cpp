@@ -272,8 +272,9 @@ void BGSMFile::loadBGSMFile(std::vector< std::string >& texturePaths,
                             const BA2File& ba2File, const std::string& fileName)
 {
   std::vector< unsigned char >  tmpBuf;
-  ba2File.extractFile(tmpBuf, fileName);
-  FileBuffer  buf(&(tmpBuf.front()), tmpBuf.size());
+  const unsigned char *fileData = (unsigned char *) 0;
+  size_t  fileSize = ba2File.extractFile(fileData, tmpBuf, fileName);
+  FileBuffer  buf(fileData, fileSize);
   loadBGSMFile(texturePaths, buf);
 }
 
@@ -35,6 +35,9 @@ void vertexNormals(DDSOutputFile& outFile, BTDFile& btdFile,
       int     cellY = yMax - ((y >> m) + (!y ? 0 : 1));
       if (cellY >= yMin)
       {
+        int     tileY = (cellY - btdFile.getCellMinY()) & 7;
+        if (cellY == yMax || tileY == 7)
+          btdFile.prefetchCells(xMin, cellY - tileY, xMax, cellY, 1U, l);
         for (int cellX = xMin; cellX <= xMax; cellX++)
         {
           std::uint16_t *srcPtr = &(cellBuf.front());
@@ -286,6 +289,12 @@ int main(int argc, char **argv)
     int     y0 = yMax;
     int     x = xMin;
     int     y = yMax;
+    // data used by each output format for prefetchCells()
+    static const unsigned char  outFmtDataMasks[12] =
+    {
+      1, 0, 2, 2, 4, 4, 8, 8, 0, 0, 2, 4
+    };
+    btdFile.setTileCacheSize(size_t((((xMax + 1 - xMin) + 7) >> 3) + 1));
     while (true)
     {
       size_t  w = size_t(xMax + 1 - xMin);
@@ -295,6 +304,11 @@ int main(int argc, char **argv)
         if (h > size_t(y0 + 1 - yMin))
           h = size_t(y0 + 1 - yMin);
         outBuf.resize(w * h * (outFmtDataSizes[outFmt] << (m << 1)), 0);
+        if (outFmtDataMasks[outFmt])
+        {
+          btdFile.prefetchCells(xMin, y0 + 1 - int(h), xMax, y0,
+                                outFmtDataMasks[outFmt], l);
+        }
       }
       size_t  cellBufSize = 16384 >> (l + l);
       switch (outFmt)
@@ -104,14 +104,28 @@ void BTDFile::loadBlock(TileData& tileData, size_t dataOffs,
   {
     errorMessage("error in compressed landscape data");
   }
-  size_t  xd = 1 << (b == 0 || l == 0 ? l : (l - 2));
-  size_t  yd = (b == 0 || l == 0 ? (1024 - 128) : ((256 - 128) >> 2)) << l;
+  // w = width of the output buffer,
+  // k = level of detail relative to the resolution of the buffer
+  size_t  w = 1024;
+  unsigned char k = 0;
+  if (b == 0)
+  {
+    w = 1024 >> tileData.hmapLOD;
+    k = l - tileData.hmapLOD;
+  }
+  else if (l != 0)
+  {
+    w = 256 >> (tileData.vclrLOD - 2);
+    k = l - tileData.vclrLOD;
+  }
+  size_t  xd = size_t(1) << k;
+  size_t  yd = (w - 128) << k;
   for (size_t y = 0; y < 128; y = y + 2)
   {
     if (b == 0)                 // vertex height
     {
       loadBlockLines_16(&(tileData.hmapData.front())
-                        + dataOffs + (y << (l + 10)), p, xd, yd);
+                        + dataOffs + ((y << k) * w), p, xd, yd);
       p = p + 384;
     }
     else if (l == 0)            // ground cover
@@ -122,7 +136,7 @@ void BTDFile::loadBlock(TileData& tileData, size_t dataOffs,
     else                        // vertex color
     {
       loadBlockLines_16(&(tileData.vclrData.front())
-                        + dataOffs + (y << (l + 6)), p, xd, yd);
+                        + dataOffs + ((y << k) * w), p, xd, yd);
       p = p + 384;
     }
   }
@@ -132,17 +146,17 @@ void BTDFile::loadBlock(TileData& tileData, size_t dataOffs,
   {
     // landscape textures
     loadBlockLines_16(&(tileData.ltexData.front())
-                      + dataOffs + (y << (l + 10)), p, xd, yd);
+                      + dataOffs + ((y << k) * w), p, xd, yd);
     p = p + 384;
   }
 }
 
-void BTDFile::loadBlocks(TileData& tileData, size_t x, size_t y,
-                         size_t threadIndex, size_t threadCnt,
-                         unsigned int blockMask)
+void BTDFile::queueBlocks(TileData& tileData, unsigned int blockMask)
 {
-  std::vector< std::uint16_t >  zlibBuf(0x6000, 0);
-  size_t  t = 0;
+  size_t  x = tileData.x0;
+  size_t  y = tileData.y0;
+  BlockTask tmp;
+  tmp.tileData = &tileData;
   // LOD3..LOD0
   for (unsigned char l = 4; l-- > 0; )
   {
@@ -156,140 +170,388 @@ void BTDFile::loadBlocks(TileData& tileData, size_t x, size_t y,
         size_t  xc = (x >> l) + xx;
         if (xc >= ((nCellsX + (1 << l) - 1) >> l))
           break;
-        if (t == threadIndex)
+        tmp.n = yc * ((nCellsX + (1 << l) - 1) >> l) + xc;
+        tmp.l = l;
+        if ((blockMask & 0x55) & (1 << (l + l)))
         {
-          size_t  n = yc * ((nCellsX + (1 << l) - 1) >> l) + xc;
-          if ((blockMask & 0x55) & (1 << (l + l)))
-            loadBlock(tileData, ((yy << 10) + xx) << (l + 7), n, l, 0, zlibBuf);
-          if ((blockMask & 0xA0) & (1 << (l + l + 1)))
-            loadBlock(tileData, ((yy << 8) + xx) << (l + 5), n, l, 1, zlibBuf);
-          if ((blockMask & 0x02) & (1 << (l + l + 1)))
-            loadBlock(tileData, ((yy << 10) + xx) << (l + 7), n, l, 1, zlibBuf);
+          unsigned char s = tileData.hmapLOD;
+          tmp.dataOffs = ((yy << (10 - s)) + xx) << (l + 7 - s);
+          tmp.b = 0;
+          taskQueue.push_back(tmp);
+        }
+        if ((blockMask & 0xA0) & (1 << (l + l + 1)))
+        {
+          unsigned char s = tileData.vclrLOD - 2;
+          tmp.dataOffs = ((yy << (8 - s)) + xx) << (l + 5 - s);
+          tmp.b = 1;
+          taskQueue.push_back(tmp);
+        }
+        if ((blockMask & 0x02) & (1 << (l + l + 1)))
+        {
+          tmp.dataOffs = ((yy << 10) + xx) << (l + 7);
+          tmp.b = 1;
+          taskQueue.push_back(tmp);
         }
-        if (++t >= threadCnt)
-          t = 0;
       }
     }
   }
 }
 
-void BTDFile::loadBlocksThread(BTDFile *p, std::string *errMsg,
-                               TileData *tileData, size_t x, size_t y,
-                               size_t threadIndex, size_t threadCnt,
-                               unsigned int blockMask)
+void BTDFile::runTask(const BlockTask& task,
+                      std::vector< std::uint16_t >& zlibBuf)
 {
   try
   {
-    p->loadBlocks(*tileData, x, y, threadIndex, threadCnt, blockMask);
+    loadBlock(*(task.tileData), task.dataOffs, task.n, task.l, task.b,
+              zlibBuf);
   }
   catch (std::exception& e)
   {
-    *errMsg = std::string(e.what());
+    std::lock_guard< std::mutex > poolLock(threadPoolMutex);
+    if (threadErrMsg.empty())
+    {
+      threadErrMsg = e.what();
+      if (threadErrMsg.empty())
+        threadErrMsg = "unknown error in BTDFile worker thread";
+    }
+    // skip the remaining tasks
+    taskQueuePos = taskQueue.size();
   }
 }
 
-const BTDFile::TileData& BTDFile::loadTile(int cellX, int cellY,
-                                           unsigned int blockMask)
+void BTDFile::threadFunction(BTDFile *p)
 {
-  unsigned int  x0 = (unsigned int) (cellX - cellMinX) & 0xFFF8U;
-  unsigned int  y0 = (unsigned int) (cellY - cellMinY) & 0xFFF8U;
-  unsigned int  cacheKey = (y0 << 16) | x0;
-  std::map< unsigned int, TileData * >::iterator  t =
-      tileCacheMap.find(cacheKey);
-  if (t == tileCacheMap.end())
+  std::vector< std::uint16_t >  zlibBuf(0x6000, 0);
+  std::unique_lock< std::mutex >  poolLock(p->threadPoolMutex);
+  while (!p->threadPoolStopFlag)
   {
-    TileData& tmp = tileCache[tileCacheIndex];
-    t = tileCacheMap.find(((unsigned int) tmp.y0 << 16) | tmp.x0);
-    if (t != tileCacheMap.end())
-      tileCacheMap.erase(t);
-    tmp.x0 = (unsigned short) x0;
-    tmp.y0 = (unsigned short) y0;
-    tmp.blockMask = 0U;
-    t = tileCacheMap.insert(std::pair< unsigned int, TileData * >(
-                                cacheKey, &tmp)).first;
-    tileCacheIndex++;
-    if (tileCacheIndex >= tileCache.size())
-      tileCacheIndex = 0;
+    if (p->taskQueuePos >= p->taskQueue.size())
+    {
+      p->threadPoolCond.wait(poolLock);
+      continue;
+    }
+    BlockTask task = p->taskQueue[p->taskQueuePos];
+    p->taskQueuePos++;
+    p->tasksRunning++;
+    poolLock.unlock();
+    p->runTask(task, zlibBuf);
+    poolLock.lock();
+    if (!(--(p->tasksRunning)))
+      p->tasksDoneCond.notify_all();
   }
-  TileData& tileData = *(t->second);
-  blockMask = (blockMask & ~(tileData.blockMask)) & 0x03F7;
-  if (!blockMask)
-    return tileData;
+}
 
-  if (blockMask & 0x0155)
+void BTDFile::runTaskQueue()
+{
+  if (taskQueue.size() < 1)
+    return;
+  if (taskQueue.size() > 1 && threads.size() < 1)
   {
-    tileData.hmapData.resize(0x00100000);
-    tileData.ltexData.resize(0x00100000);
+    size_t  threadCnt = size_t(std::thread::hardware_concurrency());
+    threadCnt = std::min< size_t >(std::max< size_t >(threadCnt, 1), 16);
+    // the main thread also runs tasks
+    for (size_t i = 1; i < threadCnt; i++)
+    {
+      threads.push_back((std::thread *) 0);
+      threads.back() = new std::thread(threadFunction, this);
+    }
+  }
+  std::vector< std::uint16_t >  zlibBuf(0x6000, 0);
+  std::unique_lock< std::mutex >  poolLock(threadPoolMutex);
+  threadErrMsg.clear();
+  taskQueuePos = 0;
+  threadPoolCond.notify_all();
+  while (true)
+  {
+    if (taskQueuePos < taskQueue.size())
+    {
+      BlockTask task = taskQueue[taskQueuePos];
+      taskQueuePos++;
+      tasksRunning++;
+      poolLock.unlock();
+      runTask(task, zlibBuf);
+      poolLock.lock();
+      tasksRunning--;
+    }
+    else if (tasksRunning)
+    {
+      tasksDoneCond.wait(poolLock);
+    }
+    else
+    {
+      break;
+    }
   }
+  taskQueue.clear();
+  taskQueuePos = 0;
+  if (!threadErrMsg.empty())
+    throw FO76UtilsError(1, threadErrMsg.c_str());
+}
+
+void BTDFile::stopThreadPool()
+{
+  {
+    std::lock_guard< std::mutex > poolLock(threadPoolMutex);
+    threadPoolStopFlag = true;
+    threadPoolCond.notify_all();
+  }
+  for (size_t i = 0; i < threads.size(); i++)
+  {
+    if (threads[i])
+    {
+      threads[i]->join();
+      delete threads[i];
+    }
+  }
+  threads.clear();
+  threadPoolStopFlag = false;
+}
+
+unsigned int BTDFile::getBlockMask(unsigned int dataMask, unsigned char l)
+{
+  unsigned int  blockMask = 0U;
+  if (dataMask & 3U)
+    blockMask = (~0U << (l + l)) & 0x0155U;
+  if (dataMask & 4U)
+    blockMask = blockMask | 0x0002U;
+  if (dataMask & 8U)
+    blockMask = blockMask | ((~0U << (l + l)) & 0x02A0U);
+  return blockMask;
+}
+
+size_t BTDFile::TileData::getDataSize() const
+{
+  return (hmapData.capacity() * sizeof(std::uint16_t)
+          + ltexData.capacity() * sizeof(std::uint16_t)
+          + gcvrData.capacity() * sizeof(unsigned char)
+          + vclrData.capacity() * sizeof(std::uint16_t));
+}
+
+void BTDFile::loadTiles(const std::vector< unsigned int >& tileKeys,
+                        unsigned int blockMask)
+{
+  blockMask = blockMask & 0x03F7;
+  // lowest level of detail requested
+  unsigned char hmapLOD = 0;
+  unsigned char vclrLOD = 2;
+  while (hmapLOD < 4 && !(blockMask & (1U << (hmapLOD << 1))))
+    hmapLOD++;
+  while (vclrLOD < 4 && !(blockMask & (2U << (vclrLOD << 1))))
+    vclrLOD++;
+  size_t  tileDataSize = 0;
+  if (blockMask & 0x0155)
+    tileDataSize = size_t(0x00400000) >> (hmapLOD << 1);
   if (blockMask & 0x0002)
-    tileData.gcvrData.resize(0x00100000);
+    tileDataSize = tileDataSize + 0x00100000;
   if (blockMask & 0x02A0)
-    tileData.vclrData.resize(0x00010000);
+    tileDataSize = tileDataSize + (size_t(0x00020000) >> ((vclrLOD - 2) << 1));
+  size_t  tileCnt = tileKeys.size();
+  if (tileDataSize > 0)
+    tileCnt = std::min(tileCnt, tileCacheSizeLimit / tileDataSize);
+  if (tileKeys.size() < 1)
+    return;
+  tileCnt = std::max< size_t >(tileCnt, 1);
 
-  // LOD4
-  if (blockMask & 0x0300)
+  std::vector< TileData * > tiles(tileCnt, (TileData *) 0);
+  for (size_t i = 0; i < tileCnt; i++)
   {
-    for (size_t yy = 0; yy < 64; yy++)
+    std::map< unsigned int, TileData * >::iterator  t =
+        tileCacheMap.find(tileKeys[i]);
+    TileData  *p;
+    if (t != tileCacheMap.end())
     {
-      if ((cellMinY + int((yy >> 3) + y0)) > cellMaxY)
-        break;
-      for (size_t xx = 0; xx < 64; xx++)
+      p = t->second;
+      // unlink from the list
+      if (p->prv)
+        p->prv->nxt = p->nxt;
+      else
+        firstTile = p->nxt;
+      if (p->nxt)
+        p->nxt->prv = p->prv;
+      else
+        lastTile = p->prv;
+    }
+    else
+    {
+      p = new TileData();
+      p->x0 = (unsigned short) (tileKeys[i] & 0xFFFFU);
+      p->y0 = (unsigned short) (tileKeys[i] >> 16);
+      p->blockMask = 0U;
+      p->hmapLOD = 4;
+      p->vclrLOD = 4;
+      try
       {
-        if ((cellMinX + int((xx >> 3) + x0)) > cellMaxX)
-          break;
-        size_t  offs = (yy + (y0 << 3)) * (nCellsX << 3) + (xx + (x0 << 3));
-        if (blockMask & 0x0155)
-        {
-          tileData.hmapData[((yy << 10) + xx) << 4] =
-              readUInt16(heightMapLOD4 + (offs << 1));
-          tileData.ltexData[((yy << 10) + xx) << 4] =
-              readUInt16(landTexturesLOD4 + (offs << 1));
-        }
-        if (blockMask & 0x02A0)
-        {
-          tileData.vclrData[((yy << 8) + xx) << 2] =
-              readUInt16(vertexColorLOD4 + (offs << 1));
-        }
+        tileCacheMap.insert(std::pair< unsigned int, TileData * >(
+                                tileKeys[i], p));
+      }
+      catch (...)
+      {
+        delete p;
+        throw;
       }
     }
+    // the tiles of the current request are moved to the end of the list
+    p->prv = lastTile;
+    p->nxt = (TileData *) 0;
+    if (lastTile)
+      lastTile->nxt = p;
+    else
+      firstTile = p;
+    lastTile = p;
+    tiles[i] = p;
   }
-  // LOD3..LOD0
-  size_t  threadCnt = size_t(std::thread::hardware_concurrency());
-  if (threadCnt < 1)
-    threadCnt = 1;
-  else if (threadCnt > 16)
-    threadCnt = 16;
-  std::vector< std::thread * >  threads(threadCnt, (std::thread *) 0);
-  std::vector< std::string >    errMsgs(threadCnt);
-  for (size_t i = 0; i < threadCnt; i++)
+
+  taskQueue.clear();
+  for (size_t i = 0; i < tileCnt; i++)
   {
-    try
+    TileData& tileData = *(tiles[i]);
+    unsigned int  m = blockMask & ~(tileData.blockMask);
+    if (!m)
+      continue;
+    size_t  prvDataSize = tileData.getDataSize();
+    if (m & 0x0155)
     {
-      threads[i] = new std::thread(loadBlocksThread,
-                                   this, &(errMsgs.front()) + i, &tileData,
-                                   x0, y0, i, threadCnt, blockMask);
+      if (hmapLOD < tileData.hmapLOD)
+      {
+        // reload all levels of detail at higher resolution
+        tileData.hmapLOD = hmapLOD;
+        std::vector< std::uint16_t >().swap(tileData.hmapData);
+        std::vector< std::uint16_t >().swap(tileData.ltexData);
+        tileData.blockMask = tileData.blockMask & ~0x0155U;
+        m = m | (blockMask & 0x0155);
+      }
+      size_t  n = size_t(0x00100000) >> (tileData.hmapLOD << 1);
+      tileData.hmapData.resize(n);
+      tileData.ltexData.resize(n);
     }
-    catch (std::exception& e)
+    if (m & 0x0002)
+      tileData.gcvrData.resize(0x00100000);
+    if (m & 0x02A0)
     {
-      errMsgs[i] = std::string(e.what());
-      break;
+      if (vclrLOD < tileData.vclrLOD)
+      {
+        tileData.vclrLOD = vclrLOD;
+        std::vector< std::uint16_t >().swap(tileData.vclrData);
+        tileData.blockMask = tileData.blockMask & ~0x02A0U;
+        m = m | (blockMask & 0x02A0);
+      }
+      tileData.vclrData.resize(size_t(0x00010000)
+                               >> ((tileData.vclrLOD - 2) << 1));
     }
-  }
-  for (size_t i = 0; i < threadCnt; i++)
-  {
-    if (threads[i])
+    tileCacheDataSize = tileCacheDataSize + tileData.getDataSize();
+    tileCacheDataSize = tileCacheDataSize - prvDataSize;
+    unsigned int  x0 = tileData.x0;
+    unsigned int  y0 = tileData.y0;
+
+    // LOD4
+    if (m & 0x0300)
     {
-      threads[i]->join();
-      delete threads[i];
+      unsigned char s = tileData.hmapLOD;
+      unsigned char sv = tileData.vclrLOD - 2;
+      for (size_t yy = 0; yy < 64; yy++)
+      {
+        if ((cellMinY + int((yy >> 3) + y0)) > cellMaxY)
+          break;
+        for (size_t xx = 0; xx < 64; xx++)
+        {
+          if ((cellMinX + int((xx >> 3) + x0)) > cellMaxX)
+            break;
+          size_t  offs = (yy + (y0 << 3)) * (nCellsX << 3) + (xx + (x0 << 3));
+          if (m & 0x0100)
+          {
+            tileData.hmapData[((yy << (10 - s)) + xx) << (4 - s)] =
+                readUInt16(heightMapLOD4 + (offs << 1));
+            tileData.ltexData[((yy << (10 - s)) + xx) << (4 - s)] =
+                readUInt16(landTexturesLOD4 + (offs << 1));
+          }
+          if (m & 0x0200)
+          {
+            tileData.vclrData[((yy << (8 - sv)) + xx) << (2 - sv)] =
+                readUInt16(vertexColorLOD4 + (offs << 1));
+          }
+        }
+      }
     }
+    // LOD3..LOD0
+    queueBlocks(tileData, m);
+  }
+  try
+  {
+    runTaskQueue();
+  }
+  catch (...)
+  {
+    // the state of the tiles is undefined after an error
+    for (size_t i = 0; i < tileCnt; i++)
+      tiles[i]->blockMask = 0U;
+    throw;
+  }
+  for (size_t i = 0; i < tileCnt; i++)
+    tiles[i]->blockMask = tiles[i]->blockMask | blockMask;
+
+  // remove least recently used tiles that are not part of this request
+  while (tileCacheDataSize > tileCacheSizeLimit && firstTile &&
+         std::find(tiles.begin(), tiles.end(), firstTile) == tiles.end())
+  {
+    TileData  *p = firstTile;
+    firstTile = p->nxt;
+    if (firstTile)
+      firstTile->prv = (TileData *) 0;
+    else
+      lastTile = (TileData *) 0;
+    tileCacheMap.erase(((unsigned int) p->y0 << 16) | p->x0);
+    tileCacheDataSize = tileCacheDataSize - p->getDataSize();
+    delete p;
+  }
+}
+
+const BTDFile::TileData& BTDFile::loadTile(int cellX, int cellY,
+                                           unsigned int blockMask)
+{
+  unsigned int  x0 = (unsigned int) (cellX - cellMinX) & 0xFFF8U;
+  unsigned int  y0 = (unsigned int) (cellY - cellMinY) & 0xFFF8U;
+  unsigned int  cacheKey = (y0 << 16) | x0;
+  std::map< unsigned int, TileData * >::iterator  t =
+      tileCacheMap.find(cacheKey);
+  if (t == tileCacheMap.end() ||
+      ((blockMask & ~(t->second->blockMask)) & 0x03F7) != 0)
+  {
+    std::vector< unsigned int > tileKeys(1, cacheKey);
+    loadTiles(tileKeys, blockMask);
+    t = tileCacheMap.find(cacheKey);
+  }
+  return *(t->second);
+}
+
+const BTDFile::TileData& BTDFile::findTile(int cellX, int cellY,
+                                           unsigned int blockMask) const
+{
+  unsigned int  x0 = (unsigned int) (cellX - cellMinX) & 0xFFF8U;
+  unsigned int  y0 = (unsigned int) (cellY - cellMinY) & 0xFFF8U;
+  std::map< unsigned int, TileData * >::const_iterator  t =
+      tileCacheMap.find((y0 << 16) | x0);
+  if (t == tileCacheMap.end() ||
+      ((blockMask & ~(t->second->blockMask)) & 0x03F7) != 0)
+  {
+    errorMessage("BTDFile: tile data has not been loaded");
   }
-  for (size_t i = 0; i < threadCnt; i++)
+  return *(t->second);
+}
+
+void BTDFile::prefetchCells(int cellX0, int cellY0, int cellX1, int cellY1,
+                            unsigned int dataMask, unsigned char l)
+{
+  cellX0 = std::max(cellX0, cellMinX);
+  cellY0 = std::max(cellY0, cellMinY);
+  cellX1 = std::min(cellX1, cellMaxX);
+  cellY1 = std::min(cellY1, cellMaxY);
+  std::vector< unsigned int > tileKeys;
+  for (int y = (cellY0 - cellMinY) & ~7; y <= (cellY1 - cellMinY); y += 8)
   {
-    if (!errMsgs[i].empty())
-      throw FO76UtilsError(1, errMsgs[i].c_str());
+    for (int x = (cellX0 - cellMinX) & ~7; x <= (cellX1 - cellMinX); x += 8)
+      tileKeys.push_back(((unsigned int) y << 16) | (unsigned int) x);
   }
-  tileData.blockMask = tileData.blockMask | blockMask;
-  return tileData;
+  loadTiles(tileKeys, getBlockMask(dataMask, l));
 }
 
 BTDFile::BTDFile(const char *fileName)
@@ -299,7 +561,13 @@ BTDFile::BTDFile(const char *fileName)
     errorMessage("input file format is not BTD");
   if (readUInt32() != 6U)
     errorMessage("unsupported BTD format version");
-  tileCacheIndex = 0;
+  firstTile = (TileData *) 0;
+  lastTile = (TileData *) 0;
+  tileCacheDataSize = 0;
+  tileCacheSizeLimit = 0;
+  taskQueuePos = 0;
+  tasksRunning = 0;
+  threadPoolStopFlag = false;
   // TODO: check header data for errors
   worldHeightMin = readFloat();
   worldHeightMax = readFloat();
@@ -348,34 +616,22 @@ BTDFile::BTDFile(const char *fileName)
 
 BTDFile::~BTDFile()
 {
+  stopThreadPool();
+  while (firstTile)
+  {
+    TileData  *p = firstTile;
+    firstTile = p->nxt;
+    delete p;
+  }
 }
 
 void BTDFile::setTileCacheSize(size_t n)
 {
-  size_t  prvSize = tileCache.size();
-  if (n <= prvSize)
-    return;
-  tileCacheMap.clear();
-  tileCache.resize(n);
-  for (size_t i = prvSize; i < n; i++)
-  {
-    tileCache[i].x0 = 0x8000;
-    tileCache[i].y0 = 0x8000;
-    tileCache[i].blockMask = 0U;
-  }
-  for (size_t i = 0; i < prvSize; i++)
-  {
-    TileData  *t = &(tileCache.front()) + i;
-    unsigned int  cacheKey = ((unsigned int) t->y0 << 16) | t->x0;
-    if (bool(cacheKey & 0x80008000U) || !(t->blockMask))
-    {
-      t->x0 = 0x8000;
-      t->y0 = 0x8000;
-      t->blockMask = 0U;
-      continue;
-    }
-    tileCacheMap.insert(std::pair< unsigned int, TileData * >(cacheKey, t));
-  }
+  // 1024 * 1024 * 5 bytes for height map, land textures and ground cover,
+  // 256 * 256 * 2 bytes for terrain color
+  n = n * 0x00520000;
+  if (n > tileCacheSizeLimit)
+    tileCacheSizeLimit = n;
 }
 
 unsigned int BTDFile::getLandTexture(size_t n) const
@@ -393,48 +649,75 @@ unsigned int BTDFile::getGroundCover(size_t n) const
 }
 
 void BTDFile::getCellHeightMap(std::uint16_t *buf, int cellX, int cellY,
-                               unsigned char l)
+                               unsigned char l, int pitch)
 {
-  const TileData& tileData = loadTile(cellX, cellY, (~0U << (l + l)) & 0x0155U);
-  size_t  x0 = size_t((cellX - cellMinX) & 7) << 7;
-  size_t  y0 = size_t((cellY - cellMinY) & 7) << 7;
+  (void) loadTile(cellX, cellY, getBlockMask(1U, l));
+  ((const BTDFile *) this)->getCellHeightMap(buf, cellX, cellY, l, pitch);
+}
+
+void BTDFile::getCellHeightMap(std::uint16_t *buf, int cellX, int cellY,
+                               unsigned char l, int pitch) const
+{
+  const TileData& tileData = findTile(cellX, cellY, getBlockMask(1U, l));
+  unsigned char s = tileData.hmapLOD;
+  size_t  x0 = size_t((cellX - cellMinX) & 7) << (7 - s);
+  size_t  y0 = size_t((cellY - cellMinY) & 7) << (7 - s);
   size_t  n = 128 >> l;
-  unsigned char m = 7 - l;
-  for (size_t yc = 0; yc < n; yc++)
+  if (!pitch)
+    pitch = int(n);
+  for (size_t yc = 0; yc < n; yc++, buf = buf + pitch)
   {
     for (size_t xc = 0; xc < n; xc++)
     {
-      buf[(yc << m) | xc] =
-          tileData.hmapData[((y0 + (yc << l)) << 10) + x0 + (xc << l)];
+      buf[xc] =
+          tileData.hmapData[((y0 + (yc << (l - s))) << (10 - s))
+                            + x0 + (xc << (l - s))];
     }
   }
 }
 
 void BTDFile::getCellLandTexture(std::uint16_t *buf, int cellX, int cellY,
-                                 unsigned char l)
+                                 unsigned char l, int pitch)
 {
-  const TileData& tileData = loadTile(cellX, cellY, (~0U << (l + l)) & 0x0155U);
-  size_t  x0 = size_t((cellX - cellMinX) & 7) << 7;
-  size_t  y0 = size_t((cellY - cellMinY) & 7) << 7;
+  (void) loadTile(cellX, cellY, getBlockMask(2U, l));
+  ((const BTDFile *) this)->getCellLandTexture(buf, cellX, cellY, l, pitch);
+}
+
+void BTDFile::getCellLandTexture(std::uint16_t *buf, int cellX, int cellY,
+                                 unsigned char l, int pitch) const
+{
+  const TileData& tileData = findTile(cellX, cellY, getBlockMask(2U, l));
+  unsigned char s = tileData.hmapLOD;
+  size_t  x0 = size_t((cellX - cellMinX) & 7) << (7 - s);
+  size_t  y0 = size_t((cellY - cellMinY) & 7) << (7 - s);
   size_t  n = 128 >> l;
-  unsigned char m = 7 - l;
-  for (size_t yc = 0; yc < n; yc++)
+  if (!pitch)
+    pitch = int(n);
+  for (size_t yc = 0; yc < n; yc++, buf = buf + pitch)
   {
     for (size_t xc = 0; xc < n; xc++)
     {
       unsigned int  tmp =
-          tileData.ltexData[((y0 + (yc << l)) << 10) + x0 + (xc << l)];
+          tileData.ltexData[((y0 + (yc << (l - s))) << (10 - s))
+                            + x0 + (xc << (l - s))];
       tmp = ((tmp & 0x7E00) >> 9) | (tmp & 0x01C0) | ((tmp & 0x003F) << 9);
       tmp = ((tmp & 0x7038) >> 3) | (tmp & 0x01C0) | ((tmp & 0x0E07) << 3);
-      buf[(yc << m) | xc] = (std::uint16_t) tmp;
+      buf[xc] = (std::uint16_t) tmp;
     }
   }
 }
 
 void BTDFile::getCellGroundCover(unsigned char *buf, int cellX, int cellY,
-                                 unsigned char l)
+                                 unsigned char l, int pitch)
 {
-  const TileData& tileData = loadTile(cellX, cellY, 0x0002);
+  (void) loadTile(cellX, cellY, getBlockMask(4U, l));
+  ((const BTDFile *) this)->getCellGroundCover(buf, cellX, cellY, l, pitch);
+}
+
+void BTDFile::getCellGroundCover(unsigned char *buf, int cellX, int cellY,
+                                 unsigned char l, int pitch) const
+{
+  const TileData& tileData = findTile(cellX, cellY, getBlockMask(4U, l));
   size_t  x = size_t(cellX - cellMinX);
   size_t  y = size_t(cellY - cellMinY);
   size_t  x0 = (x & 7) << 7;
@@ -442,7 +725,9 @@ void BTDFile::getCellGroundCover(unsigned char *buf, int cellX, int cellY,
   size_t  n = 128 >> l;
   unsigned char m = 7 - l;
   unsigned int  gcvrMask = 0;
-  for (size_t yc = 0; yc < n; yc++)
+  if (!pitch)
+    pitch = int(n);
+  for (size_t yc = 0; yc < n; yc++, buf = buf + pitch)
   {
     for (size_t xc = 0; xc < n; xc++)
     {
@@ -458,26 +743,37 @@ void BTDFile::getCellGroundCover(unsigned char *buf, int cellX, int cellY,
       tmp = ((tmp & 0xF0) >> 4) | ((tmp & 0x0F) << 4);
       tmp = ((tmp & 0xCC) >> 2) | ((tmp & 0x33) << 2);
       tmp = (((tmp & 0xAA) >> 1) | ((tmp & 0x55) << 1)) & gcvrMask;
-      buf[(yc << m) | xc] = (unsigned char) tmp;
+      buf[xc] = (unsigned char) tmp;
     }
   }
 }
 
 void BTDFile::getCellTerrainColor(std::uint16_t *buf, int cellX, int cellY,
-                                  unsigned char l)
+                                  unsigned char l, int pitch)
 {
-  const TileData& tileData = loadTile(cellX, cellY, (~0U << (l + l)) & 0x02A0U);
+  (void) loadTile(cellX, cellY, getBlockMask(8U, l));
+  ((const BTDFile *) this)->getCellTerrainColor(buf, cellX, cellY, l, pitch);
+}
+
+void BTDFile::getCellTerrainColor(std::uint16_t *buf, int cellX, int cellY,
+                                  unsigned char l, int pitch) const
+{
+  const TileData& tileData = findTile(cellX, cellY, getBlockMask(8U, l));
+  unsigned char s = tileData.vclrLOD - 2;
   size_t  x0 = size_t((cellX - cellMinX) & 7) << 5;
   size_t  y0 = size_t((cellY - cellMinY) & 7) << 5;
   size_t  n = 128 >> l;
-  unsigned char m = 7 - l;
-  for (size_t yc = 0; yc < n; yc++)
+  if (!pitch)
+    pitch = int(n);
+  for (size_t yc = 0; yc < n; yc++, buf = buf + pitch)
   {
     size_t  yy = (l >= 2 ? (yc << (l - 2)) : (yc >> (2 - l)));
+    yy = (y0 + yy) >> s;
     for (size_t xc = 0; xc < n; xc++)
     {
       size_t  xx = (l >= 2 ? (xc << (l - 2)) : (xc >> (2 - l)));
-      buf[(yc << m) | xc] = tileData.vclrData[((y0 + yy) << 8) + x0 + xx];
+      xx = (x0 + xx) >> s;
+      buf[xc] = tileData.vclrData[(yy << (8 - s)) + xx];
     }
   }
 }
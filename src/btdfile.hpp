@@ -5,6 +5,10 @@
 #include "common.hpp"
 #include "filebuf.hpp"
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
 class BTDFile : public FileBuffer
 {
  protected:
@@ -49,14 +53,44 @@ class BTDFile : public FileBuffer
     // bit 8: LOD4 vertex height and land textures are loaded
     // bit 9: LOD4 terrain color is loaded
     unsigned int  blockMask;
-    std::vector< std::uint16_t >  hmapData;     // vertex height, 1024 * 1024
-    std::vector< std::uint16_t >  ltexData;     // land textures, 1024 * 1024
+    // the resolution of hmapData and ltexData is 1024 >> hmapLOD, and that
+    // of vclrData is 256 >> (vclrLOD - 2), only the levels of detail that
+    // have been requested are stored
+    unsigned char hmapLOD;
+    unsigned char vclrLOD;
+    // list of tiles in least recently used first order
+    TileData      *prv;
+    TileData      *nxt;
+    std::vector< std::uint16_t >  hmapData;     // vertex height
+    std::vector< std::uint16_t >  ltexData;     // land textures
     std::vector< unsigned char >  gcvrData;     // ground cover, 1024 * 1024
-    std::vector< std::uint16_t >  vclrData;     // terrain color, 256 * 256
+    std::vector< std::uint16_t >  vclrData;     // terrain color
+    size_t getDataSize() const;
   };
   std::map< unsigned int, TileData * >  tileCacheMap;
-  std::vector< TileData > tileCache;
-  size_t  tileCacheIndex;
+  TileData  *firstTile;
+  TileData  *lastTile;
+  size_t  tileCacheDataSize;
+  size_t  tileCacheSizeLimit;           // maximum tile data size in bytes
+  struct BlockTask
+  {
+    TileData      *tileData;
+    size_t        dataOffs;
+    size_t        n;
+    unsigned char l;
+    unsigned char b;
+  };
+  // ZLib compressed blocks of all tiles being loaded are decompressed by a
+  // persistent pool of worker threads and the main thread
+  std::vector< BlockTask >  taskQueue;
+  size_t  taskQueuePos;
+  size_t  tasksRunning;
+  bool    threadPoolStopFlag;
+  std::string threadErrMsg;
+  std::vector< std::thread * >  threads;
+  std::mutex  threadPoolMutex;
+  std::condition_variable threadPoolCond;       // new tasks or stop request
+  std::condition_variable tasksDoneCond;
   // ----------------
   static void loadBlockLines_8(unsigned char *dst, const unsigned char *src);
   static void loadBlockLines_16(std::uint16_t *dst, const unsigned char *src,
@@ -64,18 +98,42 @@ class BTDFile : public FileBuffer
   void loadBlock(TileData& tileData, size_t dataOffs,
                  size_t n, unsigned char l, unsigned char b,
                  std::vector< std::uint16_t >& zlibBuf);
-  void loadBlocks(TileData& tileData, size_t x, size_t y,
-                  size_t threadIndex, size_t threadCnt, unsigned int blockMask);
-  static void loadBlocksThread(BTDFile *p, std::string *errMsg,
-                               TileData *tileData, size_t x, size_t y,
-                               size_t threadIndex, size_t threadCnt,
-                               unsigned int blockMask);
+  void queueBlocks(TileData& tileData, unsigned int blockMask);
+  void runTask(const BlockTask& task, std::vector< std::uint16_t >& zlibBuf);
+  static void threadFunction(BTDFile *p);
+  void runTaskQueue();
+  void stopThreadPool();
+  static unsigned int getBlockMask(unsigned int dataMask, unsigned char l);
+  // load or find tiles, tileKeys contains the coordinates of the SW corner
+  // of each tile as (y0 << 16) | x0, the number of tiles loaded is limited
+  // by the tile cache size
+  void loadTiles(const std::vector< unsigned int >& tileKeys,
+                 unsigned int blockMask);
   const TileData& loadTile(int cellX, int cellY, unsigned int blockMask);
+  // find a tile without modifying the cache, throws an exception if the tile
+  // is not loaded, or some of the blocks in blockMask are missing
+  const TileData& findTile(int cellX, int cellY, unsigned int blockMask) const;
  public:
   BTDFile(const char *fileName);
   virtual ~BTDFile();
-  // set the number of 8x8 cell (5.125 MiB) tiles to keep decompressed
+  // set the number of 8x8 cell (5.125 MiB) tiles to keep decompressed,
+  // tiles loaded at a lower level of detail use less memory, and a greater
+  // number of them can be cached
   void setTileCacheSize(size_t n);
+  // load the tiles that contain cells cellX0,cellY0 to cellX1,cellY1 in
+  // advance, decompressing the data of multiple tiles in parallel
+  // dataMask is the set of getCell*() functions that will be used (1: height
+  // map, 2: land textures, 4: ground cover, 8: terrain color), l is the
+  // level of detail
+  // the total size of the tiles loaded is limited by the tile cache size
+  // the const versions of the getCell*() functions only read the tiles that
+  // have already been loaded, and throw an exception on a cache miss, these
+  // can be called from multiple threads, but not at the same time as any
+  // non-const function; to use them, call prefetchCells() with a dataMask
+  // and l that include all the data needed, and set a tile cache size that
+  // is large enough for all the tiles in the area
+  void prefetchCells(int cellX0, int cellY0, int cellX1, int cellY1,
+                     unsigned int dataMask, unsigned char l = 0);
   inline int getCellMinX() const
   {
     return cellMinX;
@@ -111,18 +169,32 @@ class BTDFile : public FileBuffer
   unsigned int getLandTexture(size_t n) const;
   unsigned int getGroundCover(size_t n) const;
   // N = 128 >> l, buffer size = N * N
+  // the non-const versions of the getCell*() functions load the tile if it
+  // is not in the cache
+  // the data is written directly to an image if pitch is not zero, in this
+  // case buf points to the first (southernmost) row of the cell, and pitch
+  // is the number of elements from one row to the next, which can be
+  // negative for images with the north at the top
   // height map in pixelFormatGRAY16 format
   void getCellHeightMap(std::uint16_t *buf, int cellX, int cellY,
-                        unsigned char l = 0);
+                        unsigned char l = 0, int pitch = 0);
+  void getCellHeightMap(std::uint16_t *buf, int cellX, int cellY,
+                        unsigned char l = 0, int pitch = 0) const;
   // land texture opacities in pixelFormatA16 format (see filebuf.hpp)
   void getCellLandTexture(std::uint16_t *buf, int cellX, int cellY,
-                          unsigned char l = 0);
+                          unsigned char l = 0, int pitch = 0);
+  void getCellLandTexture(std::uint16_t *buf, int cellX, int cellY,
+                          unsigned char l = 0, int pitch = 0) const;
   // ground cover mask in pixelFormatA8 format
   void getCellGroundCover(unsigned char *buf, int cellX, int cellY,
-                          unsigned char l = 0);
+                          unsigned char l = 0, int pitch = 0);
+  void getCellGroundCover(unsigned char *buf, int cellX, int cellY,
+                          unsigned char l = 0, int pitch = 0) const;
   // vertex colors in pixelFormatRGBA16 format, l >= 2
   void getCellTerrainColor(std::uint16_t *buf, int cellX, int cellY,
-                           unsigned char l = 2);
+                           unsigned char l = 2, int pitch = 0);
+  void getCellTerrainColor(std::uint16_t *buf, int cellX, int cellY,
+                           unsigned char l = 2, int pitch = 0) const;
   // buf[0..5]   = SW quadrant land texture IDs (0xFF: no texture),
   //               getLandTexture() returns the corresponding form IDs
   // buf[8..15]  = SW quadrant ground cover IDs (0xFF: none)
@@ -38,8 +38,9 @@ static void renderCubeMap(const BA2File& ba2File,
                           int imageWidth, int imageHeight, float mipLevel)
 {
   std::vector< unsigned char >  fileBuf;
-  ba2File.extractFile(fileBuf, texturePath);
-  DDSTexture  texture(&(fileBuf.front()), fileBuf.size());
+  const unsigned char *fileData = (unsigned char *) 0;
+  size_t  fileSize = ba2File.extractFile(fileData, fileBuf, texturePath);
+  DDSTexture  texture(fileData, fileSize);
   if (!texture.getIsCubeMap())
   {
     std::fprintf(stderr, "Warning: %s is not a cube map\n",
@@ -3,6 +3,7 @@
 #include "ddstxt.hpp"
 
 #include <thread>
+#include <atomic>
 
 static inline std::uint64_t decodeBC3Alpha(std::uint64_t& a,
                                            const unsigned char *src,
@@ -279,7 +280,14 @@ void DDSTexture::loadTextureData(
     std::uint32_t *p = textureData[i] + dataOffs;
     unsigned int  w = ((xSizeMip0 - 1U) >> i) + 1U;
     unsigned int  h = ((ySizeMip0 - 1U) >> i) + 1U;
-    if (i < mipLevelCnt)
+    if (i < blockMipCnt)
+    {
+      // compressed format, copy blocks without decoding
+      size_t  n = size_t(w >> 2) * size_t(h >> 2) * blockSize;
+      std::memcpy(p, srcPtr, n);
+      srcPtr = srcPtr + n;
+    }
+    else if (i < mipLevelCnt)
     {
       if (blockSize > 16)
       {
@@ -320,6 +328,22 @@ void DDSTexture::loadTextureData(
       unsigned int  xMask = (xSizeMip0 - 1U) >> (i - 1);
       unsigned int  yMask = (ySizeMip0 - 1U) >> (i - 1);
       size_t  w2 = size_t(xMask + 1U);
+      std::vector< std::uint32_t >  tmpBuf;
+      if ((i - 1) < blockMipCnt)
+      {
+        tmpBuf.resize(w2 * size_t(yMask + 1U));
+        const unsigned char *blockPtr =
+            reinterpret_cast< const unsigned char * >(p2);
+        for (unsigned int y = 0; y <= yMask; y = y + 4)
+        {
+          for (unsigned int x = 0; x <= xMask; x = x + 4)
+          {
+            blockPtr = blockPtr + decodeFunction(&(tmpBuf[y * w2 + x]),
+                                                 blockPtr, (unsigned int) w2);
+          }
+        }
+        p2 = &(tmpBuf.front());
+      }
       for (unsigned int y = 0; y < h; y++)
       {
         size_t  offsY2 = size_t((y << 1) & yMask) * w2;
@@ -360,7 +384,8 @@ void DDSTexture::loadTextureData(
   }
 }
 
-void DDSTexture::loadTexture(FileBuffer& buf, int mipOffset)
+void DDSTexture::loadTexture(FileBuffer& buf, int mipOffset,
+                             bool blockCompressed)
 {
   buf.setPosition(0);
   if (buf.size() < 148 || !FileBuffer::checkType(buf.readUInt32(), "DDS "))
@@ -374,6 +399,8 @@ void DDSTexture::loadTexture(FileBuffer& buf, int mipOffset)
   haveAlpha = false;
   isCubeMap = false;
   textureCnt = 1;
+  blockMipCnt = 0;
+  textureID = 0U;
   ySizeMip0 = buf.readUInt32();
   xSizeMip0 = buf.readUInt32();
   if (ySizeMip0 < 1 || ySizeMip0 > 32768 ||
@@ -560,6 +587,21 @@ void DDSTexture::loadTexture(FileBuffer& buf, int mipOffset)
   {
     errorMessage("DDS file is shorter than expected");
   }
+  const unsigned char *srcPtr = buf.getDataPtr() + dataOffs;
+  for ( ; mipOffset > 0 && mipLevelCnt > 1; mipOffset--, mipLevelCnt--)
+  {
+    unsigned int  w = xSizeMip0;
+    unsigned int  h = ySizeMip0;
+    if (blockSize > 16)
+      srcPtr = srcPtr + (size_t(w) * h * (blockSize >> 4));
+    else
+      srcPtr = srcPtr + (size_t((w + 3) >> 2) * ((h + 3) >> 2) * blockSize);
+    xSizeMip0 = (xSizeMip0 + 1) >> 1;
+    ySizeMip0 = (ySizeMip0 + 1) >> 1;
+  }
+  // only mip levels with a size of at least 4x4 that are present in the file
+  // can be stored in compressed format
+  blockCompressed = blockCompressed && blockSize <= 16 && textureCnt == 1;
   size_t  dataOffsets[20];
   size_t  bufSize = 0;
   for (int i = 0; i < 20; i++)
@@ -571,23 +613,30 @@ void DDSTexture::loadTexture(FileBuffer& buf, int mipOffset)
     if (h < 1)
       h = 1;
     dataOffsets[i] = bufSize;
-    bufSize = bufSize + (size_t(w) * h);
+    if (blockCompressed && i < mipLevelCnt && w >= 4 && h >= 4)
+    {
+      blockMipCnt = i + 1;
+      bufSize = bufSize + ((size_t(w) * h * blockSize) >> 6);
+    }
+    else
+    {
+      bufSize = bufSize + (size_t(w) * h);
+    }
   }
   textureDataSize = bufSize;
   textureDataBuf = new std::uint32_t[bufSize * size_t(textureCnt)];
   for (int i = 0; i < 20; i++)
     textureData[i] = textureDataBuf + dataOffsets[i];
-  const unsigned char *srcPtr = buf.getDataPtr() + dataOffs;
-  for ( ; mipOffset > 0 && mipLevelCnt > 1; mipOffset--, mipLevelCnt--)
+  this->blockSize = (unsigned int) blockSize;
+  blockDecodeFunction = decodeFunction;
+  if (blockMipCnt > 0)
   {
-    unsigned int  w = xSizeMip0;
-    unsigned int  h = ySizeMip0;
-    if (blockSize > 16)
-      srcPtr = srcPtr + (size_t(w) * h * (blockSize >> 4));
-    else
-      srcPtr = srcPtr + (size_t((w + 3) >> 2) * ((h + 3) >> 2) * blockSize);
-    xSizeMip0 = (xSizeMip0 + 1) >> 1;
-    ySizeMip0 = (ySizeMip0 + 1) >> 1;
+    static std::atomic< unsigned int >  textureIDCounter(0U);
+    do
+    {
+      textureID = ++textureIDCounter;
+    }
+    while (!textureID);
   }
   for (size_t i = 0; i < textureCnt; i++)
   {
@@ -600,6 +649,7 @@ void DDSTexture::loadTexture(FileBuffer& buf, int mipOffset)
     ySizeMip0 = (ySizeMip0 + 1) >> 1;
     for (int i = 0; (i + 1) < 20; i++)
       textureData[i] = textureData[i + 1];
+    blockMipCnt = (blockMipCnt > 0 ? (blockMipCnt - 1) : 0);
   }
 }
 
@@ -620,21 +670,23 @@ inline FloatVector4 DDSTexture::getPixelB_2(
                       p1 + (y1 * w + x1), p2 + (y1 * w + x1), xf, yf);
 }
 
-DDSTexture::DDSTexture(const char *fileName, int mipOffset)
+DDSTexture::DDSTexture(const char *fileName, int mipOffset,
+                       bool blockCompressed)
 {
   FileBuffer  tmpBuf(fileName);
-  loadTexture(tmpBuf, mipOffset);
+  loadTexture(tmpBuf, mipOffset, blockCompressed);
 }
 
-DDSTexture::DDSTexture(const unsigned char *buf, size_t bufSize, int mipOffset)
+DDSTexture::DDSTexture(const unsigned char *buf, size_t bufSize, int mipOffset,
+                       bool blockCompressed)
 {
   FileBuffer  tmpBuf(buf, bufSize);
-  loadTexture(tmpBuf, mipOffset);
+  loadTexture(tmpBuf, mipOffset, blockCompressed);
 }
 
-DDSTexture::DDSTexture(FileBuffer& buf, int mipOffset)
+DDSTexture::DDSTexture(FileBuffer& buf, int mipOffset, bool blockCompressed)
 {
-  loadTexture(buf, mipOffset);
+  loadTexture(buf, mipOffset, blockCompressed);
 }
 
 DDSTexture::DDSTexture(std::uint32_t c)
@@ -645,7 +697,11 @@ DDSTexture::DDSTexture(std::uint32_t c)
     isCubeMap(false),
     textureCnt(1),
     textureDataSize(0),
-    textureDataBuf((std::uint32_t *) 0)
+    textureDataBuf((std::uint32_t *) 0),
+    blockMipCnt(0),
+    blockSize(0U),
+    textureID(0U),
+    blockDecodeFunction(&decodeBlock_BC1)
 {
   unsigned char *p = reinterpret_cast< unsigned char * >(&textureDataSize);
   for (size_t i = 0; i < (sizeof(textureData) / sizeof(std::uint32_t *)); i++)
@@ -659,6 +715,70 @@ DDSTexture::~DDSTexture()
     delete[] textureDataBuf;
 }
 
+struct DDSDecodedBlockCache
+{
+  // key: address of the compressed block and texture ID
+  const unsigned char *blockPtr[256];
+  unsigned int  textureID[256];
+  std::uint32_t pixelData[256][16];
+};
+
+static thread_local DDSDecodedBlockCache  ddsDecodedBlockCache;
+
+std::uint32_t DDSTexture::decodePixel(unsigned int x, unsigned int y,
+                                      int mipLevel) const
+{
+  unsigned int  w = ((xSizeMip0 - 1U) >> (unsigned char) mipLevel) + 1U;
+  if (mipLevel >= blockMipCnt)
+    return textureData[mipLevel][y * w + x];
+  const unsigned char *blockPtr =
+      reinterpret_cast< const unsigned char * >(textureData[mipLevel])
+      + (size_t((y >> 2) * (w >> 2) + (x >> 2)) * blockSize);
+  // direct mapped cache of 16x16 blocks, textures sampled at the same
+  // coordinates are mapped to different entries
+  unsigned int  n = (((y << 2) & 0xF0U) | ((x >> 2) & 0x0FU))
+                    ^ ((textureID * 0x9DU + (unsigned int) mipLevel) & 0xFFU);
+  DDSDecodedBlockCache& cache = ddsDecodedBlockCache;
+  if (BRANCH_UNLIKELY(!(cache.blockPtr[n] == blockPtr &&
+                        cache.textureID[n] == textureID)))
+  {
+    (void) blockDecodeFunction(cache.pixelData[n], blockPtr, 4U);
+    cache.blockPtr[n] = blockPtr;
+    cache.textureID[n] = textureID;
+  }
+  return cache.pixelData[n][((y & 3U) << 2) | (x & 3U)];
+}
+
+FloatVector4 DDSTexture::getPixelB_Compressed(
+    int x0, int y0, float xf, float yf,
+    unsigned int xMask, unsigned int yMask, int mipLevel) const
+{
+  unsigned int  x0u = (unsigned int) x0;
+  unsigned int  y0u = (unsigned int) y0;
+  unsigned int  x1 = (x0u + 1U) & xMask;
+  unsigned int  y1 = (y0u + 1U) & yMask;
+  x0u = x0u & xMask;
+  y0u = y0u & yMask;
+  std::uint32_t tmp[4];
+  tmp[0] = decodePixel(x0u, y0u, mipLevel);
+  tmp[1] = decodePixel(x1, y0u, mipLevel);
+  tmp[2] = decodePixel(x0u, y1, mipLevel);
+  tmp[3] = decodePixel(x1, y1, mipLevel);
+  return FloatVector4(&(tmp[0]), &(tmp[1]), &(tmp[2]), &(tmp[3]), xf, yf);
+}
+
+FloatVector4 DDSTexture::getPixelT_Compressed(
+    int x0, int y0, float xf0, float yf0,
+    int x1, int y1, float xf1, float yf1,
+    unsigned int xMask, unsigned int yMask, int mipLevel, float mf) const
+{
+  FloatVector4  c0(getPixelB_Compressed(x0, y0, xf0, yf0, xMask, yMask,
+                                        mipLevel));
+  FloatVector4  c1(getPixelB_Compressed(x1, y1, xf1, yf1, xMask >> 1,
+                                        yMask >> 1, mipLevel + 1));
+  return ((c0 * (1.0f - mf)) + (c1 * mf));
+}
+
 FloatVector4 DDSTexture::getPixelB(float x, float y, int mipLevel) const
 {
   return getPixelB_Inline(x, y, mipLevel);
@@ -679,13 +799,17 @@ FloatVector4 DDSTexture::getPixelT_2(float x, float y, float mipLevel,
   const std::uint32_t * const *t2 = &(t.textureData[m0]);
   unsigned int  w = xSizeMip0;
   unsigned int  h = ySizeMip0;
-  if (BRANCH_UNLIKELY(!(t.xSizeMip0 == w && t.ySizeMip0 == h)))
+  // block compressed textures are sampled separately
+  bool    isCompressed = ((blockMipCnt | t.blockMipCnt) != 0);
+  if (BRANCH_UNLIKELY(!(t.xSizeMip0 == w && t.ySizeMip0 == h) || isCompressed))
   {
-    if ((t.xSizeMip0 << 1) == w && (t.ySizeMip0 << 1) == h && m0 > 0)
+    if ((t.xSizeMip0 << 1) == w && (t.ySizeMip0 << 1) == h && m0 > 0 &&
+        !isCompressed)
     {
       t2--;
     }
-    else if (t.xSizeMip0 == (w << 1) && t.ySizeMip0 == (h << 1))
+    else if (t.xSizeMip0 == (w << 1) && t.ySizeMip0 == (h << 1) &&
+             !isCompressed)
     {
       t2++;
     }
@@ -732,18 +856,26 @@ FloatVector4 DDSTexture::getPixelT_N(float x, float y, float mipLevel) const
   int     y0 = int(yf);
   xf = x - xf;
   yf = y - yf;
-  FloatVector4  c0(getPixelB(textureData[m0], x0, y0, xf, yf, xMask, yMask));
+  if (BRANCH_UNLIKELY(m0 < blockMipCnt))
+  {
+    if (mf >= (1.0f / 512.0f) && mf < (511.0f / 512.0f))
+    {
+      return getPixelT_Compressed(
+                 x0, y0, xf, yf,
+                 int((unsigned int) x0 >> 1), int((unsigned int) y0 >> 1),
+                 (xf + float(x0 & 1)) * 0.5f, (yf + float(y0 & 1)) * 0.5f,
+                 xMask, yMask, m0, mf);
+    }
+    return getPixelB_Compressed(x0, y0, xf, yf, xMask, yMask, m0);
+  }
   if (BRANCH_LIKELY(mf >= (1.0f / 512.0f) && mf < (511.0f / 512.0f)))
   {
-    xf = (xf + float(x0 & 1)) * 0.5f;
-    yf = (yf + float(y0 & 1)) * 0.5f;
-    x0 = int((unsigned int) x0 >> 1);
-    y0 = int((unsigned int) y0 >> 1);
-    FloatVector4  c1(getPixelB(textureData[m0 + 1], x0, y0, xf, yf,
-                               xMask >> 1, yMask >> 1));
-    c0 = (c0 * (1.0f - mf)) + (c1 * mf);
+    return getPixelT(&(textureData[m0]), x0, y0, xf, yf,
+                     int((unsigned int) x0 >> 1), int((unsigned int) y0 >> 1),
+                     (xf + float(x0 & 1)) * 0.5f, (yf + float(y0 & 1)) * 0.5f,
+                     xMask, yMask, mf);
   }
-  return c0;
+  return getPixelB(textureData[m0], x0, y0, xf, yf, xMask, yMask);
 }
 
 FloatVector4 DDSTexture::getPixelBM(float x, float y, int mipLevel) const
@@ -769,15 +901,24 @@ FloatVector4 DDSTexture::getPixelTM(float x, float y, float mipLevel) const
   {
     return FloatVector4(textureData[m0]);
   }
-  FloatVector4  c0(getPixelB(textureData[m0], x0, y0, xf, yf, xMask, yMask));
   if (BRANCH_LIKELY(mf >= (1.0f / 512.0f) && mf < (511.0f / 512.0f)))
   {
-    (void) convertTexCoord(x0, y0, xf, yf, xMask, yMask, x, y, m0 + 1, true);
-    FloatVector4  c1(getPixelB(textureData[m0 + 1], x0, y0, xf, yf,
-                               xMask, yMask));
-    c0 = (c0 * (1.0f - mf)) + (c1 * mf);
+    int     x1, y1;
+    float   xf1, yf1;
+    unsigned int  xMask1, yMask1;
+    (void) convertTexCoord(x1, y1, xf1, yf1, xMask1, yMask1, x, y, m0 + 1,
+                           true);
+    if (BRANCH_UNLIKELY(m0 < blockMipCnt))
+    {
+      return getPixelT_Compressed(x0, y0, xf, yf, x1, y1, xf1, yf1,
+                                  xMask, yMask, m0, mf);
+    }
+    return getPixelT(&(textureData[m0]), x0, y0, xf, yf, x1, y1, xf1, yf1,
+                     xMask, yMask, mf);
   }
-  return c0;
+  if (BRANCH_UNLIKELY(m0 < blockMipCnt))
+    return getPixelB_Compressed(x0, y0, xf, yf, xMask, yMask, m0);
+  return getPixelB(textureData[m0], x0, y0, xf, yf, xMask, yMask);
 }
 
 FloatVector4 DDSTexture::getPixelBC(float x, float y, int mipLevel) const
@@ -800,15 +941,24 @@ FloatVector4 DDSTexture::getPixelTC(float x, float y, float mipLevel) const
   {
     return FloatVector4(textureData[m0]);
   }
-  FloatVector4  c0(getPixelB(textureData[m0], x0, y0, xf, yf, xMask, yMask));
   if (BRANCH_LIKELY(mf >= (1.0f / 512.0f) && mf < (511.0f / 512.0f)))
   {
-    (void) convertTexCoord(x0, y0, xf, yf, xMask, yMask, x, y, m0 + 1, true);
-    FloatVector4  c1(getPixelB(textureData[m0 + 1], x0, y0, xf, yf,
-                               xMask, yMask));
-    c0 = (c0 * (1.0f - mf)) + (c1 * mf);
+    int     x1, y1;
+    float   xf1, yf1;
+    unsigned int  xMask1, yMask1;
+    (void) convertTexCoord(x1, y1, xf1, yf1, xMask1, yMask1, x, y, m0 + 1,
+                           true);
+    if (BRANCH_UNLIKELY(m0 < blockMipCnt))
+    {
+      return getPixelT_Compressed(x0, y0, xf, yf, x1, y1, xf1, yf1,
+                                  xMask, yMask, m0, mf);
+    }
+    return getPixelT(&(textureData[m0]), x0, y0, xf, yf, x1, y1, xf1, yf1,
+                     xMask, yMask, mf);
   }
-  return c0;
+  if (BRANCH_UNLIKELY(m0 < blockMipCnt))
+    return getPixelB_Compressed(x0, y0, xf, yf, xMask, yMask, m0);
+  return getPixelB(textureData[m0], x0, y0, xf, yf, xMask, yMask);
 }
 
 FloatVector4 DDSTexture::cubeMap(float x, float y, float z,
@@ -867,6 +1017,19 @@ FloatVector4 DDSTexture::cubeMap(float x, float y, float z,
   {
     return FloatVector4(p);
   }
+  if (BRANCH_UNLIKELY(m0 < blockMipCnt))
+  {
+    // not a cube map, n is always 0
+    FloatVector4  c0(getPixelB_Compressed(x0, y0, xf, yf, xMask, yMask, m0));
+    if (mf >= (1.0f / 512.0f) && mf < (511.0f / 512.0f))
+    {
+      (void) convertTexCoord(x0, y0, xf, yf, xMask, yMask, x, y, m0 + 1, true);
+      FloatVector4  c1(getPixelB_Compressed(x0, y0, xf, yf, xMask, yMask,
+                                            m0 + 1));
+      c0 = (c0 * (1.0f - mf)) + (c1 * mf);
+    }
+    return c0;
+  }
   FloatVector4  c0(getPixelB(p, x0, y0, xf, yf, xMask, yMask));
   if (BRANCH_LIKELY(mf >= (1.0f / 512.0f) && mf < (511.0f / 512.0f)))
   {
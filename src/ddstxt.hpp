@@ -18,6 +18,14 @@ class DDSTexture
   std::uint32_t *textureData[20];
   size_t        textureDataSize;        // size of textureDataBuf / textureCnt
   std::uint32_t *textureDataBuf;
+  // mip levels 0 to blockMipCnt - 1 are stored as BC1 to BC5 compressed
+  // blocks, and are decoded on demand
+  int           blockMipCnt;
+  unsigned int  blockSize;
+  // unique identifier of compressed textures for the decoded block cache
+  unsigned int  textureID;
+  size_t        (*blockDecodeFunction)(std::uint32_t *, const unsigned char *,
+                                       unsigned int);
   static size_t decodeBlock_BC1(
       std::uint32_t *dst, const unsigned char *src, unsigned int w);
   static size_t decodeBlock_BC2(
@@ -50,7 +58,19 @@ class DDSTexture
                        size_t (*decodeFunction)(std::uint32_t *,
                                                 const unsigned char *,
                                                 unsigned int));
-  void loadTexture(FileBuffer& buf, int mipOffset);
+  void loadTexture(FileBuffer& buf, int mipOffset, bool blockCompressed);
+  // returns a pixel from a mip level that may be stored in compressed format,
+  // x and y must be in the range 0 to width - 1 and height - 1
+  std::uint32_t decodePixel(unsigned int x, unsigned int y,
+                            int mipLevel) const;
+  // bilinear and trilinear filtering of block compressed textures
+  FloatVector4 getPixelB_Compressed(
+      int x0, int y0, float xf, float yf,
+      unsigned int xMask, unsigned int yMask, int mipLevel) const;
+  FloatVector4 getPixelT_Compressed(
+      int x0, int y0, float xf0, float yf0,
+      int x1, int y1, float xf1, float yf1,
+      unsigned int xMask, unsigned int yMask, int mipLevel, float mf) const;
   // X,Y coordinates are scaled to width,height - int(m)
   inline bool convertTexCoord(
       int& x0, int& y0, float& xf, float& yf,
@@ -59,13 +79,23 @@ class DDSTexture
   static inline FloatVector4 getPixelB(
       const std::uint32_t *p, int x0, int y0,
       float xf, float yf, unsigned int xMask, unsigned int yMask);
+  // trilinear filtering of mip levels p[0] (at x0, y0, xf0, yf0) and p[1]
+  // (at x1, y1, xf1, yf1), xMask and yMask are the masks of the first level
+  static inline FloatVector4 getPixelT(
+      const std::uint32_t * const *p, int x0, int y0, float xf0, float yf0,
+      int x1, int y1, float xf1, float yf1,
+      unsigned int xMask, unsigned int yMask, float mf);
   static inline FloatVector4 getPixelB_2(
       const std::uint32_t *p1, const std::uint32_t *p2, int x0, int y0,
       float xf, float yf, unsigned int xMask, unsigned int yMask);
  public:
-  DDSTexture(const char *fileName, int mipOffset = 0);
-  DDSTexture(const unsigned char *buf, size_t bufSize, int mipOffset = 0);
-  DDSTexture(FileBuffer& buf, int mipOffset = 0);
+  // if blockCompressed is true, BC1 to BC5 textures that are not cube maps
+  // are stored in memory in compressed format
+  DDSTexture(const char *fileName, int mipOffset = 0,
+             bool blockCompressed = false);
+  DDSTexture(const unsigned char *buf, size_t bufSize, int mipOffset = 0,
+             bool blockCompressed = false);
+  DDSTexture(FileBuffer& buf, int mipOffset = 0, bool blockCompressed = false);
   DDSTexture(std::uint32_t c);          // create 1x1 texture of color c
   virtual ~DDSTexture();
   inline int getWidth() const
@@ -92,11 +122,25 @@ class DDSTexture
   {
     return textureCnt;
   }
+  inline bool isBlockCompressed() const
+  {
+    return (blockMipCnt > 0);
+  }
+  // memory used by the texture data in bytes
+  inline size_t getDataSize() const
+  {
+    if (!textureDataBuf)
+      return 0;
+    return (textureDataSize * size_t(textureCnt) * sizeof(std::uint32_t));
+  }
   // no interpolation, returns color in RGBA format (LSB = red, MSB = alpha)
   inline std::uint32_t getPixelN(int x, int y, int mipLevel) const
   {
     unsigned int  xMask = (xSizeMip0 - 1U) >> (unsigned char) mipLevel;
     unsigned int  yMask = (ySizeMip0 - 1U) >> (unsigned char) mipLevel;
+    if (BRANCH_UNLIKELY(mipLevel < blockMipCnt))
+      return decodePixel((unsigned int) x & xMask, (unsigned int) y & yMask,
+                         mipLevel);
     return textureData[mipLevel][((unsigned int) y & yMask) * (xMask + 1U)
                                  + ((unsigned int) x & xMask)];
   }
@@ -104,6 +148,10 @@ class DDSTexture
   {
     unsigned int  xMask = (xSizeMip0 - 1U) >> (unsigned char) mipLevel;
     unsigned int  yMask = (ySizeMip0 - 1U) >> (unsigned char) mipLevel;
+    // compressed textures always have a texture count of 1
+    if (BRANCH_UNLIKELY(mipLevel < blockMipCnt))
+      return decodePixel((unsigned int) x & xMask, (unsigned int) y & yMask,
+                         mipLevel);
     const std::uint32_t *p =
         textureData[mipLevel] + (textureDataSize * size_t(n));
     return p[((unsigned int) y & yMask) * (xMask + 1U)
@@ -116,6 +164,8 @@ class DDSTexture
     int     yMask = int((ySizeMip0 - 1U) >> (unsigned char) mipLevel);
     x = (!(x & (xMask + 1)) ? x : ~x) & xMask;
     y = (!(y & (yMask + 1)) ? y : ~y) & yMask;
+    if (BRANCH_UNLIKELY(mipLevel < blockMipCnt))
+      return decodePixel((unsigned int) x, (unsigned int) y, mipLevel);
     return textureData[mipLevel][y * (xMask + 1) + x];
   }
   // getPixelN() with clamped texture coordinates
@@ -125,6 +175,8 @@ class DDSTexture
     int     yMask = int((ySizeMip0 - 1U) >> (unsigned char) mipLevel);
     x = (x > 0 ? (x < xMask ? x : xMask) : 0);
     y = (y > 0 ? (y < yMask ? y : yMask) : 0);
+    if (BRANCH_UNLIKELY(mipLevel < blockMipCnt))
+      return decodePixel((unsigned int) x, (unsigned int) y, mipLevel);
     return textureData[mipLevel][y * (xMask + 1) + x];
   }
   // bilinear filtering (getPixelB/getPixelT use normalized texture coordinates)
@@ -193,6 +245,34 @@ inline FloatVector4 DDSTexture::getPixelB(
                       p + (y1 * w + x0u), p + (y1 * w + x1), xf, yf);
 }
 
+inline FloatVector4 DDSTexture::getPixelT(
+    const std::uint32_t * const *p, int x0, int y0, float xf0, float yf0,
+    int x1, int y1, float xf1, float yf1,
+    unsigned int xMask, unsigned int yMask, float mf)
+{
+  unsigned int  w = xMask + 1U;
+  unsigned int  x0u = (unsigned int) x0;
+  unsigned int  y0u = (unsigned int) y0;
+  unsigned int  x0v = (x0u + 1U) & xMask;
+  unsigned int  y0v = (y0u + 1U) & yMask;
+  x0u = x0u & xMask;
+  y0u = y0u & yMask;
+  xMask = xMask >> 1;
+  yMask = yMask >> 1;
+  unsigned int  w1 = xMask + 1U;
+  unsigned int  x1u = (unsigned int) x1;
+  unsigned int  y1u = (unsigned int) y1;
+  unsigned int  x1v = (x1u + 1U) & xMask;
+  unsigned int  y1v = (y1u + 1U) & yMask;
+  x1u = x1u & xMask;
+  y1u = y1u & yMask;
+  return FloatVector4::interpolateTrilinear(
+             p[0] + (y0u * w + x0u), p[0] + (y0u * w + x0v),
+             p[0] + (y0v * w + x0u), p[0] + (y0v * w + x0v), xf0, yf0,
+             p[1] + (y1u * w1 + x1u), p[1] + (y1u * w1 + x1v),
+             p[1] + (y1v * w1 + x1u), p[1] + (y1v * w1 + x1v), xf1, yf1, mf);
+}
+
 inline FloatVector4 DDSTexture::getPixelB_Inline(
     float x, float y, int mipLevel) const
 {
@@ -201,6 +281,8 @@ inline FloatVector4 DDSTexture::getPixelB_Inline(
   float   xf, yf;
   unsigned int  xMask, yMask;
   (void) convertTexCoord(x0, y0, xf, yf, xMask, yMask, x, y, mipLevel);
+  if (BRANCH_UNLIKELY(mipLevel < blockMipCnt))
+    return getPixelB_Compressed(x0, y0, xf, yf, xMask, yMask, mipLevel);
   return getPixelB(textureData[mipLevel], x0, y0, xf, yf, xMask, yMask);
 }
 
@@ -215,18 +297,26 @@ inline FloatVector4 DDSTexture::getPixelT_Inline(
   unsigned int  xMask, yMask;
   if (BRANCH_UNLIKELY(!convertTexCoord(x0, y0, xf, yf, xMask, yMask, x, y, m0)))
     return FloatVector4(textureData[m0]);
-  FloatVector4  c0(getPixelB(textureData[m0], x0, y0, xf, yf, xMask, yMask));
+  if (BRANCH_UNLIKELY(m0 < blockMipCnt))
+  {
+    if (mf >= (1.0f / 512.0f) && mf < (511.0f / 512.0f))
+    {
+      return getPixelT_Compressed(
+                 x0, y0, xf, yf,
+                 int((unsigned int) x0 >> 1), int((unsigned int) y0 >> 1),
+                 (xf + float(x0 & 1)) * 0.5f, (yf + float(y0 & 1)) * 0.5f,
+                 xMask, yMask, m0, mf);
+    }
+    return getPixelB_Compressed(x0, y0, xf, yf, xMask, yMask, m0);
+  }
   if (BRANCH_LIKELY(mf >= (1.0f / 512.0f) && mf < (511.0f / 512.0f)))
   {
-    xf = (xf + float(x0 & 1)) * 0.5f;
-    yf = (yf + float(y0 & 1)) * 0.5f;
-    x0 = int((unsigned int) x0 >> 1);
-    y0 = int((unsigned int) y0 >> 1);
-    FloatVector4  c1(getPixelB(textureData[m0 + 1], x0, y0, xf, yf,
-                               xMask >> 1, yMask >> 1));
-    c0 = (c0 * (1.0f - mf)) + (c1 * mf);
+    return getPixelT(&(textureData[m0]), x0, y0, xf, yf,
+                     int((unsigned int) x0 >> 1), int((unsigned int) y0 >> 1),
+                     (xf + float(x0 & 1)) * 0.5f, (yf + float(y0 & 1)) * 0.5f,
+                     xMask, yMask, mf);
   }
-  return c0;
+  return getPixelB(textureData[m0], x0, y0, xf, yf, xMask, yMask);
 }
 
 inline FloatVector4 DDSTexture::getPixelBM_Inline(
@@ -242,6 +332,8 @@ inline FloatVector4 DDSTexture::getPixelBM_Inline(
   y = (!(int(yf) & 1) ? y : (1.0f - y));
   unsigned int  xMask, yMask;
   (void) convertTexCoord(x0, y0, xf, yf, xMask, yMask, x, y, mipLevel, true);
+  if (BRANCH_UNLIKELY(mipLevel < blockMipCnt))
+    return getPixelB_Compressed(x0, y0, xf, yf, xMask, yMask, mipLevel);
   return getPixelB(textureData[mipLevel], x0, y0, xf, yf, xMask, yMask);
 }
 
@@ -255,6 +347,8 @@ inline FloatVector4 DDSTexture::getPixelBC_Inline(
   float   xf, yf;
   unsigned int  xMask, yMask;
   (void) convertTexCoord(x0, y0, xf, yf, xMask, yMask, x, y, mipLevel, true);
+  if (BRANCH_UNLIKELY(mipLevel < blockMipCnt))
+    return getPixelB_Compressed(x0, y0, xf, yf, xMask, yMask, mipLevel);
   return getPixelB(textureData[mipLevel], x0, y0, xf, yf, xMask, yMask);
 }
 
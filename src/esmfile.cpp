@@ -3,10 +3,33 @@
 #include "zlib.hpp"
 #include "esmfile.hpp"
 
-const unsigned char * ESMFile::uncompressRecord(ESMRecord& r)
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(_WIN32) || defined(_WIN64)
+#  include <process.h>
+#else
+#  include <unistd.h>
+#endif
+
+void ESMFile::uncompressRecord(
+    std::shared_ptr< std::vector< unsigned char > >& recordData,
+    const ESMRecord& r)
 {
-  if (r.formID == zlibBufRecord)
-    return &(zlibBuf[zlibBufIndex].front());
+  ZLibCacheShard& cacheShard = zlibCache[r.formID & (zlibCacheShardCnt - 1)];
+  {
+    std::lock_guard< std::mutex > cacheLock(cacheShard.cacheMutex);
+    std::map< unsigned int, ZLibCacheEntry >::iterator  i =
+        cacheShard.records.find(r.formID);
+    if (i != cacheShard.records.end())
+    {
+      cacheShard.useOrder.erase(i->second.lastUsed);
+      i->second.lastUsed = ++(cacheShard.useCnt);
+      cacheShard.useOrder[i->second.lastUsed] = r.formID;
+      recordData = i->second.data;
+      return;
+    }
+  }
+  // the record is decompressed without holding the lock
   unsigned int  compressedSize;
   {
     FileBuffer  buf(r.fileData + 4, 4);
@@ -19,9 +42,9 @@ const unsigned char * ESMFile::uncompressRecord(ESMRecord& r)
   compressedSize = compressedSize - 4;
   buf.setPosition(offs);
   unsigned int  uncompressedSize = buf.readUInt32();
-  zlibBufRecord = 0xFFFFFFFFU;
-  zlibBuf[zlibBufIndex].resize(size_t(offs) + uncompressedSize);
-  unsigned char *p = &(zlibBuf[zlibBufIndex].front());
+  std::shared_ptr< std::vector< unsigned char > > tmpData(
+      new std::vector< unsigned char >(size_t(offs) + uncompressedSize));
+  unsigned char *p = &(tmpData->front());
   std::memcpy(p, buf.getDataPtr(), offs);
   p[4] = (unsigned char) (uncompressedSize & 0xFF);
   p[5] = (unsigned char) ((uncompressedSize >> 8) & 0xFF);
@@ -34,14 +57,31 @@ const unsigned char * ESMFile::uncompressRecord(ESMRecord& r)
                          buf.getDataPtr() + (offs + 4), compressedSize);
   if (recordSize != uncompressedSize)
     errorMessage("invalid compressed record size");
-  if ((zlibBufIndex + 1) < zlibBuf.size())
+
+  std::lock_guard< std::mutex > cacheLock(cacheShard.cacheMutex);
+  ZLibCacheEntry& e = cacheShard.records[r.formID];
+  if (e.data)
   {
-    zlibBufIndex++;
-    r.flags = r.flags & ~0x00040000U;
-    r.fileData = p;
+    // another thread has already stored the same record
+    recordData = e.data;
+    return;
   }
-  zlibBufRecord = r.formID;
-  return p;
+  e.data = tmpData;
+  e.lastUsed = ++(cacheShard.useCnt);
+  cacheShard.useOrder[e.lastUsed] = r.formID;
+  cacheShard.dataSize = cacheShard.dataSize + tmpData->size();
+  while (cacheShard.dataSize > zlibCacheShardSize &&
+         cacheShard.records.size() > 1)
+  {
+    std::map< unsigned long long, unsigned int >::iterator  i =
+        cacheShard.useOrder.begin();
+    std::map< unsigned int, ZLibCacheEntry >::iterator  j =
+        cacheShard.records.find(i->second);
+    cacheShard.dataSize = cacheShard.dataSize - j->second.data->size();
+    cacheShard.records.erase(j);
+    cacheShard.useOrder.erase(i);
+  }
+  recordData = tmpData;
 }
 
 unsigned int ESMFile::loadRecords(size_t& groupCnt, FileBuffer& buf,
@@ -101,13 +141,540 @@ unsigned int ESMFile::loadRecords(size_t& groupCnt, FileBuffer& buf,
   return r;
 }
 
+void ESMFile::scanTopLevelRecord(TopLevelRecord& t) const
+{
+  FileBuffer  buf(esmFiles[t.fileIndex]->getDataPtr(), t.endPos);
+  buf.setPosition(t.startPos);
+  t.recordCnt = 0;
+  t.groupCnt = 0;
+  t.maxFormID = 0U;
+  while (buf.getPosition() < buf.size())
+  {
+    if ((buf.getPosition() + recordHdrSize) > buf.size())
+      throw FO76UtilsError("end of input file %s", t.fileName);
+    unsigned int  recordType = buf.readUInt32Fast();
+    unsigned int  recordSize = buf.readUInt32Fast();
+    unsigned int  flags = buf.readUInt32Fast();
+    unsigned int  formID = buf.readUInt32Fast();
+    // skip version control info
+    buf.setPosition(buf.getPosition() + (recordHdrSize - 16));
+    if (FileBuffer::checkType(recordType, "GRUP"))
+    {
+      if (recordSize < recordHdrSize ||
+          (buf.getPosition() + (recordSize - recordHdrSize)) > buf.size())
+      {
+        throw FO76UtilsError("%s: invalid group size", t.fileName);
+      }
+      t.groupCnt++;
+    }
+    else
+    {
+      if (formID > 0x0FFFFFFFU)
+        throw FO76UtilsError("%s: invalid form ID", t.fileName);
+      t.maxFormID = (formID > t.maxFormID ? formID : t.maxFormID);
+      if ((recordSize < 10 && (flags & 0x00040000) != 0) ||
+          (buf.getPosition() + recordSize) > buf.size())
+      {
+        throw FO76UtilsError("%s: invalid record size", t.fileName);
+      }
+      t.recordCnt++;
+      buf.setPosition(buf.getPosition() + recordSize);
+    }
+  }
+}
+
+void ESMFile::loadTopLevelThread(ESMFile *p,
+                                 std::vector< TopLevelRecord > *topLevelRecords,
+                                 size_t *nextRecord, size_t endRecord,
+                                 std::mutex *recordMutex, bool loadPass)
+{
+  while (true)
+  {
+    size_t  i;
+    {
+      std::lock_guard< std::mutex > recordLock(*recordMutex);
+      i = *nextRecord;
+      if (i >= endRecord)
+        break;
+      (*nextRecord)++;
+    }
+    TopLevelRecord& t = (*topLevelRecords)[i];
+    try
+    {
+      if (!loadPass)
+      {
+        p->scanTopLevelRecord(t);
+      }
+      else
+      {
+        FileBuffer  buf(p->esmFiles[t.fileIndex]->getDataPtr(),
+                        p->esmFiles[t.fileIndex]->size());
+        buf.setPosition(t.startPos);
+        size_t  groupCnt = t.firstGroup;
+        (void) p->loadRecords(groupCnt, buf, t.endPos, 0U);
+      }
+    }
+    catch (std::exception& e)
+    {
+      t.errMsg = std::string(e.what());
+      if (t.errMsg.empty())
+        t.errMsg = "error loading ESM file";
+      // records before i have already been started, so the first error
+      // in file order is still found
+      std::lock_guard< std::mutex > recordLock(*recordMutex);
+      *nextRecord = endRecord;
+    }
+  }
+}
+
+void ESMFile::loadTopLevelRecords(
+    std::vector< TopLevelRecord >& topLevelRecords,
+    size_t startRecord, size_t endRecord, bool loadPass)
+{
+  size_t  threadCnt = size_t(std::thread::hardware_concurrency());
+  if (threadCnt < 1)
+    threadCnt = 1;
+  else if (threadCnt > 16)
+    threadCnt = 16;
+  threadCnt = std::min(threadCnt, endRecord - startRecord);
+  size_t  nextRecord = startRecord;
+  std::mutex  recordMutex;
+  std::vector< std::thread * >  threads(threadCnt, (std::thread *) 0);
+  for (size_t i = 1; i < threadCnt; i++)
+  {
+    try
+    {
+      threads[i] = new std::thread(loadTopLevelThread, this, &topLevelRecords,
+                                   &nextRecord, endRecord, &recordMutex,
+                                   loadPass);
+    }
+    catch (std::exception&)
+    {
+      break;
+    }
+  }
+  loadTopLevelThread(this, &topLevelRecords, &nextRecord, endRecord,
+                     &recordMutex, loadPass);
+  for (size_t i = 1; i < threadCnt; i++)
+  {
+    if (threads[i])
+    {
+      threads[i]->join();
+      delete threads[i];
+    }
+  }
+  for (size_t i = startRecord; i < endRecord; i++)
+  {
+    if (!topLevelRecords[i].errMsg.empty())
+      throw FO76UtilsError(1, topLevelRecords[i].errMsg.c_str());
+  }
+}
+
+bool ESMFile::getIndexCacheFileName(
+    std::string& cacheFileName, std::vector< std::int64_t >& fileModTimes,
+    const std::vector< std::string >& fileNames)
+{
+  if (!FileBuffer::getCachePath(cacheFileName))
+    return false;
+  fileModTimes.clear();
+  // FNV-1a hash of the ESM path names
+  std::uint64_t h = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < fileNames.size(); i++)
+  {
+#if defined(_WIN32) || defined(_WIN64)
+    struct __stat64 st;
+    if (_stat64(fileNames[i].c_str(), &st) != 0)
+#else
+    struct stat st;
+    if (stat(fileNames[i].c_str(), &st) != 0)
+#endif
+    {
+      return false;
+    }
+    fileModTimes.push_back(std::int64_t(st.st_mtime));
+    const std::string&  s = fileNames[i];
+    for (size_t j = 0; j <= s.length(); j++)
+    {
+      h = h ^ (unsigned char) s.c_str()[j];
+      h = h * 0x00000100000001B3ULL;
+    }
+  }
+  char    tmpBuf[32];
+  std::snprintf(tmpBuf, 32, "/esmi%016llx.bin", (unsigned long long) h);
+  cacheFileName += tmpBuf;
+  return true;
+}
+
+// Index cache file format (all integers are little endian):
+//   0:  "ESMI"
+//   4:  version (indexCacheVersion)
+//   8:  number of ESM files (E)
+//  12:  number of records (recordCnt)
+//  16:  number of records and groups (R)
+//  20:  formIDMap size (M)
+//  24:  reserved
+//  28:  size of name data in bytes (N)
+//  32:  E * 24 bytes: ESM file size (64-bit), modification time (64-bit),
+//       offset of file name in the name data (32-bit), padding
+//  32 + E * 24:  R * 32 bytes: records in recordBuf, as type, flags, formID,
+//                parent, children, next, ESM file index and offset of the
+//                record data in the file (0xFFFFFFFF, 0 if not used)
+//  32 + E * 24 + R * 32:  M * 4 bytes: formIDMap
+//  32 + E * 24 + R * 32 + M * 4:  N bytes of '\0' terminated file names
+
+bool ESMFile::loadIndexCache(const char *cacheFileName,
+                             const std::vector< std::string >& fileNames,
+                             const std::vector< std::int64_t >& fileModTimes)
+{
+  try
+  {
+    FileBuffer  buf(cacheFileName);
+    if (buf.size() < 33 || buf.readUInt32Fast() != 0x494D5345 ||       // "ESMI"
+        buf.readUInt32Fast() != indexCacheVersion ||
+        buf.readUInt32Fast() != esmFiles.size() || buf[buf.size() - 1] != 0)
+    {
+      return false;
+    }
+    unsigned int  tmpRecordCnt = buf.readUInt32Fast();
+    size_t  recordsSize = buf.readUInt32Fast();
+    size_t  formIDMapSize = buf.readUInt32Fast();
+    (void) buf.readUInt32Fast();        // reserved
+    size_t  namesSize = buf.readUInt32Fast();
+    size_t  recordsOffs = esmFiles.size() * 24 + 32;
+    size_t  formIDMapOffs = recordsOffs + recordsSize * 32;
+    size_t  namesOffs = formIDMapOffs + formIDMapSize * 4;
+    if (tmpRecordCnt > recordsSize || formIDMapSize > 0x10000000 ||
+        (namesOffs + namesSize) != buf.size())
+    {
+      return false;
+    }
+    const char  *names =
+        reinterpret_cast< const char * >(buf.getDataPtr() + namesOffs);
+    for (size_t i = 0; i < esmFiles.size(); i++)
+    {
+      buf.setPosition(i * 24 + 32);
+      std::uint64_t fileSize = buf.readUInt64();
+      std::int64_t  modTime = std::int64_t(buf.readUInt64());
+      size_t  nameOffs = buf.readUInt32Fast();
+      if (fileSize != esmFiles[i]->size() || modTime != fileModTimes[i] ||
+          nameOffs >= namesSize ||
+          std::strcmp(names + nameOffs, fileNames[i].c_str()) != 0)
+      {
+        return false;
+      }
+    }
+    recordCnt = tmpRecordCnt;
+    recordBuf.resize(recordsSize);
+    buf.setPosition(recordsOffs);
+    for (size_t i = 0; i < recordsSize; i++)
+    {
+      ESMRecord&  r = recordBuf[i];
+      r.type = buf.readUInt32Fast();
+      r.flags = buf.readUInt32Fast();
+      r.formID = buf.readUInt32Fast();
+      r.parent = buf.readUInt32Fast();
+      r.children = buf.readUInt32Fast();
+      r.next = buf.readUInt32Fast();
+      size_t  fileIndex = buf.readUInt32Fast();
+      size_t  offs = buf.readUInt32Fast();
+      if (fileIndex == 0xFFFFFFFFU)
+        continue;
+      if (fileIndex >= esmFiles.size() ||
+          (offs + recordHdrSize) > esmFiles[fileIndex]->size())
+      {
+        throw FO76UtilsError("invalid ESM index cache file");
+      }
+      r.fileData = esmFiles[fileIndex]->getDataPtr() + offs;
+    }
+    formIDMap.resize(formIDMapSize);
+    if (formIDMapSize > 0)
+    {
+      std::memcpy(&(formIDMap.front()), buf.getDataPtr() + formIDMapOffs,
+                  formIDMapSize * sizeof(unsigned int));
+    }
+    for (size_t i = 0; i < formIDMapSize; i++)
+    {
+      if (formIDMap[i] > recordsSize)
+        throw FO76UtilsError("invalid ESM index cache file");
+    }
+    // check the parent and child links, so that they can be followed
+    // without testing for invalid form IDs
+    for (size_t i = 0; i < recordsSize; i++)
+    {
+      const ESMRecord&  r = recordBuf[i];
+      if ((r.parent && !findRecord(r.parent)) ||
+          (r.children && !findRecord(r.children)) ||
+          (r.next && !findRecord(r.next)))
+      {
+        throw FO76UtilsError("invalid ESM index cache file");
+      }
+    }
+  }
+  catch (FO76UtilsError&)
+  {
+    recordCnt = 0;
+    recordBuf.clear();
+    formIDMap.clear();
+    return false;
+  }
+  return true;
+}
+
+static inline void writeIndexUInt32(std::vector< unsigned char >& buf,
+                                    std::uint32_t n)
+{
+  buf.push_back((unsigned char) (n & 0xFF));
+  buf.push_back((unsigned char) ((n >> 8) & 0xFF));
+  buf.push_back((unsigned char) ((n >> 16) & 0xFF));
+  buf.push_back((unsigned char) ((n >> 24) & 0xFF));
+}
+
+void ESMFile::saveIndexCache(
+    const char *cacheFileName, const std::vector< std::string >& fileNames,
+    const std::vector< std::int64_t >& fileModTimes) const
+{
+  std::string esmNames;
+  for (size_t i = 0; i < fileNames.size(); i++)
+  {
+    // record offsets are stored as 32-bit integers
+    if (esmFiles[i]->size() > 0xFFFFFFFFU)
+      return;
+    esmNames += fileNames[i];
+    esmNames += '\0';
+  }
+  if (recordBuf.size() >= 0xFFFFFFFFU || esmNames.length() >= 0xFFFFFFFFU)
+    return;
+  std::vector< unsigned char >  buf;
+  buf.reserve(esmFiles.size() * 24 + recordBuf.size() * 32
+              + formIDMap.size() * 4 + esmNames.length() + 32);
+  writeIndexUInt32(buf, 0x494D5345);    // "ESMI"
+  writeIndexUInt32(buf, indexCacheVersion);
+  writeIndexUInt32(buf, std::uint32_t(esmFiles.size()));
+  writeIndexUInt32(buf, recordCnt);
+  writeIndexUInt32(buf, std::uint32_t(recordBuf.size()));
+  writeIndexUInt32(buf, std::uint32_t(formIDMap.size()));
+  writeIndexUInt32(buf, 0U);
+  writeIndexUInt32(buf, std::uint32_t(esmNames.length()));
+  for (size_t i = 0, n = 0; i < esmFiles.size(); i++)
+  {
+    std::uint64_t fileSize = esmFiles[i]->size();
+    writeIndexUInt32(buf, std::uint32_t(fileSize));
+    writeIndexUInt32(buf, std::uint32_t(fileSize >> 32));
+    writeIndexUInt32(buf, std::uint32_t(fileModTimes[i]));
+    writeIndexUInt32(buf, std::uint32_t(std::uint64_t(fileModTimes[i]) >> 32));
+    writeIndexUInt32(buf, std::uint32_t(n));
+    writeIndexUInt32(buf, 0U);
+    n = n + fileNames[i].length() + 1;
+  }
+  for (size_t i = 0; i < recordBuf.size(); i++)
+  {
+    const ESMRecord&  r = recordBuf[i];
+    writeIndexUInt32(buf, r.type);
+    writeIndexUInt32(buf, r.flags);
+    writeIndexUInt32(buf, r.formID);
+    writeIndexUInt32(buf, r.parent);
+    writeIndexUInt32(buf, r.children);
+    writeIndexUInt32(buf, r.next);
+    std::uint32_t fileIndex = 0xFFFFFFFFU;
+    std::uint32_t offs = 0U;
+    for (size_t j = 0; r.fileData && j < esmFiles.size(); j++)
+    {
+      const unsigned char *p = esmFiles[j]->getDataPtr();
+      if (r.fileData >= p && r.fileData < (p + esmFiles[j]->size()))
+      {
+        fileIndex = std::uint32_t(j);
+        offs = std::uint32_t(r.fileData - p);
+        break;
+      }
+    }
+    writeIndexUInt32(buf, fileIndex);
+    writeIndexUInt32(buf, offs);
+  }
+  for (size_t i = 0; i < formIDMap.size(); i++)
+    writeIndexUInt32(buf, formIDMap[i]);
+  // write to a temporary file first, so that other processes never see
+  // an incomplete index
+  std::string tmpFileName(cacheFileName);
+  {
+    char    tmpBuf[32];
+#if defined(_WIN32) || defined(_WIN64)
+    std::snprintf(tmpBuf, 32, ".%d.tmp", int(_getpid()));
+#else
+    std::snprintf(tmpBuf, 32, ".%d.tmp", int(getpid()));
+#endif
+    tmpFileName += tmpBuf;
+  }
+  try
+  {
+    {
+      OutputFile  f(tmpFileName.c_str(), 0);
+      f.writeData(&(buf.front()), buf.size());
+      f.writeData(esmNames.c_str(), esmNames.length());
+    }
+    if (std::rename(tmpFileName.c_str(), cacheFileName) != 0)
+    {
+      (void) std::remove(cacheFileName);
+      if (std::rename(tmpFileName.c_str(), cacheFileName) != 0)
+        (void) std::remove(tmpFileName.c_str());
+    }
+  }
+  catch (FO76UtilsError&)
+  {
+    // the cache is optional, ignore errors
+    (void) std::remove(tmpFileName.c_str());
+  }
+}
+
+void ESMFile::loadRecordIndex(const std::vector< std::string >& fileNames)
+{
+  // find the top level records and groups, which are then scanned
+  // on multiple threads
+  std::vector< TopLevelRecord > topLevelRecords;
+  for (size_t i = 0; i < esmFiles.size(); i++)
+  {
+    FileBuffer& buf = *(esmFiles[i]);
+    size_t  offs = 0;
+    while (offs < buf.size())
+    {
+      TopLevelRecord  t;
+      t.fileName = fileNames[i].c_str();
+      t.fileIndex = i;
+      t.startPos = offs;
+      t.endPos = buf.size();
+      t.recordCnt = 0;
+      t.groupCnt = 0;
+      t.maxFormID = 0U;
+      t.firstGroup = 0;
+      t.n = 0U;
+      t.isNewRecord = false;
+      if ((offs + recordHdrSize) <= buf.size())
+      {
+        size_t  recordSize = FileBuffer::readUInt32Fast(buf.getDataPtr()
+                                                        + (offs + 4));
+        if (!FileBuffer::checkType(
+                 FileBuffer::readUInt32Fast(buf.getDataPtr() + offs),
+                 "GRUP"))
+        {
+          recordSize = recordSize + recordHdrSize;
+        }
+        else if (recordSize < recordHdrSize)
+        {
+          recordSize = buf.size();        // invalid group size
+        }
+        if (recordSize <= (buf.size() - offs))
+          t.endPos = offs + recordSize;
+      }
+      // errors are reported by scanTopLevelRecord()
+      offs = t.endPos;
+      topLevelRecords.push_back(t);
+    }
+  }
+  loadTopLevelRecords(topLevelRecords, 0, topLevelRecords.size(), false);
+
+  size_t  groupCnt = 0;
+  unsigned int  maxFormID = 0;
+  for (size_t i = 0; i < topLevelRecords.size(); i++)
+  {
+    const TopLevelRecord& t = topLevelRecords[i];
+    recordCnt = recordCnt + (unsigned int) t.recordCnt;
+    topLevelRecords[i].firstGroup = groupCnt;
+    groupCnt = groupCnt + t.groupCnt;
+    maxFormID = (t.maxFormID > maxFormID ? t.maxFormID : maxFormID);
+  }
+  recordBuf.resize(recordCnt + groupCnt);
+  formIDMap.resize(maxFormID + 1U, (unsigned int) recordBuf.size());
+
+  unsigned int  n = 0;
+  // files that contain the same form ID more than once are loaded on a
+  // single thread, so that the last instance of the record is used
+  std::vector< bool > duplicateFormIDs(esmFiles.size(), false);
+  for (size_t i = 0; i < esmFiles.size(); i++)
+  {
+    FileBuffer& buf = *(esmFiles[i]);
+    buf.setPosition(0);
+    unsigned int  firstRecord = n;
+    while (buf.getPosition() < buf.size())
+    {
+      unsigned int  recordType = buf.readUInt32Fast();
+      unsigned int  recordSize = buf.readUInt32Fast();
+      (void) buf.readUInt32Fast();      // flags
+      unsigned int  formID = buf.readUInt32Fast();
+      // skip version control info
+      buf.setPosition(buf.getPosition() + (recordHdrSize - 16));
+      if (!FileBuffer::checkType(recordType, "GRUP") && formID <= maxFormID)
+      {
+        if (formIDMap[formID] >= firstRecord &&
+            formIDMap[formID] < recordBuf.size())
+        {
+          duplicateFormIDs[i] = true;
+        }
+        formIDMap[formID] = n;
+        n++;
+        buf.setPosition(buf.getPosition() + recordSize);
+      }
+    }
+  }
+
+  groupCnt = 0;
+  for (size_t i = 0, j = 0; i < esmFiles.size(); i++)
+  {
+    FileBuffer& buf = *(esmFiles[i]);
+    size_t  startRecord = j;
+    while (j < topLevelRecords.size() && topLevelRecords[j].fileIndex == i)
+      j++;
+    if (duplicateFormIDs[i])
+    {
+      buf.setPosition(0);
+      n = loadRecords(groupCnt, buf, buf.size(), 0U);
+    }
+    else
+    {
+      for (size_t k = startRecord; k < j; k++)
+      {
+        TopLevelRecord& t = topLevelRecords[k];
+        const unsigned char *p = buf.getDataPtr() + t.startPos;
+        if (FileBuffer::checkType(FileBuffer::readUInt32Fast(p), "GRUP"))
+          t.n = (unsigned int) t.firstGroup | 0x80000000U;
+        else
+          t.n = FileBuffer::readUInt32Fast(p + 12);
+        const ESMRecord *r = findRecord(t.n);
+        t.isNewRecord = (r && !r->fileData);
+        groupCnt = groupCnt + t.groupCnt;
+      }
+      loadTopLevelRecords(topLevelRecords, startRecord, j, true);
+      // link the top level records in the same way as loadRecords()
+      ESMRecord *prv = (ESMRecord *) 0;
+      n = 0U;
+      for (size_t k = startRecord; k < j; k++)
+      {
+        if (!topLevelRecords[k].isNewRecord)
+          continue;
+        ESMRecord *r = findRecord(topLevelRecords[k].n);
+        if (prv)
+          prv->next = topLevelRecords[k].n;
+        prv = r;
+        if (!n)
+          n = topLevelRecords[k].n;
+      }
+    }
+    ESMRecord *r = findRecord(0U);
+    if (n != 0U && r && r->next != n)
+    {
+      while (r->next)
+        r = findRecord(r->next);
+      r->next = n;
+    }
+  }
+}
+
 ESMFile::ESMFile(const char *fileNames, bool enableZLibCache)
   : recordCnt(0),
     recordHdrSize(0),
     esmVersion(0),
     esmFlags(0),
-    zlibBufIndex(0),
-    zlibBufRecord(0xFFFFFFFFU)
+    zlibCacheShardSize(!enableZLibCache ? (size_t(2) << 20) : ~(size_t(0))),
+    fileNameHash(0U),
+    fileInfoHash(0U)
 {
   try
   {
@@ -163,98 +730,40 @@ ESMFile::ESMFile(const char *fileNames, bool enableZLibCache)
       }
     }
 
-    size_t  compressedCnt = 0;
-    size_t  groupCnt = 0;
-    unsigned int  maxFormID = 0;
-    for (size_t i = 0; i < esmFiles.size(); i++)
-    {
-      FileBuffer& buf = *(esmFiles[i]);
-      buf.setPosition(0);
-      while (buf.getPosition() < buf.size())
-      {
-        if ((buf.getPosition() + recordHdrSize) > buf.size())
-          throw FO76UtilsError("end of input file %s", tmpFileNames[i].c_str());
-        unsigned int  recordType = buf.readUInt32Fast();
-        unsigned int  recordSize = buf.readUInt32Fast();
-        unsigned int  flags = buf.readUInt32Fast();
-        unsigned int  formID = buf.readUInt32Fast();
-        // skip version control info
-        buf.setPosition(buf.getPosition() + (recordHdrSize - 16));
-        if (FileBuffer::checkType(recordType, "GRUP"))
-        {
-          if (recordSize < recordHdrSize ||
-              (buf.getPosition() + (recordSize - recordHdrSize)) > buf.size())
-          {
-            throw FO76UtilsError("%s: invalid group size",
-                                 tmpFileNames[i].c_str());
-          }
-          groupCnt++;
-        }
-        else
-        {
-          if (formID > 0x0FFFFFFFU)
-          {
-            throw FO76UtilsError("%s: invalid form ID",
-                                 tmpFileNames[i].c_str());
-          }
-          maxFormID = (formID > maxFormID ? formID : maxFormID);
-          if ((recordSize < 10 && (flags & 0x00040000) != 0) ||
-              (buf.getPosition() + recordSize) > buf.size())
-          {
-            throw FO76UtilsError("%s: invalid record size",
-                                 tmpFileNames[i].c_str());
-          }
-          recordCnt++;
-          if (flags & 0x00040000)
-            compressedCnt++;
-          buf.setPosition(buf.getPosition() + recordSize);
-        }
-      }
-    }
-    recordBuf.resize(recordCnt + groupCnt);
-    formIDMap.resize(maxFormID + 1U, (unsigned int) recordBuf.size());
-    if (compressedCnt)
+    std::string cacheFileName;
+    std::vector< std::int64_t > fileModTimes;
+    bool    indexCacheEnabled =
+        getIndexCacheFileName(cacheFileName, fileModTimes, tmpFileNames);
+    if (!(indexCacheEnabled &&
+          loadIndexCache(cacheFileName.c_str(), tmpFileNames, fileModTimes)))
     {
-      if (!enableZLibCache)
-        compressedCnt = 1;
-      zlibBuf.resize(compressedCnt);
+      loadRecordIndex(tmpFileNames);
+      if (indexCacheEnabled)
+        saveIndexCache(cacheFileName.c_str(), tmpFileNames, fileModTimes);
     }
-
-    unsigned int  n = 0;
-    for (size_t i = 0; i < esmFiles.size(); i++)
+    if (indexCacheEnabled)
     {
-      FileBuffer& buf = *(esmFiles[i]);
-      buf.setPosition(0);
-      while (buf.getPosition() < buf.size())
+      // FNV-1a hash of the cache file name (which includes a hash of the
+      // ESM path names), and the file sizes and modification times
+      std::uint64_t h = 0xCBF29CE484222325ULL;
+      for (size_t i = 0; i <= cacheFileName.length(); i++)
       {
-        unsigned int  recordType = buf.readUInt32Fast();
-        unsigned int  recordSize = buf.readUInt32Fast();
-        (void) buf.readUInt32Fast();    // flags
-        unsigned int  formID = buf.readUInt32Fast();
-        // skip version control info
-        buf.setPosition(buf.getPosition() + (recordHdrSize - 16));
-        if (!FileBuffer::checkType(recordType, "GRUP") && formID <= maxFormID)
-        {
-          formIDMap[formID] = n;
-          n++;
-          buf.setPosition(buf.getPosition() + recordSize);
-        }
+        h = h ^ (unsigned char) cacheFileName.c_str()[i];
+        h = h * 0x00000100000001B3ULL;
       }
-    }
-
-    groupCnt = 0;
-    for (size_t i = 0; i < esmFiles.size(); i++)
-    {
-      FileBuffer& buf = *(esmFiles[i]);
-      buf.setPosition(0);
-      n = loadRecords(groupCnt, buf, buf.size(), 0U);
-      ESMRecord *r = findRecord(0U);
-      if (n != 0U && r && r->next != n)
+      fileNameHash = (h ? h : 1U);
+      for (size_t i = 0; i < esmFiles.size(); i++)
       {
-        while (r->next)
-          r = findRecord(r->next);
-        r->next = n;
+        std::uint64_t tmp[2];
+        tmp[0] = esmFiles[i]->size();
+        tmp[1] = std::uint64_t(fileModTimes[i]);
+        for (size_t j = 0; j < 16; j++)
+        {
+          h = h ^ ((tmp[j >> 3] >> ((j & 7) << 3)) & 0xFFU);
+          h = h * 0x00000100000001B3ULL;
+        }
       }
+      fileInfoHash = (h ? h : 1U);
     }
   }
   catch (...)
@@ -293,9 +802,14 @@ ESMFile::ESMField::ESMField(ESMFile& f, const ESMRecord& r)
   if (r.type == 0x50555247)             // "GRUP"
     return;
   if (r.flags & 0x00040000)             // compressed record
-    fileBuf = f.uncompressRecord(*(f.findRecord(r.formID)));
+  {
+    f.uncompressRecord(recordData, r);
+    fileBuf = &(recordData->front());
+  }
   else
+  {
     fileBuf = r.fileData;
+  }
   fileBufSize = f.recordHdrSize;
   filePos = 4;
   dataRemaining = readUInt32Fast();
@@ -312,9 +826,14 @@ ESMFile::ESMField::ESMField(ESMFile& f, unsigned int formID)
   if (r->type == 0x50555247)            // "GRUP"
     return;
   if (r->flags & 0x00040000)            // compressed record
-    fileBuf = f.uncompressRecord(*(f.findRecord(r->formID)));
+  {
+    f.uncompressRecord(recordData, *r);
+    fileBuf = &(recordData->front());
+  }
   else
+  {
     fileBuf = r->fileData;
+  }
   fileBufSize = f.recordHdrSize;
   filePos = 4;
   dataRemaining = readUInt32Fast();
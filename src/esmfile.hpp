@@ -5,6 +5,10 @@
 #include "common.hpp"
 #include "filebuf.hpp"
 
+#include <thread>
+#include <mutex>
+#include <memory>
+
 class ESMFile
 {
  public:
@@ -29,6 +33,9 @@ class ESMFile
   };
   class ESMField : public FileBuffer
   {
+   protected:
+    // decompressed record data, if the record is compressed
+    std::shared_ptr< std::vector< unsigned char > > recordData;
    public:
     unsigned int  type;
     unsigned int  dataRemaining;
@@ -64,12 +71,41 @@ class ESMFile
   // 0xC3: Fallout 76 (Steel Dawn and newer)
   unsigned char esmVersion;
   unsigned short  esmFlags;     // 0x80: localized strings
-  unsigned int  zlibBufIndex;
-  unsigned int  zlibBufRecord;
   std::vector< ESMRecord >    recordBuf;
   std::vector< unsigned int > formIDMap;
-  std::vector< std::vector< unsigned char > > zlibBuf;
+  // Decompressed records are stored in an LRU cache that is split into
+  // shards by form ID, each with its own mutex, so that ESMField objects can
+  // be created on multiple threads. The size of each shard is limited to
+  // zlibCacheShardSize bytes, but at least the most recently used record is
+  // kept. Evicted data remains valid until the ESMField using it is
+  // destroyed.
+  struct ZLibCacheEntry
+  {
+    std::shared_ptr< std::vector< unsigned char > > data;
+    unsigned long long  lastUsed;
+  };
+  struct ZLibCacheShard
+  {
+    std::mutex  cacheMutex;
+    std::map< unsigned int, ZLibCacheEntry >  records;
+    // form IDs in LRU order, indexed by ZLibCacheEntry::lastUsed
+    std::map< unsigned long long, unsigned int >  useOrder;
+    size_t      dataSize;
+    unsigned long long  useCnt;
+    ZLibCacheShard()
+      : dataSize(0),
+        useCnt(0ULL)
+    {
+    }
+  };
+  static const size_t zlibCacheShardCnt = 16;
+  size_t  zlibCacheShardSize;
+  ZLibCacheShard  zlibCache[zlibCacheShardCnt];
   std::vector< FileBuffer * > esmFiles;
+  static const std::uint32_t  indexCacheVersion = 2U;
+  // hashes of the names, and the sizes and modification times of the files
+  std::uint64_t fileNameHash;
+  std::uint64_t fileInfoHash;
   inline const ESMRecord *findRecord(unsigned int n) const
   {
     size_t  offs = recordBuf.size();
@@ -85,11 +121,56 @@ class ESMFile
   {
     return const_cast< ESMRecord * >(((const ESMFile *) this)->findRecord(n));
   }
-  const unsigned char *uncompressRecord(ESMRecord& r);
+  // top level records and groups, which are scanned and loaded in parallel
+  struct TopLevelRecord
+  {
+    const char    *fileName;
+    size_t        fileIndex;
+    size_t        startPos;
+    size_t        endPos;
+    size_t        recordCnt;
+    size_t        groupCnt;         // including the record itself if group
+    unsigned int  maxFormID;
+    size_t        firstGroup;       // number of the first group in the record
+    unsigned int  n;                // form ID, or group number | 0x80000000
+    bool          isNewRecord;      // true if n was not loaded from a master
+    std::string   errMsg;
+  };
+  // returns the decompressed data of r in recordData, this is thread safe
+  void uncompressRecord(std::shared_ptr< std::vector< unsigned char > >&
+                            recordData, const ESMRecord& r);
   unsigned int loadRecords(size_t& groupCnt, FileBuffer& buf,
                            size_t endPos, unsigned int parent);
+  // count and validate the records and groups of a top level record
+  void scanTopLevelRecord(TopLevelRecord& t) const;
+  // loadPass = false: scanTopLevelRecord(), true: loadRecords()
+  static void loadTopLevelThread(ESMFile *p,
+                                 std::vector< TopLevelRecord > *topLevelRecords,
+                                 size_t *nextRecord, size_t endRecord,
+                                 std::mutex *recordMutex, bool loadPass);
+  void loadTopLevelRecords(std::vector< TopLevelRecord >& topLevelRecords,
+                           size_t startRecord, size_t endRecord,
+                           bool loadPass);
+  // parse the ESM files to create recordBuf and formIDMap
+  void loadRecordIndex(const std::vector< std::string >& fileNames);
+  // The record index (recordBuf and formIDMap) can be cached in the
+  // directory specified by the FO76UTILS_CACHEPATH environment variable.
+  // getIndexCacheFileName() returns false if the cache is not enabled,
+  // fileModTimes is filled with the modification times of the ESM files.
+  static bool getIndexCacheFileName(
+      std::string& cacheFileName, std::vector< std::int64_t >& fileModTimes,
+      const std::vector< std::string >& fileNames);
+  // returns false if the cache file does not exist or is not valid
+  bool loadIndexCache(const char *cacheFileName,
+                      const std::vector< std::string >& fileNames,
+                      const std::vector< std::int64_t >& fileModTimes);
+  void saveIndexCache(const char *cacheFileName,
+                      const std::vector< std::string >& fileNames,
+                      const std::vector< std::int64_t >& fileModTimes) const;
  public:
   // fileNames can be a single ESM file, or a comma separated list
+  // if enableZLibCache is true, the size of the cache of decompressed
+  // records is not limited
   ESMFile(const char *fileNames, bool enableZLibCache = false);
   virtual ~ESMFile();
   inline const ESMRecord& operator[](size_t n) const
@@ -122,6 +203,17 @@ class ESMFile
     return bool(esmFlags & 0x80);
   }
   void getVersionControlInfo(ESMVCInfo& f, const ESMRecord& r) const;
+  // hashes of the names of the ESM files, and of their names, sizes and
+  // modification times, for identifying cached data derived from them
+  // both are 0 if caching is not enabled with FO76UTILS_CACHEPATH
+  inline std::uint64_t getFileNameHash() const
+  {
+    return fileNameHash;
+  }
+  inline std::uint64_t getFileInfoHash() const
+  {
+    return fileInfoHash;
+  }
 };
 
 #endif
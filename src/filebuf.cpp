@@ -347,6 +347,22 @@ bool FileBuffer::getDefaultDataPath(std::string& dataPath)
   return (dataPath.length() > 0);
 }
 
+bool FileBuffer::getCachePath(std::string& cachePath)
+{
+  cachePath.clear();
+  const char  *s = std::getenv("FO76UTILS_CACHEPATH");
+  if (!s)
+    return false;
+  cachePath = s;
+  while (cachePath.length() > 1 &&
+         (cachePath[cachePath.length() - 1] == '/' ||
+          cachePath[cachePath.length() - 1] == '\\'))
+  {
+    cachePath.resize(cachePath.length() - 1);
+  }
+  return (cachePath.length() > 0);
+}
+
 std::FILE * FileBuffer::openFileInDataPath(const char *fileName,
                                            const char *mode)
 {
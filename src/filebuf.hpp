@@ -72,6 +72,8 @@ class FileBuffer
   FileBuffer(const char *fileName);
   virtual ~FileBuffer();
   static bool getDefaultDataPath(std::string& dataPath);
+  // returns the directory for cache files from FO76UTILS_CACHEPATH
+  static bool getCachePath(std::string& cachePath);
   static std::FILE *openFileInDataPath(const char *fileName, const char *mode);
 };
 
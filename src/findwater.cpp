@@ -227,8 +227,10 @@ static std::vector< NIFFile::NIFTriShape >& getMeshData(ESMFile& esmFile,
     try
     {
       std::vector< unsigned char >  fileBuf;
-      meshArchiveFile->extractFile(fileBuf, modelPath);
-      nifFile = new NIFFile(&(fileBuf.front()), fileBuf.size());
+      const unsigned char *fileData = (unsigned char *) 0;
+      size_t  fileSize =
+          meshArchiveFile->extractFile(fileData, fileBuf, modelPath);
+      nifFile = new NIFFile(fileData, fileSize);
       nifFile->getMesh(i->second);
       nifFiles.push_back(nifFile);
       return i->second;
@@ -70,6 +70,14 @@ struct FloatVector4
                       const std::uint32_t *p1_2, const std::uint32_t *p2_2,
                       const std::uint32_t *p1_3, const std::uint32_t *p2_3,
                       float xf, float yf, bool isSRGB = false);
+  // bilinear interpolation of p0 to p3 with weights xf0, yf0, and of p4 to p7
+  // with weights xf1, yf1, the two results are blended with weight mf
+  static inline FloatVector4 interpolateTrilinear(
+      const std::uint32_t *p0, const std::uint32_t *p1,
+      const std::uint32_t *p2, const std::uint32_t *p3, float xf0, float yf0,
+      const std::uint32_t *p4, const std::uint32_t *p5,
+      const std::uint32_t *p6, const std::uint32_t *p7, float xf1, float yf1,
+      float mf);
   static inline FloatVector4 convertFloat16(std::uint64_t n);
   static inline FloatVector4 convertA2R10G10B10(const std::uint32_t& c);
   // convert from the pixel format selected with USE_PIXELFMT_RGB10A2
@@ -101,6 +109,8 @@ struct FloatVector4
   inline FloatVector4& clearV3();
   inline FloatVector4& minValues(const FloatVector4& r);
   inline FloatVector4& maxValues(const FloatVector4& r);
+  // returns a 4-bit mask of the elements that are less than those of r
+  inline unsigned int getLessThanMask(const FloatVector4& r) const;
   inline float dotProduct(const FloatVector4& r) const;
   // dot product of first three elements
   inline float dotProduct3(const FloatVector4& r) const;
@@ -333,6 +343,15 @@ inline FloatVector4& FloatVector4::maxValues(const FloatVector4& r)
   return (*this);
 }
 
+inline unsigned int FloatVector4::getLessThanMask(const FloatVector4& r) const
+{
+  XMM_Float tmp;
+  __asm__ ("vcmpltps %2, %1, %0" : "=x" (tmp) : "x" (v), "xm" (r.v));
+  unsigned int  m;
+  __asm__ ("vmovmskps %1, %0" : "=r" (m) : "x" (tmp));
+  return m;
+}
+
 inline float FloatVector4::dotProduct(const FloatVector4& r) const
 {
   XMM_Float tmp1;
@@ -768,6 +787,14 @@ inline FloatVector4& FloatVector4::maxValues(const FloatVector4& r)
   return (*this);
 }
 
+inline unsigned int FloatVector4::getLessThanMask(const FloatVector4& r) const
+{
+  return ((unsigned int) (v[0] < r.v[0])
+          | ((unsigned int) (v[1] < r.v[1]) << 1)
+          | ((unsigned int) (v[2] < r.v[2]) << 2)
+          | ((unsigned int) (v[3] < r.v[3]) << 3));
+}
+
 inline float FloatVector4::dotProduct(const FloatVector4& r) const
 {
   FloatVector4  tmp(*this);
@@ -1019,6 +1046,55 @@ inline FloatVector4::FloatVector4(
   *this = v0;
 }
 
+inline FloatVector4 FloatVector4::interpolateTrilinear(
+    const std::uint32_t *p0, const std::uint32_t *p1,
+    const std::uint32_t *p2, const std::uint32_t *p3, float xf0, float yf0,
+    const std::uint32_t *p4, const std::uint32_t *p5,
+    const std::uint32_t *p6, const std::uint32_t *p7, float xf1, float yf1,
+    float mf)
+{
+#if ENABLE_X86_64_AVX
+  // both mip levels are interpolated at once, using 256-bit vectors
+  XMM_Float tmp1, tmp2;
+  YMM_Float v0, v1, v2, v3;
+  __asm__ ("vpmovzxbd %1, %0" : "=x" (tmp1) : "m" (*p0));
+  __asm__ ("vpmovzxbd %1, %0" : "=x" (tmp2) : "m" (*p4));
+  __asm__ ("vinsertf128 $0x01, %2, %t1, %0"
+           : "=x" (v0) : "x" (tmp1), "x" (tmp2));
+  __asm__ ("vpmovzxbd %1, %0" : "=x" (tmp1) : "m" (*p1));
+  __asm__ ("vpmovzxbd %1, %0" : "=x" (tmp2) : "m" (*p5));
+  __asm__ ("vinsertf128 $0x01, %2, %t1, %0"
+           : "=x" (v1) : "x" (tmp1), "x" (tmp2));
+  __asm__ ("vpmovzxbd %1, %0" : "=x" (tmp1) : "m" (*p2));
+  __asm__ ("vpmovzxbd %1, %0" : "=x" (tmp2) : "m" (*p6));
+  __asm__ ("vinsertf128 $0x01, %2, %t1, %0"
+           : "=x" (v2) : "x" (tmp1), "x" (tmp2));
+  __asm__ ("vpmovzxbd %1, %0" : "=x" (tmp1) : "m" (*p3));
+  __asm__ ("vpmovzxbd %1, %0" : "=x" (tmp2) : "m" (*p7));
+  __asm__ ("vinsertf128 $0x01, %2, %t1, %0"
+           : "=x" (v3) : "x" (tmp1), "x" (tmp2));
+  __asm__ ("vcvtdq2ps %0, %0" : "+x" (v0));
+  __asm__ ("vcvtdq2ps %0, %0" : "+x" (v1));
+  __asm__ ("vcvtdq2ps %0, %0" : "+x" (v2));
+  __asm__ ("vcvtdq2ps %0, %0" : "+x" (v3));
+  YMM_Float xf = { xf0, xf0, xf0, xf0, xf1, xf1, xf1, xf1 };
+  YMM_Float yf = { yf0, yf0, yf0, yf0, yf1, yf1, yf1, yf1 };
+  v1 -= v0;
+  v3 -= v2;
+  v1 *= xf;
+  v3 *= xf;
+  v0 += v1;
+  v0 += ((v2 + v3 - v0) * yf);
+  FloatVector4  c0, c1;
+  __asm__ ("vmovaps %x1, %0" : "=x" (c0.v) : "x" (v0));
+  __asm__ ("vextractf128 $0x01, %1, %0" : "=x" (c1.v) : "x" (v0));
+#else
+  FloatVector4  c0(p0, p1, p2, p3, xf0, yf0);
+  FloatVector4  c1(p4, p5, p6, p7, xf1, yf1);
+#endif
+  return ((c0 * (1.0f - mf)) + (c1 * mf));
+}
+
 inline FloatVector4 FloatVector4::convertRGBA32(const std::uint32_t& c)
 {
 #if USE_PIXELFMT_RGB10A2
@@ -3,98 +3,291 @@
 #include "landdata.hpp"
 #include "bgsmfile.hpp"
 
-void LandscapeData::allocateDataBuf(unsigned int formatMask, bool isFO76)
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(_WIN32) || defined(_WIN64)
+#  include <process.h>
+#else
+#  include <unistd.h>
+#endif
+
+void LandscapeData::getDataSizes(size_t *dataSizes,
+                                 unsigned int formatMask, bool isFO76) const
 {
-  size_t  hmapDataSize = 0;
-  size_t  ltexData32Size = 0;
-  size_t  vnmlDataSize = 0;
-  size_t  vclrData24Size = 0;
-  size_t  ltexData16Size = 0;
-  size_t  vclrData16Size = 0;
-  size_t  gcvrDataSize = 0;
-  size_t  txtSetDataSize = 0;
+  for (size_t i = 0; i < 8; i++)
+    dataSizes[i] = 0;
   size_t  vertexCnt = size_t(getImageWidth()) * size_t(getImageHeight());
   if (formatMask & 0x01)
-    hmapDataSize = vertexCnt * sizeof(std::uint16_t);
+    dataSizes[0] = vertexCnt * sizeof(std::uint16_t);
   if (!isFO76)
   {
     if (formatMask & 0x02)
-      ltexData32Size = vertexCnt * sizeof(std::uint32_t);
+      dataSizes[1] = vertexCnt * sizeof(std::uint32_t);
     if (formatMask & 0x04)
-      vnmlDataSize = vertexCnt * 3;
+      dataSizes[2] = vertexCnt * 3;
     if (formatMask & 0x08)
-      vclrData24Size = vertexCnt * 3;
+      dataSizes[3] = vertexCnt * 3;
   }
   else
   {
     if (formatMask & 0x02)
-      ltexData16Size = vertexCnt * sizeof(std::uint16_t);
+      dataSizes[4] = vertexCnt * sizeof(std::uint16_t);
     if (formatMask & 0x08)
     {
-      vclrData16Size = vertexCnt * sizeof(std::uint16_t);
+      dataSizes[5] = vertexCnt * sizeof(std::uint16_t);
       if (cellResolution >= 128)
-        vclrData16Size = vclrData16Size >> 4;
+        dataSizes[5] = dataSizes[5] >> 4;
       else if (cellResolution >= 64)
-        vclrData16Size = vclrData16Size >> 2;
+        dataSizes[5] = dataSizes[5] >> 2;
     }
     if (formatMask & 0x10)
-      gcvrDataSize = vertexCnt;
+      dataSizes[6] = vertexCnt;
   }
   if (formatMask & 0x12)
   {
-    txtSetDataSize =
+    dataSizes[7] =
         size_t(cellMaxX + 1 - cellMinX) * size_t(cellMaxY + 1 - cellMinY) * 64;
   }
-  size_t  totalDataSize =
-      (hmapDataSize + ltexData32Size + vnmlDataSize + vclrData24Size
-       + ltexData16Size + vclrData16Size + gcvrDataSize + txtSetDataSize)
-      / sizeof(std::uint32_t);
+}
+
+void LandscapeData::setDataPointers(const unsigned char *p,
+                                    const size_t *dataSizes, size_t alignment)
+{
+  const unsigned char *dataPtrs[8];
+  for (size_t i = 0; i < 8; i++)
+  {
+    dataPtrs[i] = (unsigned char *) 0;
+    if (dataSizes[i])
+    {
+      dataPtrs[i] = p;
+      p = p + ((dataSizes[i] + (alignment - 1)) & ~(alignment - 1));
+    }
+  }
+  hmapData = reinterpret_cast< const std::uint16_t * >(dataPtrs[0]);
+  ltexData32 = reinterpret_cast< const std::uint32_t * >(dataPtrs[1]);
+  vnmlData = dataPtrs[2];
+  vclrData24 = dataPtrs[3];
+  ltexData16 = reinterpret_cast< const std::uint16_t * >(dataPtrs[4]);
+  vclrData16 = reinterpret_cast< const std::uint16_t * >(dataPtrs[5]);
+  gcvrData = dataPtrs[6];
+  txtSetData = dataPtrs[7];
+}
+
+void LandscapeData::allocateDataBuf(unsigned int formatMask, bool isFO76)
+{
+  size_t  dataSizes[8];
+  getDataSizes(dataSizes, formatMask, isFO76);
+  size_t  totalDataSize = 0;
+  for (size_t i = 0; i < 8; i++)
+    totalDataSize = totalDataSize + dataSizes[i];
+  totalDataSize = totalDataSize / sizeof(std::uint32_t);
   if (totalDataSize < 1)
     return;
   dataBuf.resize(totalDataSize);
-  unsigned char *p = reinterpret_cast< unsigned char * >(&(dataBuf.front()));
-  if (hmapDataSize)
+  setDataPointers(reinterpret_cast< unsigned char * >(&(dataBuf.front())),
+                  dataSizes, 1);
+  std::uint32_t *ltexBuf = dataBufPtr(ltexData32);
+  for (size_t i = 0; i < (dataSizes[1] / sizeof(std::uint32_t)); i++)
+    ltexBuf[i] = 0U;
+  unsigned char *txtSetBuf = dataBufPtr(txtSetData);
+  for (size_t i = 0; i < dataSizes[7]; i++)
+    txtSetBuf[i] = 0xFF;
+}
+
+LandscapeData::LoadThreadState::LoadThreadState(
+    LandscapeData *p, void (*func)(LandscapeData *, LoadThreadState *, size_t))
+  : landscapeData(p),
+    itemFunction(func),
+    nextItem(0),
+    itemCnt(0),
+    itemsRunning(0),
+    stopFlag(false)
+{
+}
+
+LandscapeData::LoadThreadState::~LoadThreadState()
+{
   {
-    hmapData = reinterpret_cast< std::uint16_t * >(p);
-    p = p + hmapDataSize;
+    std::lock_guard< std::mutex > loadLock(loadMutex);
+    stopFlag = true;
+    newItemsCond.notify_all();
   }
-  if (ltexData32Size)
+  for (size_t i = 0; i < threads.size(); i++)
   {
-    ltexData32 = reinterpret_cast< std::uint32_t * >(p);
-    for (size_t i = 0; i < (ltexData32Size / sizeof(std::uint32_t)); i++)
-      ltexData32[i] = 0U;
-    p = p + ltexData32Size;
+    if (threads[i])
+    {
+      threads[i]->join();
+      delete threads[i];
+    }
   }
-  if (vnmlDataSize)
+}
+
+void LandscapeData::LoadThreadState::runItem(size_t n)
+{
+  try
   {
-    vnmlData = p;
-    p = p + vnmlDataSize;
+    itemFunction(landscapeData, this, n);
   }
-  if (vclrData24Size)
+  catch (std::exception& e)
+  {
+    std::lock_guard< std::mutex > loadLock(loadMutex);
+    if (errMsg.empty())
+    {
+      errMsg = e.what();
+      if (errMsg.empty())
+        errMsg = "LandscapeData: error loading terrain data";
+    }
+    nextItem = itemCnt;                 // skip the remaining items
+  }
+}
+
+void LandscapeData::LoadThreadState::threadFunction(LoadThreadState *s)
+{
+  std::unique_lock< std::mutex >  loadLock(s->loadMutex);
+  while (!s->stopFlag)
   {
-    vclrData24 = p;
-    p = p + vclrData24Size;
+    if (s->nextItem >= s->itemCnt)
+    {
+      s->newItemsCond.wait(loadLock);
+      continue;
+    }
+    size_t  n = s->nextItem;
+    s->nextItem++;
+    s->itemsRunning++;
+    loadLock.unlock();
+    s->runItem(n);
+    loadLock.lock();
+    if (!(--(s->itemsRunning)))
+      s->itemsDoneCond.notify_all();
   }
-  if (ltexData16Size)
+}
+
+void LandscapeData::LoadThreadState::runItems(size_t n)
+{
+  if (n > 1 && threads.size() < 1)
   {
-    ltexData16 = reinterpret_cast< std::uint16_t * >(p);
-    p = p + ltexData16Size;
+    size_t  threadCnt = size_t(std::thread::hardware_concurrency());
+    threadCnt = std::min< size_t >(std::max< size_t >(threadCnt, 1), 16);
+    // the calling thread also runs items
+    for (size_t i = 1; i < threadCnt && i < n; i++)
+    {
+      try
+      {
+        threads.push_back(new std::thread(threadFunction, this));
+      }
+      catch (std::exception&)
+      {
+        break;
+      }
+    }
   }
-  if (vclrData16Size)
+  std::unique_lock< std::mutex >  loadLock(loadMutex);
+  errMsg.clear();
+  nextItem = 0;
+  itemCnt = n;
+  newItemsCond.notify_all();
+  while (true)
   {
-    vclrData16 = reinterpret_cast< std::uint16_t * >(p);
-    p = p + vclrData16Size;
+    if (nextItem < itemCnt)
+    {
+      size_t  i = nextItem;
+      nextItem++;
+      itemsRunning++;
+      loadLock.unlock();
+      runItem(i);
+      loadLock.lock();
+      itemsRunning--;
+    }
+    else if (itemsRunning)
+    {
+      itemsDoneCond.wait(loadLock);
+    }
+    else
+    {
+      break;
+    }
   }
-  if (gcvrDataSize)
+  if (!errMsg.empty())
+    throw FO76UtilsError(1, errMsg.c_str());
+}
+
+void LandscapeData::loadBTDCell(const BTDFile& btdFile, int x, int y,
+                                unsigned int formatMask, unsigned char mipLevel)
+{
+  size_t  n = size_t(cellResolution);
+  unsigned char m = 7 - mipLevel;
+  size_t  w = size_t(cellMaxX + 1 - cellMinX);
+  // the cell data is decoded directly to the output images, starting from
+  // the last (southernmost) row of the cell, with a negative pitch
+  size_t  offs = size_t((cellMaxY - y) << m) | (n - 1);
+  offs = ((offs * w) + size_t(x - cellMinX)) << m;
+  int     pitch = -(int(w << m));
+  if (formatMask & 0x01)                // height map
   {
-    gcvrData = p;
-    p = p + gcvrDataSize;
+    btdFile.getCellHeightMap(dataBufPtr(hmapData) + offs, x, y, mipLevel,
+                             pitch);
   }
-  if (txtSetDataSize)
+  if (formatMask & 0x02)                // land texture
   {
-    txtSetData = p;
-    for (size_t i = 0; i < txtSetDataSize; i++)
-      txtSetData[i] = 0xFF;
+    btdFile.getCellLandTexture(dataBufPtr(ltexData16) + offs, x, y, mipLevel,
+                               pitch);
+  }
+  if (formatMask & 0x08)                // terrain color
+  {
+    if (mipLevel > 2)
+    {
+      btdFile.getCellTerrainColor(dataBufPtr(vclrData16) + offs, x, y,
+                                  mipLevel, pitch);
+    }
+    else
+    {
+      size_t  offs2 = size_t((cellMaxY - y) << 5) | 31U;
+      offs2 = ((offs2 * w) + size_t(x - cellMinX)) << 5;
+      btdFile.getCellTerrainColor(dataBufPtr(vclrData16) + offs2, x, y, 2,
+                                  -(int(w << 5)));
+    }
+  }
+  if (formatMask & 0x10)                // ground cover
+  {
+    btdFile.getCellGroundCover(dataBufPtr(gcvrData) + offs, x, y, mipLevel,
+                               pitch);
+  }
+  if (formatMask & 0x12)                // texture set
+  {
+    unsigned char tmpBuf[64];
+    unsigned char *bufp8 = tmpBuf;
+    size_t  ltexCnt = btdFile.getLandTextureCount();
+    btdFile.getCellTextureSet(bufp8, x, y);
+    for (size_t yy = 0; yy < 2; yy++)
+    {
+      offs = size_t((cellMaxY - y) << 1) | (~yy & 1);
+      offs = ((offs * w) + size_t(x - cellMinX)) << 5;
+      for (size_t xx = 0; xx < 32; xx++, bufp8++, offs++)
+      {
+        unsigned char tmp = *bufp8;
+        if ((xx & 8) && tmp != 0xFF)
+          tmp = (unsigned char) ((ltexCnt + tmp) & 0xFF);
+        dataBufPtr(txtSetData)[offs] = tmp;
+      }
+    }
+  }
+}
+
+void LandscapeData::loadBTDTile(LandscapeData *p, LoadThreadState *s,
+                                size_t n)
+{
+  BTDLoadState& btdState = *(static_cast< BTDLoadState * >(s));
+  // each item is a tile of up to 8x8 cells, the tiles have already been
+  // loaded by the main thread
+  int     x0 = std::max(btdState.tileX0 + int(n << 3), p->cellMinX);
+  int     x1 = std::min(btdState.tileX0 + int(n << 3) + 7, p->cellMaxX);
+  for (int y = btdState.y0; y >= btdState.y1; y--)
+  {
+    for (int x = x0; x <= x1; x++)
+    {
+      p->loadBTDCell(*(btdState.btdFile), x, y,
+                     btdState.formatMask, btdState.mipLevel);
+    }
   }
 }
 
@@ -133,115 +326,29 @@ void LandscapeData::loadBTDFile(const char *btdFileName,
   ltexDPaths.resize(ltexCnt + gcvrCnt);
   ltexNPaths.resize(ltexCnt + gcvrCnt);
   allocateDataBuf(formatMask, true);
-  size_t  n = size_t(cellResolution);
-  unsigned char m = 7 - mipLevel;
-  std::vector< std::uint16_t >  tmpBuf(n * n);
-  int     x0 = cellMinX;
-  int     y0 = cellMaxY;
-  int     x = cellMinX;
-  int     y = cellMaxY;
-  while (true)
+  // decompress each row of 8x8 cell tiles in parallel, and then decode
+  // the cells of the tiles on multiple threads, the worker threads are
+  // created once for all rows
+  // the threads use the const getCell*() functions of btdFile, which throw
+  // an exception if a tile is not loaded, so the tile cache must be large
+  // enough for a whole row
+  unsigned int  dataMask = (formatMask & 0x0B) | ((formatMask & 0x10) >> 2);
+  BTDLoadState  s(this);
+  s.btdFile = &btdFile;
+  s.formatMask = formatMask;
+  s.mipLevel = mipLevel;
+  s.tileX0 = cellMinX - ((cellMinX - btdFile.getCellMinX()) & 7);
+  btdFile.setTileCacheSize(size_t(((cellMaxX - s.tileX0) >> 3) + 2));
+  for (int y0 = cellMaxY; y0 >= cellMinY; y0 = s.y1 - 1)
   {
-    size_t  w = size_t(cellMaxX + 1 - cellMinX);
-    if (formatMask & 0x01)              // height map
+    s.y0 = y0;
+    s.y1 = std::max(y0 - ((y0 - btdFile.getCellMinY()) & 7), cellMinY);
+    if (dataMask)
     {
-      std::uint16_t *bufp16 = &(tmpBuf.front());
-      btdFile.getCellHeightMap(bufp16, x, y, mipLevel);
-      for (size_t yy = 0; yy < n; yy++)
-      {
-        size_t  offs = size_t((cellMaxY - y) << m) | (~yy & (n - 1));
-        offs = ((offs * w) + size_t(x - cellMinX)) << m;
-        for (size_t xx = 0; xx < n; xx++, bufp16++, offs++)
-          hmapData[offs] = *bufp16;
-      }
-    }
-    if (formatMask & 0x02)              // land texture
-    {
-      std::uint16_t *bufp16 = &(tmpBuf.front());
-      btdFile.getCellLandTexture(bufp16, x, y, mipLevel);
-      for (size_t yy = 0; yy < n; yy++)
-      {
-        size_t  offs = size_t((cellMaxY - y) << m) | (~yy & (n - 1));
-        offs = ((offs * w) + size_t(x - cellMinX)) << m;
-        for (size_t xx = 0; xx < n; xx++, bufp16++, offs++)
-          ltexData16[offs] = *bufp16;
-      }
-    }
-    if (formatMask & 0x08)              // terrain color
-    {
-      std::uint16_t *bufp16 = &(tmpBuf.front());
-      if (mipLevel > 2)
-      {
-        btdFile.getCellTerrainColor(bufp16, x, y, mipLevel);
-        for (size_t yy = 0; yy < n; yy++)
-        {
-          size_t  offs = size_t((cellMaxY - y) << m) | (~yy & (n - 1));
-          offs = ((offs * w) + size_t(x - cellMinX)) << m;
-          for (size_t xx = 0; xx < n; xx++, bufp16++, offs++)
-            vclrData16[offs] = *bufp16;
-        }
-      }
-      else
-      {
-        btdFile.getCellTerrainColor(bufp16, x, y, 2);
-        for (size_t yy = 0; yy < 32; yy++)
-        {
-          size_t  offs = size_t((cellMaxY - y) << 5) | (31U - yy);
-          offs = ((offs * w) + size_t(x - cellMinX)) << 5;
-          for (size_t xx = 0; xx < 32; xx++, bufp16++, offs++)
-            vclrData16[offs] = *bufp16;
-        }
-      }
-    }
-    if (formatMask & 0x10)              // ground cover
-    {
-      unsigned char   *bufp8 =
-          reinterpret_cast< unsigned char * >(&(tmpBuf.front()));
-      btdFile.getCellGroundCover(bufp8, x, y, mipLevel);
-      for (size_t yy = 0; yy < n; yy++)
-      {
-        size_t  offs = size_t((cellMaxY - y) << m) | (~yy & (n - 1));
-        offs = ((offs * w) + size_t(x - cellMinX)) << m;
-        for (size_t xx = 0; xx < n; xx++, bufp8++, offs++)
-          gcvrData[offs] = *bufp8;
-      }
-    }
-    if (formatMask & 0x12)              // texture set
-    {
-      unsigned char   *bufp8 =
-          reinterpret_cast< unsigned char * >(&(tmpBuf.front()));
-      btdFile.getCellTextureSet(bufp8, x, y);
-      for (size_t yy = 0; yy < 2; yy++)
-      {
-        size_t  offs = size_t((cellMaxY - y) << 1) | (~yy & 1);
-        offs = ((offs * w) + size_t(x - cellMinX)) << 5;
-        for (size_t xx = 0; xx < 32; xx++, bufp8++, offs++)
-        {
-          unsigned char tmp = *bufp8;
-          if ((xx & 8) && tmp != 0xFF)
-            tmp = (unsigned char) ((ltexCnt + tmp) & 0xFF);
-          txtSetData[offs] = tmp;
-        }
-      }
-    }
-    x++;
-    if (x > cellMaxX || ((x - btdFile.getCellMinX()) & 7) == 0)
-    {
-      y--;
-      if (y < cellMinY || ((y - btdFile.getCellMinY()) & 7) == 7)
-      {
-        if (x > cellMaxX)
-        {
-          if (y < cellMinY)
-            break;
-          x = cellMinX;
-          y0 = y;
-        }
-        x0 = x;
-        y = y0;
-      }
-      x = x0;
+      btdFile.prefetchCells(cellMinX, s.y1, cellMaxX, s.y0,
+                            dataMask, mipLevel);
     }
+    s.runItems(size_t(((cellMaxX - s.tileX0) >> 3) + 1));
   }
 }
 
@@ -299,6 +406,143 @@ unsigned char LandscapeData::findTextureID(unsigned int formID)
   return (unsigned char) (ltexFormIDs.size() - 1);
 }
 
+void LandscapeData::loadESMLand(ESMFile& esmFile, ESMLandData& d,
+                                unsigned int formatMask)
+{
+  d.cellDataValidMask = 0;
+  d.zOffs = 0.0f;
+  d.zMin = landLevel;
+  d.zMax = landLevel;
+  const ESMFile::ESMRecord  *r = esmFile.getRecordPtr(d.formID);
+  if (!(r && *r == "LAND"))
+    return;
+  unsigned int  k = d.cellKey;
+  int     x = (int(k & 0xFFFFU) - (cellMinX + 32768)) << 5;
+  int     y = ((cellMaxY + 32768 - int((k >> 16) & 0xFFFFU)) << 5) + 31;
+  size_t  w = size_t(cellMaxX + 1 - cellMinX) << 5;
+  size_t  dataOffs = size_t(y) * w + size_t(x);
+  unsigned int  cellDataValidMask = 0;
+  unsigned int  textureQuadrant = 0;
+  unsigned int  textureLayer = 0;
+  ESMFile::ESMField f(esmFile, *r);
+  while (f.next())
+  {
+    if (f == "VHGT" && (formatMask & 0x01) && f.size() >= 1093)
+    {
+      // vertex heights
+      float   zOffs = f.readFloat() * 8.0f;
+      d.zOffs = zOffs;
+      int     z = 0;
+      std::uint16_t *p = dataBufPtr(hmapData) + dataOffs;
+      for (int yy = 0; yy < 32; yy++, p = p - (w + 32))
+      {
+        int     tmp = f.readUInt8Fast();
+        z += (!(tmp & 0x80) ? tmp : (tmp - 256));
+        *(p++) = (std::uint16_t) (z + 32768);
+        float   zf = zOffs + float(z << 3);
+        d.zMin = (zf < d.zMin ? zf : d.zMin);
+        d.zMax = (zf > d.zMax ? zf : d.zMax);
+        int     z0 = z;
+        for (int xx = 1; xx < 32; xx++)
+        {
+          tmp = f.readUInt8Fast();
+          z += (!(tmp & 0x80) ? tmp : (tmp - 256));
+          *(p++) = (std::uint16_t) (z + 32768);
+          zf = zOffs + float(z << 3);
+          d.zMin = (zf < d.zMin ? zf : d.zMin);
+          d.zMax = (zf > d.zMax ? zf : d.zMax);
+        }
+        z = z0;
+        (void) f.readUInt8Fast();
+      }
+      cellDataValidMask |= 1U;
+    }
+    else if (f == "VNML" && (formatMask & 0x04) && f.size() >= 3267)
+    {
+      // vertex normals
+      unsigned char *p = dataBufPtr(vnmlData) + (dataOffs * 3);
+      for (int yy = 0; yy < 32; yy++, p = p - ((w + 32) * 3))
+      {
+        for (int xx = 0; xx < 32; xx++, p = p + 3)
+        {
+          p[2] = (unsigned char) (f.readUInt8Fast() ^ 0x80);
+          p[1] = (unsigned char) (f.readUInt8Fast() ^ 0x80);
+          p[0] = (unsigned char) (f.readUInt8Fast() ^ 0x80);
+        }
+        f.setPosition(f.getPosition() + 3);
+      }
+      cellDataValidMask |= 4U;
+    }
+    else if (f == "VCLR" && (formatMask & 0x08) && f.size() >= 3267)
+    {
+      // vertex colors
+      unsigned char *p = dataBufPtr(vclrData24) + (dataOffs * 3);
+      for (int yy = 0; yy < 32; yy++, p = p - ((w + 32) * 3))
+      {
+        for (int xx = 0; xx < 32; xx++, p = p + 3)
+        {
+          p[2] = f.readUInt8Fast();
+          p[1] = f.readUInt8Fast();
+          p[0] = f.readUInt8Fast();
+        }
+        f.setPosition(f.getPosition() + 3);
+      }
+      cellDataValidMask |= 8U;
+    }
+    else if ((formatMask & 0x02) && f.size() >= 8)
+    {
+      // vertex textures
+      if (f == "BTXT" || f == "ATXT")
+      {
+        unsigned int  textureFormID = f.readUInt32Fast();
+        textureQuadrant = f.readUInt16Fast() & 3U;
+        textureLayer = 0;
+        if (f == "ATXT")
+          textureLayer = (f.readUInt16Fast() & 7U) + 1;
+        size_t  yy = (size_t(y) >> 4) - ((textureQuadrant & 2U) >> 1);
+        size_t  xx = (size_t(x) >> 4) + (textureQuadrant & 1U);
+        // the texture ID is set later, after all records have been loaded
+        size_t  txtSetOffs = (yy * w) + (xx << 4) + textureLayer;
+        d.txtSetFormIDs.push_back(((unsigned long long) txtSetOffs << 32)
+                                  | textureFormID);
+        cellDataValidMask |= 2U;
+      }
+      else if (f == "VTXT" && textureLayer)
+      {
+        while ((f.getPosition() + 8) <= f.size())
+        {
+          unsigned int  n = f.readUInt32Fast() & 0xFFFFU;
+          int     a = int(f.readFloat() * 15.0f + 0.5f);
+          a = (a >= 0 ? (a <= 15 ? a : 15) : 0);
+          unsigned int  xx = n % 17U;
+          unsigned int  yy = (n / 17U) % 17U;
+          if ((xx | yy) & 16)
+            continue;
+          std::uint32_t *p = dataBufPtr(ltexData32) + dataOffs;
+          p = p + (xx + ((textureQuadrant & 1U) << 4));
+          p = p - ((yy + ((textureQuadrant & 2U) << 3)) * w);
+          std::uint32_t m = 15U << ((textureLayer - 1U) << 2);
+          *p = (*p & ~m) | (((std::uint32_t) a * 0x11111111U) & m);
+        }
+      }
+    }
+  }
+  d.cellDataValidMask = cellDataValidMask;
+}
+
+void LandscapeData::loadESMCell(LandscapeData *p, LoadThreadState *s,
+                                size_t n)
+{
+  ESMLoadState& esmState = *(static_cast< ESMLoadState * >(s));
+  for (size_t i = esmState.cellListOffsets[n];
+       i < esmState.cellListOffsets[n + 1]; i++)
+  {
+    size_t  j = size_t(esmState.cellList[i] & 0xFFFFFFFFU);
+    p->loadESMLand(*(esmState.esmFile), (*(esmState.landData))[j],
+                   esmState.formatMask);
+  }
+}
+
 void LandscapeData::loadESMFile(ESMFile& esmFile,
                                 unsigned int formatMask, unsigned int worldID,
                                 unsigned int defTxtID, unsigned char mipLevel)
@@ -345,124 +589,51 @@ void LandscapeData::loadESMFile(ESMFile& esmFile,
   }
   zMin = landLevel;
   zMax = landLevel;
+  // decompress and decode LAND records on multiple threads, records of the
+  // same cell are processed in the original order by the same thread
+  std::vector< ESMLandData >  landData;
+  ESMLoadState  s(this);
+  s.esmFile = &esmFile;
+  s.formatMask = formatMask;
+  s.landData = &landData;
   for (size_t i = 0; i < landList.size(); i++)
   {
     unsigned int  k = (unsigned int) ((landList[i] >> 32) & 0xFFFFFFFFU);
-    std::map< unsigned int, unsigned int >::iterator  j = emptyCells.find(k);
-    if (j == emptyCells.end())
+    if (emptyCells.find(k) == emptyCells.end())
       continue;
-    const ESMFile::ESMRecord  *r =
-        esmFile.getRecordPtr((unsigned int) (landList[i] & 0xFFFFFFFFU));
-    if (!(r && *r == "LAND"))
-      continue;
-    int     x = (int(k & 0xFFFFU) - (cellMinX + 32768)) << 5;
-    int     y = ((cellMaxY + 32768 - int((k >> 16) & 0xFFFFU)) << 5) + 31;
-    size_t  w = size_t(cellMaxX + 1 - cellMinX) << 5;
-    size_t  dataOffs = size_t(y) * w + size_t(x);
-    unsigned int  cellDataValidMask = 0;
-    unsigned int  textureQuadrant = 0;
-    unsigned int  textureLayer = 0;
-    ESMFile::ESMField f(esmFile, *r);
-    while (f.next())
-    {
-      if (f == "VHGT" && (formatMask & 0x01) && f.size() >= 1093)
-      {
-        // vertex heights
-        float   zOffs = f.readFloat() * 8.0f;
-        cellHeightOffsets[k] = zOffs;
-        int     z = 0;
-        std::uint16_t *p = hmapData + dataOffs;
-        for (int yy = 0; yy < 32; yy++, p = p - (w + 32))
-        {
-          int     tmp = f.readUInt8Fast();
-          z += (!(tmp & 0x80) ? tmp : (tmp - 256));
-          *(p++) = (std::uint16_t) (z + 32768);
-          float   zf = zOffs + float(z << 3);
-          zMin = (zf < zMin ? zf : zMin);
-          zMax = (zf > zMax ? zf : zMax);
-          int     z0 = z;
-          for (int xx = 1; xx < 32; xx++)
-          {
-            tmp = f.readUInt8Fast();
-            z += (!(tmp & 0x80) ? tmp : (tmp - 256));
-            *(p++) = (std::uint16_t) (z + 32768);
-            zf = zOffs + float(z << 3);
-            zMin = (zf < zMin ? zf : zMin);
-            zMax = (zf > zMax ? zf : zMax);
-          }
-          z = z0;
-          (void) f.readUInt8Fast();
-        }
-        cellDataValidMask |= 1U;
-      }
-      else if (f == "VNML" && (formatMask & 0x04) && f.size() >= 3267)
-      {
-        // vertex normals
-        unsigned char *p = vnmlData + (dataOffs * 3);
-        for (int yy = 0; yy < 32; yy++, p = p - ((w + 32) * 3))
-        {
-          for (int xx = 0; xx < 32; xx++, p = p + 3)
-          {
-            p[2] = (unsigned char) (f.readUInt8Fast() ^ 0x80);
-            p[1] = (unsigned char) (f.readUInt8Fast() ^ 0x80);
-            p[0] = (unsigned char) (f.readUInt8Fast() ^ 0x80);
-          }
-          f.setPosition(f.getPosition() + 3);
-        }
-        cellDataValidMask |= 4U;
-      }
-      else if (f == "VCLR" && (formatMask & 0x08) && f.size() >= 3267)
-      {
-        // vertex colors
-        unsigned char *p = vclrData24 + (dataOffs * 3);
-        for (int yy = 0; yy < 32; yy++, p = p - ((w + 32) * 3))
-        {
-          for (int xx = 0; xx < 32; xx++, p = p + 3)
-          {
-            p[2] = f.readUInt8Fast();
-            p[1] = f.readUInt8Fast();
-            p[0] = f.readUInt8Fast();
-          }
-          f.setPosition(f.getPosition() + 3);
-        }
-        cellDataValidMask |= 8U;
-      }
-      else if ((formatMask & 0x02) && f.size() >= 8)
-      {
-        // vertex textures
-        if (f == "BTXT" || f == "ATXT")
-        {
-          unsigned char textureID = findTextureID(f.readUInt32Fast());
-          textureQuadrant = f.readUInt16Fast() & 3U;
-          textureLayer = 0;
-          if (f == "ATXT")
-            textureLayer = (f.readUInt16Fast() & 7U) + 1;
-          size_t  yy = (size_t(y) >> 4) - ((textureQuadrant & 2U) >> 1);
-          size_t  xx = (size_t(x) >> 4) + (textureQuadrant & 1U);
-          txtSetData[(yy * w) + (xx << 4) + textureLayer] = textureID;
-          cellDataValidMask |= 2U;
-        }
-        else if (f == "VTXT" && textureLayer)
-        {
-          while ((f.getPosition() + 8) <= f.size())
-          {
-            unsigned int  n = f.readUInt32Fast() & 0xFFFFU;
-            int     a = int(f.readFloat() * 15.0f + 0.5f);
-            a = (a >= 0 ? (a <= 15 ? a : 15) : 0);
-            unsigned int  xx = n % 17U;
-            unsigned int  yy = (n / 17U) % 17U;
-            if ((xx | yy) & 16)
-              continue;
-            std::uint32_t *p = ltexData32 + dataOffs;
-            p = p + (xx + ((textureQuadrant & 1U) << 4));
-            p = p - ((yy + ((textureQuadrant & 2U) << 3)) * w);
-            std::uint32_t m = 15U << ((textureLayer - 1U) << 2);
-            *p = (*p & ~m) | (((std::uint32_t) a * 0x11111111U) & m);
-          }
-        }
-      }
+    s.cellList.push_back(((unsigned long long) k << 32) | landData.size());
+    landData.resize(landData.size() + 1);
+    landData.back().formID = (unsigned int) (landList[i] & 0xFFFFFFFFU);
+    landData.back().cellKey = k;
+  }
+  std::sort(s.cellList.begin(), s.cellList.end());
+  for (size_t i = 0; i < s.cellList.size(); i++)
+  {
+    if (!i || (s.cellList[i] >> 32) != (s.cellList[i - 1] >> 32))
+      s.cellListOffsets.push_back(i);
+  }
+  size_t  cellCnt = s.cellListOffsets.size();
+  s.cellListOffsets.push_back(s.cellList.size());
+  s.runItems(cellCnt);
+  for (size_t i = 0; i < landData.size(); i++)
+  {
+    const ESMLandData&  d = landData[i];
+    if (d.cellDataValidMask & 1U)
+    {
+      cellHeightOffsets[d.cellKey] = d.zOffs;
+      zMin = (d.zMin < zMin ? d.zMin : zMin);
+      zMax = (d.zMax > zMax ? d.zMax : zMax);
     }
-    j->second = j->second & ~cellDataValidMask;
+    // land texture IDs are allocated in the order of the records
+    for (size_t j = 0; j < d.txtSetFormIDs.size(); j++)
+    {
+      unsigned long long  tmp = d.txtSetFormIDs[j];
+      dataBufPtr(txtSetData)[size_t(tmp >> 32)] =
+          findTextureID((unsigned int) (tmp & 0xFFFFFFFFU));
+    }
+    std::map< unsigned int, unsigned int >::iterator  j =
+        emptyCells.find(d.cellKey);
+    j->second = j->second & ~(d.cellDataValidMask);
   }
   for (std::map< unsigned int, unsigned int >::iterator i = emptyCells.begin();
        i != emptyCells.end(); i++)
@@ -479,20 +650,22 @@ void LandscapeData::loadESMFile(ESMFile& esmFile,
       for (int xx = 0; xx < 32; xx++, dataOffs++)
       {
         if (i->second & 0x01)
-          hmapData[dataOffs] = 0x8000;
+          dataBufPtr(hmapData)[dataOffs] = 0x8000;
         if (i->second & 0x02)
-          ltexData32[dataOffs] = 0U;
+          dataBufPtr(ltexData32)[dataOffs] = 0U;
         if (i->second & 0x04)
         {
-          vnmlData[dataOffs * 3] = 0xFF;
-          vnmlData[dataOffs * 3 + 1] = 0x80;
-          vnmlData[dataOffs * 3 + 2] = 0x80;
+          unsigned char *p = dataBufPtr(vnmlData) + (dataOffs * 3);
+          p[0] = 0xFF;
+          p[1] = 0x80;
+          p[2] = 0x80;
         }
         if (i->second & 0x08)
         {
-          vclrData24[dataOffs * 3] = 0xFF;
-          vclrData24[dataOffs * 3 + 1] = 0xFF;
-          vclrData24[dataOffs * 3 + 2] = 0xFF;
+          unsigned char *p = dataBufPtr(vclrData24) + (dataOffs * 3);
+          p[0] = 0xFF;
+          p[1] = 0xFF;
+          p[2] = 0xFF;
         }
       }
     }
@@ -500,6 +673,7 @@ void LandscapeData::loadESMFile(ESMFile& esmFile,
   if (formatMask & 0x01)
   {
     // convert height map to normalized 16-bit unsigned integer format
+    std::uint16_t *hmapBuf = dataBufPtr(hmapData);
     double  zScale = 0.0;
     if (zMax > zMin)
       zScale = 65535.0 / (double(zMax) - double(zMin));
@@ -515,10 +689,10 @@ void LandscapeData::loadESMFile(ESMFile& esmFile,
       {
         for (int xx = 0; xx < 32; xx++, dataOffs++)
         {
-          double  z = double((int(hmapData[dataOffs]) - 32768) << 3);
+          double  z = double((int(hmapBuf[dataOffs]) - 32768) << 3);
           int     tmp = int(z * zScale + zOffset);
           tmp = (tmp >= 0 ? (tmp <= 65535 ? tmp : 65535) : 0);
-          hmapData[dataOffs] = (std::uint16_t) tmp;
+          hmapBuf[dataOffs] = (std::uint16_t) tmp;
         }
       }
     }
@@ -529,12 +703,13 @@ void LandscapeData::loadESMFile(ESMFile& esmFile,
     {
       // replace missing textures with default texture ID
       unsigned char defaultTexture = findTextureID(defTxtID);
+      unsigned char *txtSetBuf = dataBufPtr(txtSetData);
       size_t  n = (size_t(cellMaxX + 1 - cellMinX)
                    * size_t(cellMaxY + 1 - cellMinY)) << 6;
       for (size_t i = 0; i < n; i++)
       {
-        if (txtSetData[i] == 0xFF && (i & 15) <= 8)
-          txtSetData[i] = defaultTexture;
+        if (txtSetBuf[i] == 0xFF && (i & 15) <= 8)
+          txtSetBuf[i] = defaultTexture;
       }
     }
     ltexEDIDs.resize(ltexFormIDs.size());
@@ -643,6 +818,265 @@ void LandscapeData::loadWorldInfo(ESMFile& esmFile, unsigned int worldID)
   }
 }
 
+bool LandscapeData::getSnapshotFileName(
+    std::string& fileName, std::vector< std::uint32_t >& params,
+    const ESMFile *esmFile, const char *btdFileName,
+    unsigned int formatMask, unsigned int worldID, unsigned int defTxtID,
+    int mipLevel, int xMin, int yMin, int xMax, int yMax)
+{
+  if (!FileBuffer::getCachePath(fileName))
+    return false;
+  params.clear();
+  params.push_back(formatMask);
+  params.push_back(worldID);
+  params.push_back(defTxtID);
+  params.push_back(std::uint32_t(mipLevel));
+  params.push_back(std::uint32_t(xMin));
+  params.push_back(std::uint32_t(yMin));
+  params.push_back(std::uint32_t(xMax));
+  params.push_back(std::uint32_t(yMax));
+  // the file name is derived from the input path names and parameters
+  // only, the file sizes and modification times are stored as additional
+  // parameters, so that an outdated snapshot is replaced
+  std::uint64_t fileInfo[3];
+  if (btdFileName && *btdFileName)
+  {
+    // FNV-1a hash of the BTD path name, file size and modification time
+#if defined(_WIN32) || defined(_WIN64)
+    struct __stat64 st;
+    if (_stat64(btdFileName, &st) != 0)
+#else
+    struct stat st;
+    if (stat(btdFileName, &st) != 0)
+#endif
+    {
+      return false;
+    }
+    std::uint64_t h = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; btdFileName[i]; i++)
+    {
+      h = h ^ (unsigned char) btdFileName[i];
+      h = h * 0x00000100000001B3ULL;
+    }
+    fileInfo[0] = h;
+    fileInfo[1] = std::uint64_t(st.st_size);
+    fileInfo[2] = std::uint64_t(std::int64_t(st.st_mtime));
+  }
+  else
+  {
+    // the ESM data is identified by the ESM file names, sizes and times
+    if (!(esmFile && esmFile->getFileInfoHash()))
+      return false;
+    fileInfo[0] = esmFile->getFileNameHash();
+    fileInfo[1] = esmFile->getFileInfoHash();
+    fileInfo[2] = 0U;
+  }
+  for (size_t i = 0; i < 3; i++)
+  {
+    params.push_back(std::uint32_t(fileInfo[i] & 0xFFFFFFFFU));
+    params.push_back(std::uint32_t(fileInfo[i] >> 32));
+  }
+  std::uint64_t h = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < 10; i++)
+  {
+    for (size_t j = 0; j < 4; j++)
+    {
+      h = h ^ ((params[i] >> (j << 3)) & 0xFFU);
+      h = h * 0x00000100000001B3ULL;
+    }
+  }
+  char    tmpBuf[32];
+  std::snprintf(tmpBuf, 32, "/land%016llx.bin", (unsigned long long) h);
+  fileName += tmpBuf;
+  return true;
+}
+
+// Snapshot file format (all integers are little endian):
+//   0:  "LNDS"
+//   4:  version (snapshotVersion)
+//   8:  number of parameters (P)
+//  12:  number of land textures (T)
+//  16:  cellMinX, cellMinY, cellMaxX, cellMaxY (32-bit signed integers)
+//  32:  cellResolution, cellOffset
+//  40:  zMin, zMax (32-bit floats)
+//  48:  P * 4 bytes: parameters from getSnapshotFileName()
+//  48 + P * 4:  T * 4 bytes: ltexFormIDs
+//  the data buffers follow, in the order of getDataSizes(), each one is
+//  aligned to 64 bytes, and padded with zero bytes
+// The land texture EDIDs and paths are not stored, because these depend on
+// the archives, and are always loaded from the ESM file.
+// waterLevel, landLevel and waterFormID are not stored either. These are
+// read from the WRLD record by loadWorldInfo() before the terrain is loaded,
+// or are the defaults if there is no ESM file. The terrain data does not
+// change them. In BTD mode, the parameters do not identify the ESM file, so
+// a stored value could be outdated, or could be from a run without an ESM
+// file.
+
+bool LandscapeData::loadSnapshot(const char *fileName,
+                                 const std::vector< std::uint32_t >& params,
+                                 unsigned int formatMask, bool isFO76)
+{
+  try
+  {
+    snapshotBuf = new FileBuffer(fileName);
+    FileBuffer& buf = *snapshotBuf;
+    if (buf.size() < 48 || buf.readUInt32Fast() != 0x53444E4C ||       // "LNDS"
+        buf.readUInt32Fast() != snapshotVersion ||
+        buf.readUInt32Fast() != params.size())
+    {
+      throw FO76UtilsError("invalid LandscapeData snapshot file");
+    }
+    size_t  ltexCnt = buf.readUInt32Fast();
+    int     tmpCellMinX = buf.readInt32();
+    int     tmpCellMinY = buf.readInt32();
+    int     tmpCellMaxX = buf.readInt32();
+    int     tmpCellMaxY = buf.readInt32();
+    int     tmpCellResolution = buf.readInt32();
+    int     tmpCellOffset = buf.readInt32();
+    float   tmpZMin = buf.readFloat();
+    float   tmpZMax = buf.readFloat();
+    if (tmpCellMinX < std::max(cellMinX, -32768) ||
+        tmpCellMinY < std::max(cellMinY, -32768) ||
+        tmpCellMaxX > std::min(cellMaxX, 32767) ||
+        tmpCellMaxY > std::min(cellMaxY, 32767) ||
+        tmpCellMaxX < tmpCellMinX || tmpCellMaxY < tmpCellMinY ||
+        !(tmpCellResolution >= 8 && tmpCellResolution <= 128 &&
+          !(tmpCellResolution & (tmpCellResolution - 1))) ||
+        tmpCellOffset != (!isFO76 ? 0 : (tmpCellResolution >> 1)) ||
+        (buf.size() - 48) < ((params.size() + ltexCnt) * 4))
+    {
+      throw FO76UtilsError("invalid LandscapeData snapshot file");
+    }
+    for (size_t i = 0; i < params.size(); i++)
+    {
+      if (buf.readUInt32Fast() != params[i])
+        throw FO76UtilsError("invalid LandscapeData snapshot file");
+    }
+    cellMinX = tmpCellMinX;
+    cellMinY = tmpCellMinY;
+    cellMaxX = tmpCellMaxX;
+    cellMaxY = tmpCellMaxY;
+    cellResolution = tmpCellResolution;
+    cellOffset = tmpCellOffset;
+    zMin = tmpZMin;
+    zMax = tmpZMax;
+    ltexFormIDs.resize(ltexCnt);
+    for (size_t i = 0; i < ltexCnt; i++)
+      ltexFormIDs[i] = buf.readUInt32Fast();
+    size_t  dataSizes[8];
+    getDataSizes(dataSizes, formatMask, isFO76);
+    size_t  offs = (buf.getPosition() + 63) & ~(size_t(63));
+    size_t  totalDataSize = offs;
+    for (size_t i = 0; i < 8; i++)
+      totalDataSize = totalDataSize + ((dataSizes[i] + 63) & ~(size_t(63)));
+    if (totalDataSize != buf.size())
+      throw FO76UtilsError("invalid LandscapeData snapshot file");
+    setDataPointers(buf.getDataPtr() + offs, dataSizes, 64);
+  }
+  catch (FO76UtilsError&)
+  {
+    if (snapshotBuf)
+    {
+      delete snapshotBuf;
+      snapshotBuf = (FileBuffer *) 0;
+    }
+    ltexFormIDs.clear();
+    return false;
+  }
+  ltexEDIDs.resize(ltexFormIDs.size());
+  ltexBGSMPaths.resize(ltexFormIDs.size());
+  ltexDPaths.resize(ltexFormIDs.size());
+  ltexNPaths.resize(ltexFormIDs.size());
+  return true;
+}
+
+static inline void writeSnapshotUInt32(std::vector< unsigned char >& buf,
+                                       std::uint32_t n)
+{
+  buf.push_back((unsigned char) (n & 0xFF));
+  buf.push_back((unsigned char) ((n >> 8) & 0xFF));
+  buf.push_back((unsigned char) ((n >> 16) & 0xFF));
+  buf.push_back((unsigned char) ((n >> 24) & 0xFF));
+}
+
+void LandscapeData::saveSnapshot(const char *fileName,
+                                 const std::vector< std::uint32_t >& params,
+                                 unsigned int formatMask, bool isFO76) const
+{
+  std::vector< unsigned char >  buf;
+  writeSnapshotUInt32(buf, 0x53444E4C);         // "LNDS"
+  writeSnapshotUInt32(buf, snapshotVersion);
+  writeSnapshotUInt32(buf, std::uint32_t(params.size()));
+  writeSnapshotUInt32(buf, std::uint32_t(ltexFormIDs.size()));
+  writeSnapshotUInt32(buf, std::uint32_t(cellMinX));
+  writeSnapshotUInt32(buf, std::uint32_t(cellMinY));
+  writeSnapshotUInt32(buf, std::uint32_t(cellMaxX));
+  writeSnapshotUInt32(buf, std::uint32_t(cellMaxY));
+  writeSnapshotUInt32(buf, std::uint32_t(cellResolution));
+  writeSnapshotUInt32(buf, std::uint32_t(cellOffset));
+  std::uint32_t tmp;
+  std::memcpy(&tmp, &zMin, sizeof(std::uint32_t));
+  writeSnapshotUInt32(buf, tmp);
+  std::memcpy(&tmp, &zMax, sizeof(std::uint32_t));
+  writeSnapshotUInt32(buf, tmp);
+  for (size_t i = 0; i < params.size(); i++)
+    writeSnapshotUInt32(buf, params[i]);
+  for (size_t i = 0; i < ltexFormIDs.size(); i++)
+    writeSnapshotUInt32(buf, ltexFormIDs[i]);
+  size_t  dataSizes[8];
+  getDataSizes(dataSizes, formatMask, isFO76);
+  const unsigned char *dataPtrs[8];
+  dataPtrs[0] = reinterpret_cast< const unsigned char * >(hmapData);
+  dataPtrs[1] = reinterpret_cast< const unsigned char * >(ltexData32);
+  dataPtrs[2] = vnmlData;
+  dataPtrs[3] = vclrData24;
+  dataPtrs[4] = reinterpret_cast< const unsigned char * >(ltexData16);
+  dataPtrs[5] = reinterpret_cast< const unsigned char * >(vclrData16);
+  dataPtrs[6] = gcvrData;
+  dataPtrs[7] = txtSetData;
+  // write to a temporary file first, so that other processes never see
+  // an incomplete snapshot
+  std::string tmpFileName(fileName);
+  {
+    char    tmpBuf[32];
+#if defined(_WIN32) || defined(_WIN64)
+    std::snprintf(tmpBuf, 32, ".%d.tmp", int(_getpid()));
+#else
+    std::snprintf(tmpBuf, 32, ".%d.tmp", int(getpid()));
+#endif
+    tmpFileName += tmpBuf;
+  }
+  try
+  {
+    {
+      OutputFile  f(tmpFileName.c_str(), 0);
+      buf.resize((buf.size() + 63) & ~(size_t(63)), 0);
+      f.writeData(&(buf.front()), buf.size());
+      for (size_t i = 0; i < 8; i++)
+      {
+        if (!dataSizes[i])
+          continue;
+        f.writeData(dataPtrs[i], dataSizes[i]);
+        buf.clear();
+        buf.resize(((dataSizes[i] + 63) & ~(size_t(63))) - dataSizes[i], 0);
+        if (buf.size() > 0)
+          f.writeData(&(buf.front()), buf.size());
+      }
+    }
+    if (std::rename(tmpFileName.c_str(), fileName) != 0)
+    {
+      (void) std::remove(fileName);
+      if (std::rename(tmpFileName.c_str(), fileName) != 0)
+        (void) std::remove(tmpFileName.c_str());
+    }
+  }
+  catch (...)
+  {
+    // failing to write the snapshot is not an error
+    (void) std::remove(tmpFileName.c_str());
+  }
+}
+
 LandscapeData::LandscapeData(
     ESMFile *esmFile, const char *btdFileName, const BA2File *ba2File,
     unsigned int formatMask, unsigned int worldID, unsigned int defTxtID,
@@ -665,7 +1099,8 @@ LandscapeData::LandscapeData(
     zMax(-1.0e9f),
     waterLevel(0.0f),
     landLevel(1024.0f),
-    waterFormID(0x00000018U)
+    waterFormID(0x00000018U),
+    snapshotBuf((FileBuffer *) 0)
 {
   unsigned char l = (unsigned char) mipLevel;
   if (!worldID)
@@ -676,12 +1111,30 @@ LandscapeData::LandscapeData(
     landLevel = -8192.0f;
     loadWorldInfo(*esmFile, worldID);
   }
-  if (btdFileName && *btdFileName)
-    loadBTDFile(btdFileName, formatMask & 0x1B, l);
-  else if (esmFile)
-    loadESMFile(*esmFile, formatMask & 0x0F, worldID, defTxtID, l);
-  else
+  bool    isFO76 = (btdFileName && *btdFileName);
+  unsigned int  fmtMask = formatMask & (isFO76 ? 0x1BU : 0x0FU);
+  if (!(isFO76 || esmFile))
     errorMessage("LandscapeData: no input file");
+  std::string snapshotFileName;
+  std::vector< std::uint32_t >  snapshotParams;
+  bool    snapshotEnabled =
+      getSnapshotFileName(snapshotFileName, snapshotParams, esmFile,
+                          btdFileName, fmtMask, worldID, defTxtID, mipLevel,
+                          xMin, yMin, xMax, yMax);
+  if (!(snapshotEnabled &&
+        loadSnapshot(snapshotFileName.c_str(), snapshotParams, fmtMask,
+                     isFO76)))
+  {
+    if (isFO76)
+      loadBTDFile(btdFileName, fmtMask, l);
+    else
+      loadESMFile(*esmFile, fmtMask, worldID, defTxtID, l);
+    if (snapshotEnabled)
+    {
+      saveSnapshot(snapshotFileName.c_str(), snapshotParams, fmtMask,
+                   isFO76);
+    }
+  }
   if (esmFile)
   {
     for (size_t i = 0; i < ltexFormIDs.size(); i++)
@@ -691,5 +1144,7 @@ LandscapeData::LandscapeData(
 
 LandscapeData::~LandscapeData()
 {
+  if (snapshotBuf)
+    delete snapshotBuf;
 }
 
@@ -8,6 +8,10 @@
 #include "btdfile.hpp"
 #include "ba2file.hpp"
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
 class LandscapeData
 {
  protected:
@@ -17,14 +21,16 @@ class LandscapeData
   int     cellMaxY;
   int     cellResolution;
   int     cellOffset;
-  std::uint16_t *hmapData;
-  std::uint32_t *ltexData32;
-  unsigned char *vnmlData;
-  unsigned char *vclrData24;
-  std::uint16_t *ltexData16;
-  unsigned char *gcvrData;
-  std::uint16_t *vclrData16;
-  unsigned char *txtSetData;
+  // the data is either allocated in dataBuf, or mapped read-only from a
+  // snapshot file, the loading functions write to it using dataBufPtr()
+  const std::uint16_t *hmapData;
+  const std::uint32_t *ltexData32;
+  const unsigned char *vnmlData;
+  const unsigned char *vclrData24;
+  const std::uint16_t *ltexData16;
+  const unsigned char *gcvrData;
+  const std::uint16_t *vclrData16;
+  const unsigned char *txtSetData;
   float   zMin;
   float   zMax;
   float   waterLevel;
@@ -36,7 +42,97 @@ class LandscapeData
   std::vector< std::string >  ltexDPaths;
   std::vector< std::string >  ltexNPaths;
   std::vector< std::uint32_t >  dataBuf;
+  FileBuffer    *snapshotBuf;
+  static const std::uint32_t  snapshotVersion = 1U;
+  // shared state of the threads used for loading BTD tiles or ESM cells,
+  // the worker threads are created on the first call to runItems(), and
+  // are reused until the state is destroyed
+  struct LoadThreadState
+  {
+    LandscapeData *landscapeData;
+    // function called for each item, n is the index of the item
+    void    (*itemFunction)(LandscapeData *p, LoadThreadState *s, size_t n);
+    size_t  nextItem;
+    size_t  itemCnt;
+    size_t  itemsRunning;
+    bool    stopFlag;
+    std::string errMsg;
+    std::vector< std::thread * >  threads;
+    std::mutex  loadMutex;
+    std::condition_variable newItemsCond;       // new items or stop request
+    std::condition_variable itemsDoneCond;
+    LoadThreadState(LandscapeData *p,
+                    void (*func)(LandscapeData *, LoadThreadState *, size_t));
+    ~LoadThreadState();
+    // run items 0 to n - 1 on the worker threads and the calling thread,
+    // and wait until all of them are finished
+    void runItems(size_t n);
+   protected:
+    void runItem(size_t n);
+    static void threadFunction(LoadThreadState *s);
+  };
+  struct BTDLoadState : public LoadThreadState
+  {
+    // the tiles are only read by the worker threads, see prefetchCells()
+    const BTDFile *btdFile;
+    unsigned int  formatMask;
+    unsigned char mipLevel;
+    int     tileX0;                     // first cell of the first tile
+    int     y0;                         // northernmost row of the tiles
+    int     y1;                         // southernmost row of the tiles
+    BTDLoadState(LandscapeData *p)
+      : LoadThreadState(p, &loadBTDTile)
+    {
+    }
+  };
+  // decompressed LAND record data, in the order of the LAND records
+  struct ESMLandData
+  {
+    unsigned int  formID;
+    unsigned int  cellKey;              // ((y + 32768) << 16) | (x + 32768)
+    unsigned int  cellDataValidMask;
+    float   zOffs;
+    float   zMin;
+    float   zMax;
+    // texture set data offset << 32 | land texture form ID
+    std::vector< unsigned long long > txtSetFormIDs;
+  };
+  struct ESMLoadState : public LoadThreadState
+  {
+    ESMFile       *esmFile;
+    unsigned int  formatMask;
+    std::vector< ESMLandData >  *landData;
+    // cellKey << 32 | index to landData, sorted by cell
+    std::vector< unsigned long long > cellList;
+    // index to cellList of the first record of each cell
+    std::vector< size_t > cellListOffsets;
+    ESMLoadState(LandscapeData *p)
+      : LoadThreadState(p, &loadESMCell)
+    {
+    }
+  };
+  // dataSizes[0..7] = size in bytes of hmapData, ltexData32, vnmlData,
+  // vclrData24, ltexData16, vclrData16, gcvrData and txtSetData
+  void getDataSizes(size_t *dataSizes,
+                    unsigned int formatMask, bool isFO76) const;
+  // set the data pointers to consecutive buffers at p, with the start of
+  // each buffer aligned to a multiple of alignment bytes
+  void setDataPointers(const unsigned char *p, const size_t *dataSizes,
+                       size_t alignment);
   void allocateDataBuf(unsigned int formatMask, bool isFO76);
+  // returns a writable pointer to data that has been allocated in dataBuf
+  template< typename T > inline T *dataBufPtr(const T *p)
+  {
+    if (!p)
+      return (T *) 0;
+    unsigned char *bufp = reinterpret_cast< unsigned char * >(&(dataBuf[0]));
+    return reinterpret_cast< T * >(
+               bufp + (reinterpret_cast< const unsigned char * >(p) - bufp));
+  }
+  void loadBTDCell(const BTDFile& btdFile, int x, int y,
+                   unsigned int formatMask, unsigned char mipLevel);
+  // decode the cells of the n-th tile of the current row of tiles
+  static void loadBTDTile(LandscapeData *p, LoadThreadState *s, size_t n);
   void loadBTDFile(const char *btdFileName,
                    unsigned int formatMask, unsigned char mipLevel);
   // ((y + 32768) << 48) | ((x + 32768) << 32) | land_formID
@@ -44,11 +140,30 @@ class LandscapeData
                    std::vector< unsigned long long >& landList,
                    unsigned int formID, int d = 0, int x = 0, int y = 0);
   unsigned char findTextureID(unsigned int formID);
+  void loadESMLand(ESMFile& esmFile, ESMLandData& d, unsigned int formatMask);
+  // decode the LAND records of the n-th cell of the cell list
+  static void loadESMCell(LandscapeData *p, LoadThreadState *s, size_t n);
   void loadESMFile(ESMFile& esmFile,
                    unsigned int formatMask, unsigned int worldID,
                    unsigned int defTxtID, unsigned char mipLevel);
   void loadTextureInfo(ESMFile& esmFile, const BA2File *ba2File, size_t n);
   void loadWorldInfo(ESMFile& esmFile, unsigned int worldID);
+  // The loaded terrain data can be cached in the directory specified by the
+  // FO76UTILS_CACHEPATH environment variable, and memory mapped on later
+  // runs. getSnapshotFileName() returns false if the cache is not enabled,
+  // params is filled with the parameters that identify the data.
+  static bool getSnapshotFileName(
+      std::string& fileName, std::vector< std::uint32_t >& params,
+      const ESMFile *esmFile, const char *btdFileName,
+      unsigned int formatMask, unsigned int worldID, unsigned int defTxtID,
+      int mipLevel, int xMin, int yMin, int xMax, int yMax);
+  // returns false if the snapshot file does not exist or is not valid
+  bool loadSnapshot(const char *fileName,
+                    const std::vector< std::uint32_t >& params,
+                    unsigned int formatMask, bool isFO76);
+  void saveSnapshot(const char *fileName,
+                    const std::vector< std::uint32_t >& params,
+                    unsigned int formatMask, bool isFO76) const;
  public:
   // formatMask & 1:  set to load height map (pixelFormatGRAY16)
   // formatMask & 2:  set to load land textures (pixelFormatL8A24)
@@ -85,8 +85,11 @@ static void loadTextures(
       }
       if (ba2File)
       {
-        int     n = ba2File->extractTexture(tmpBuf, fileNames[i], mipOffset);
-        textures[i] = new DDSTexture(&(tmpBuf.front()), tmpBuf.size(), n);
+        const unsigned char *fileData = (unsigned char *) 0;
+        size_t  fileSize = 0;
+        int     n = ba2File->extractTexture(fileData, fileSize, tmpBuf,
+                                            fileNames[i], mipOffset);
+        textures[i] = new DDSTexture(fileData, fileSize, n);
       }
       else
       {
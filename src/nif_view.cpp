@@ -168,9 +168,11 @@ Renderer::Renderer(const BA2File& archiveFiles, ESMFile *esmFilePtr)
   : ba2File(archiveFiles),
     esmFile(esmFilePtr),
     textureSet(0x10000000),
+    modelCache(0x10000000),
     lightX(0.0f),
     lightY(0.0f),
     lightZ(1.0f),
+    cachedModel((ModelCache::CachedModel *) 0),
     nifFile((NIFFile *) 0),
     defaultTexture(0xFFFF80C0U),
     modelRotationX(0.0f),
@@ -226,11 +228,11 @@ Renderer::Renderer(const BA2File& archiveFiles, ESMFile *esmFilePtr)
 
 Renderer::~Renderer()
 {
-  if (nifFile)
-  {
-    delete nifFile;
-    nifFile = (NIFFile *) 0;
-  }
+  meshData.clear();
+  nifFile = (NIFFile *) 0;
+  modelCache.releaseModel(cachedModel);
+  cachedModel = (ModelCache::CachedModel *) 0;
+  modelCache.clear();
   textureSet.clear();
   for (size_t i = 0; i < renderers.size(); i++)
   {
@@ -243,27 +245,16 @@ void Renderer::loadModel(const std::string& fileName)
 {
   meshData.clear();
   textureSet.shrinkTextureCache();
-  if (nifFile)
-  {
-    delete nifFile;
-    nifFile = (NIFFile *) 0;
-  }
+  nifFile = (NIFFile *) 0;
+  // previously viewed models remain in the cache
+  modelCache.releaseModel(cachedModel);
+  cachedModel = (ModelCache::CachedModel *) 0;
+  modelCache.shrinkModelCache();
   if (fileName.empty())
     return;
-  std::vector< unsigned char >& fileBuf = threadFileBuffers[0];
-  ba2File.extractFile(fileBuf, fileName);
-  nifFile = new NIFFile(&(fileBuf.front()), fileBuf.size(), &ba2File);
-  try
-  {
-    nifFile->getMesh(meshData);
-  }
-  catch (...)
-  {
-    meshData.clear();
-    delete nifFile;
-    nifFile = (NIFFile *) 0;
-    throw;
-  }
+  cachedModel = modelCache.loadModel(ba2File, fileName, threadFileBuffers[0]);
+  nifFile = cachedModel->nifFile;
+  meshData = cachedModel->meshData;
 }
 
 static inline float degreesToRadians(float x)
@@ -24,10 +24,12 @@ class Renderer : protected Renderer_Base
   std::vector< int >  viewOffsetY;
   std::vector< NIFFile::NIFTriShape > meshData;
   TextureCache  textureSet;
+  ModelCache  modelCache;
   std::vector< std::vector< unsigned char > > threadFileBuffers;
   int     threadCnt;
   float   lightX, lightY, lightZ;
-  NIFFile *nifFile;
+  ModelCache::CachedModel *cachedModel;
+  const NIFFile *nifFile;
   NIFFile::NIFVertexTransform modelTransform;
   NIFFile::NIFVertexTransform viewTransform;
   unsigned int  materialSwapTable[8];
@@ -878,6 +878,31 @@ void Plot3D_TriShape::drawPixel_FO76(Plot3D_TriShape& p, Fragment& z)
   *(z.cPtr) = c.convertToRGBA32(true, true);
 }
 
+inline void Plot3D_TriShape::shadePixel(
+    size_t offs, Fragment& v,
+    const Vertex& v0, const Vertex& v1, const Vertex& v2,
+    FloatVector4 w0, FloatVector4 w1, FloatVector4 w2)
+{
+  if (BRANCH_UNLIKELY(depthPassMode & 1))
+  {
+    *(bufZ + offs) = v.xyz[2];
+    return;
+  }
+  v.zPtr = bufZ + offs;
+  v.cPtr = bufRGBA + offs;
+  v.bitangent = (v0.bitangent * w0) + (v1.bitangent * w1) + (v2.bitangent * w2);
+  v.tangent = (v0.tangent * w0) + (v1.tangent * w1) + (v2.tangent * w2);
+  v.normal = (v0.normal * w0) + (v1.normal * w1) + (v2.normal * w2);
+  v.vertexColor =
+      (v0.vertexColor * w0) + (v1.vertexColor * w1) + (v2.vertexColor * w2);
+  drawPixelFunction(*this, v);
+  if (BRANCH_UNLIKELY(depthPassMode & 4))
+  {
+    // opaque mesh after a depth prepass: do not shade the pixel again
+    *(v.zPtr) = v.xyz[2] * 0.99999994f;
+  }
+}
+
 inline void Plot3D_TriShape::drawPixel(
     int x, int y, Fragment& v,
     const Vertex& v0, const Vertex& v1, const Vertex& v2,
@@ -891,15 +916,72 @@ inline void Plot3D_TriShape::drawPixel(
     return;
   size_t  offs = size_t(y) * size_t(width) + size_t(x);
   if (!(v.xyz[2] < *(bufZ + offs)))
-    return;
-  v.zPtr = bufZ + offs;
-  v.cPtr = bufRGBA + offs;
-  v.bitangent = (v0.bitangent * w0) + (v1.bitangent * w1) + (v2.bitangent * w2);
-  v.tangent = (v0.tangent * w0) + (v1.tangent * w1) + (v2.tangent * w2);
-  v.normal = (v0.normal * w0) + (v1.normal * w1) + (v2.normal * w2);
-  v.vertexColor =
-      (v0.vertexColor * w0) + (v1.vertexColor * w1) + (v2.vertexColor * w2);
-  drawPixelFunction(*this, v);
+  {
+    if (BRANCH_LIKELY(!(depthPassMode & 2)) || !(v.xyz[2] <= *(bufZ + offs)))
+      return;
+  }
+  shadePixel(offs, v, v0, v1, v2, w0, w1, w2);
+}
+
+inline void Plot3D_TriShape::drawSpan(
+    Fragment& v, const Vertex& v0, const Vertex& v1, const Vertex& v2,
+    int x, int y, int n, int xStep,
+    double w1, double w2, double a1, double a2, bool checkW2)
+{
+  FloatVector4  z0(v0.xyz[2]);
+  FloatVector4  z1(v1.xyz[2]);
+  FloatVector4  z2(v2.xyz[2]);
+  const float *zPtr = bufZ + (size_t(y) * size_t(width) + size_t(x));
+  float   wBuf[16];
+  // depth test blocks of 4 pixels before interpolating vertex attributes
+  for ( ; n > 0; n = n - 4, x = x + (xStep * 4), zPtr = zPtr + (xStep * 4))
+  {
+    int     k = 0;
+    for ( ; k < 4 && k < n; k++, w1 += a1, w2 += a2)
+    {
+      if ((!checkW2 ? w1 : w2) < -0.0000005 || (w1 + w2) > 1.0000005)
+        break;
+      wBuf[k] = float(1.0 - (w1 + w2));
+      wBuf[k + 4] = float(w1);
+      wBuf[k + 8] = float(w2);
+      wBuf[k + 12] = zPtr[k * xStep];
+    }
+    unsigned int  m = (1U << (unsigned int) k) - 1U;
+    if (k < 4)
+    {
+      if (!k)
+        break;
+      n = k;
+      for ( ; k < 4; k++)
+      {
+        wBuf[k] = 0.0f;
+        wBuf[k + 4] = 0.0f;
+        wBuf[k + 8] = 0.0f;
+        wBuf[k + 12] = 0.0f;
+      }
+    }
+    FloatVector4  z((z0 * FloatVector4(wBuf)) + (z1 * FloatVector4(wBuf + 4))
+                    + (z2 * FloatVector4(wBuf + 8)));
+    if (BRANCH_LIKELY(!(depthPassMode & 2)))
+      m = z.getLessThanMask(FloatVector4(wBuf + 12));
+    else
+      m = m & ~(FloatVector4(wBuf + 12).getLessThanMask(z));
+    m = m & ~(z.getLessThanMask(FloatVector4(0.0f)));
+    // the depth test is not repeated for the pixels that passed it
+    for (k = 0; m; k++, m = m >> 1)
+    {
+      if (m & 1U)
+      {
+        FloatVector4  w0(wBuf[k]);
+        FloatVector4  w1(wBuf[k + 4]);
+        FloatVector4  w2(wBuf[k + 8]);
+        v.xyz = (v0.xyz * w0) + (v1.xyz * w1) + (v2.xyz * w2);
+        v.xyz[2] = z[k];
+        shadePixel(size_t(y) * size_t(width) + size_t(x + (k * xStep)),
+                   v, v0, v1, v2, w0, w1, w2);
+      }
+    }
+  }
 }
 
 void Plot3D_TriShape::drawLine(Fragment& v, const Vertex& v0, const Vertex& v1)
@@ -1051,13 +1133,8 @@ void Plot3D_TriShape::drawTriangles()
           x = (x < (width - 1) ? x : (width - 1));
           double  w1 = ((double(x) - x0) * a1) + (yf * b1);
           double  w2 = ((double(x) - x0) * a2) + (yf * b2);
-          for ( ; BRANCH_LIKELY(x >= 0); x--, w1 -= a1, w2 -= a2)
-          {
-            if (w1 < -0.0000005 || (w1 + w2) > 1.0000005)
-              break;
-            drawPixel(x, y, v, *v0, *v1, *v2,
-                      float(1.0 - (w1 + w2)), float(w1), float(w2));
-          }
+          drawSpan(v, *v0, *v1, *v2, x, y, x + 1, -1,
+                   w1, w2, -a1, -a2, false);
         }
       }
       else                              // positive X direction
@@ -1069,13 +1146,8 @@ void Plot3D_TriShape::drawTriangles()
           x = (x > 0 ? x : 0);
           double  w1 = ((double(x) - x0) * a1) + (yf * b1);
           double  w2 = ((double(x) - x0) * a2) + (yf * b2);
-          for ( ; BRANCH_LIKELY(x < width); x++, w1 += a1, w2 += a2)
-          {
-            if (w1 < -0.0000005 || (w1 + w2) > 1.0000005)
-              break;
-            drawPixel(x, y, v, *v0, *v1, *v2,
-                      float(1.0 - (w1 + w2)), float(w1), float(w2));
-          }
+          drawSpan(v, *v0, *v1, *v2, x, y, width - x, 1,
+                   w1, w2, a1, a2, false);
         }
       }
     }
@@ -1091,13 +1163,8 @@ void Plot3D_TriShape::drawTriangles()
           x = (x < (width - 1) ? x : (width - 1));
           double  w1 = ((double(x) - x0) * a1) + (yf * b1);
           double  w2 = ((double(x) - x0) * a2) + (yf * b2);
-          for ( ; BRANCH_LIKELY(x >= 0); x--, w1 -= a1, w2 -= a2)
-          {
-            if (w2 < -0.0000005 || (w1 + w2) > 1.0000005)
-              break;
-            drawPixel(x, y, v, *v0, *v1, *v2,
-                      float(1.0 - (w1 + w2)), float(w1), float(w2));
-          }
+          drawSpan(v, *v0, *v1, *v2, x, y, x + 1, -1,
+                   w1, w2, -a1, -a2, true);
         }
       }
       else                              // positive X direction
@@ -1109,13 +1176,8 @@ void Plot3D_TriShape::drawTriangles()
           x = (x > 0 ? x : 0);
           double  w1 = ((double(x) - x0) * a1) + (yf * b1);
           double  w2 = ((double(x) - x0) * a2) + (yf * b2);
-          for ( ; BRANCH_LIKELY(x < width); x++, w1 += a1, w2 += a2)
-          {
-            if (w2 < -0.0000005 || (w1 + w2) > 1.0000005)
-              break;
-            drawPixel(x, y, v, *v0, *v1, *v2,
-                      float(1.0 - (w1 + w2)), float(w1), float(w2));
-          }
+          drawSpan(v, *v0, *v1, *v2, x, y, width - x, 1,
+                   w1, w2, a1, a2, true);
         }
       }
     }
@@ -1145,6 +1207,7 @@ Plot3D_TriShape::Plot3D_TriShape(
     renderMode((unsigned char) (mode & 15U)),
     usingSRGBColorSpace(renderMode < 12),
     waterUVScale(32),
+    depthPassMode(0),
     debugMode(0U),
     lightVector(0.0f, 0.0f, 1.0f, 0.0f),
     lightColor(1.0f),
@@ -1210,6 +1273,23 @@ void Plot3D_TriShape::drawTriShape(
   {
     return;                     // not water and no diffuse texture
   }
+  if (BRANCH_UNLIKELY(depthPassMode))
+  {
+    // opaque meshes always write the depth buffer
+    bool    isOpaque =
+        !((m.flags & (BGSMFile::Flag_TSWater | BGSMFile::Flag_IsEffect)) ||
+          m.getAlphaThreshold() > 0.0f);
+    depthPassMode = (unsigned char) ((depthPassMode & 3) | (!isOpaque ? 0 : 4));
+    if (depthPassMode & 1)
+    {
+      if (isOpaque && transformVertexData(modelTransform, viewTransform))
+      {
+        textureD = (DDSTexture *) 0;
+        drawTriangles();
+      }
+      return;
+    }
+  }
   lightVector = FloatVector4(lightX, lightY, lightZ, 0.0f);
   size_t  triangleCntRendered =
       transformVertexData(modelTransform, viewTransform);
@@ -73,6 +73,7 @@ class Plot3D_TriShape : public NIFFile::NIFTriShape
   unsigned char renderMode;
   bool    usingSRGBColorSpace;
   std::uint16_t waterUVScale;
+  unsigned char depthPassMode;
   unsigned int  debugMode;
   FloatVector4  lightVector;
   FloatVector4  lightColor;             // lightColor[3] = overall RGB scale
@@ -171,6 +172,19 @@ class Plot3D_TriShape : public NIFFile::NIFTriShape
   inline void drawPixel(int x, int y, Fragment& v,
                         const Vertex& v0, const Vertex& v1, const Vertex& v2,
                         float w0f, float w1f, float w2f);
+  // interpolates the remaining vertex attributes and draws a pixel that has
+  // already passed the depth test, v.xyz must be set by the caller
+  inline void shadePixel(size_t offs, Fragment& v,
+                         const Vertex& v0, const Vertex& v1, const Vertex& v2,
+                         FloatVector4 w0, FloatVector4 w1, FloatVector4 w2);
+  // draws up to n pixels of a horizontal span from x, y in the direction of
+  // xStep (1 or -1), until the edge of the triangle is reached; w1 and w2
+  // are incremented by a1 and a2 per pixel, the end of the span is checked
+  // on the edge with w2 = 0 if checkW2 is true, or w1 = 0 otherwise
+  inline void drawSpan(Fragment& v,
+                       const Vertex& v0, const Vertex& v1, const Vertex& v2,
+                       int x, int y, int n, int xStep, double w1, double w2,
+                       double a1, double a2, bool checkW2);
   void drawLine(Fragment& v, const Vertex& v0, const Vertex& v1);
   void drawTriangles();
  public:
@@ -242,6 +256,19 @@ class Plot3D_TriShape : public NIFFile::NIFTriShape
   {
     debugMode = (n <= 5U ? (n != 1U ? n : (0x80000000U | c)) : 0U);
   }
+  // n = 0: default mode, draw pixels that are closer than the depth buffer
+  // n = 1: depth prepass, only write the depth of opaque meshes
+  // n = 2: also draw pixels with a depth equal to the buffer, for shading
+  //        after a depth prepass
+  // bit 2 is set internally while drawing an opaque mesh in mode 2
+  inline void setDepthPassMode(unsigned char n)
+  {
+    depthPassMode = n;
+  }
+  inline unsigned char getDepthPassMode() const
+  {
+    return (depthPassMode & 3);
+  }
   // Calculate ambient light from the average color of a cube map.
   FloatVector4 cubeMapToAmbient(const DDSTexture *e) const;
 };
@@ -11,17 +11,13 @@ bool Renderer::RenderObject::operator<(const RenderObject& r) const
     return bool(r.flags & 2);
   if (flags & 2)
   {
-    unsigned int  modelID1 = model.o->modelID;
-    unsigned int  modelID2 = r.model.o->modelID;
-    unsigned int  modelMask1 = ~(Renderer::modelBatchCnt - 1U);
-    if ((modelID1 & modelMask1) != (modelID2 & modelMask1))
-      return ((modelID1 & modelMask1) < (modelID2 & modelMask1));
+    if (model.o->modelBatch != r.model.o->modelBatch)
+      return (model.o->modelBatch < r.model.o->modelBatch);
     if (tileIndex != r.tileIndex)
       return (tileIndex < r.tileIndex);
     if (z != r.z)
       return (z < r.z);
-    unsigned int  modelMask2 = Renderer::modelBatchCnt - 1U;
-    return ((modelID1 & modelMask2) < (modelID2 & modelMask2));
+    return (model.o->modelID < r.model.o->modelID);
   }
   if (tileIndex != r.tileIndex)
     return (tileIndex < r.tileIndex);
@@ -33,36 +29,21 @@ bool Renderer::RenderObject::operator<(const RenderObject& r) const
 }
 
 Renderer::ModelData::ModelData()
-  : nifFile((NIFFile *) 0),
+  : model((ModelCache::CachedModel *) 0),
     totalTriangleCnt(0),
-    o((BaseObject *) 0),
-    loadThread((std::thread *) 0)
+    o((BaseObject *) 0)
 {
 }
 
-Renderer::ModelData::~ModelData()
+void Renderer::ModelData::clear(ModelCache& modelCache)
 {
-  if (loadThread)
+  if (model)
   {
-    loadThread->join();
-    delete loadThread;
-    loadThread = (std::thread *) 0;
-  }
-  clear();
-}
-
-void Renderer::ModelData::clear()
-{
-  if (nifFile)
-  {
-    delete nifFile;
-    nifFile = (NIFFile *) 0;
+    modelCache.releaseModel(model);
+    model = (ModelCache::CachedModel *) 0;
   }
   totalTriangleCnt = 0;
-  meshData.clear();
-  o = (BaseObject *) 0;
-  threadErrMsg.clear();
-  fileBuf.clear();
+  modelBounds = NIFFile::NIFBounds();
 }
 
 Renderer::RenderThread::RenderThread()
@@ -82,19 +63,8 @@ Renderer::RenderThread::~RenderThread()
   clear();
 }
 
-void Renderer::RenderThread::join()
-{
-  if (t)
-  {
-    t->join();
-    delete t;
-    t = (std::thread *) 0;
-  }
-}
-
 void Renderer::RenderThread::clear()
 {
-  join();
   errMsg.clear();
   if (terrainMesh)
   {
@@ -102,6 +72,7 @@ void Renderer::RenderThread::clear()
     terrainMesh = (TerrainMesh *) 0;
   }
   objectsRemaining.clear();
+  zBlocksUpdated.clear();
 }
 
 unsigned long long Renderer::calculateTileMask(int x0, int y0,
@@ -175,7 +146,7 @@ signed short Renderer::calculateTileIndex(unsigned long long screenAreasUsed)
   return 1344;
 }
 
-int Renderer::setScreenAreaUsed(RenderObject& p)
+bool Renderer::calculateScreenArea(RenderObject& p, NIFFile::NIFBounds& bounds)
 {
   p.tileIndex = -1;
   NIFFile::NIFVertexTransform vt;
@@ -202,7 +173,7 @@ int Renderer::setScreenAreaUsed(RenderObject& p)
   else if (p.flags & 1)
   {
     if (!landData)
-      return -1;
+      return false;
     float   xyScale = 4096.0f / float(landData->getCellResolution());
     float   xOffset = -xyScale * float(landData->getOriginX());
     float   yOffset = xyScale * float(landData->getOriginY());
@@ -253,7 +224,7 @@ int Renderer::setScreenAreaUsed(RenderObject& p)
   }
   else
   {
-    return -1;
+    return false;
   }
   NIFFile::NIFBounds  screenBounds;
   for (int i = 0; i < 8; i++)
@@ -264,24 +235,33 @@ int Renderer::setScreenAreaUsed(RenderObject& p)
     v = vt.transformXYZ(v);
     screenBounds += v;
   }
-  worldBounds += screenBounds.boundsMin;
-  worldBounds += screenBounds.boundsMax;
+  FloatVector4  imageOffset(float(imageX0), float(imageY0), 0.0f, 0.0f);
+  bounds += (screenBounds.boundsMin + imageOffset);
+  bounds += (screenBounds.boundsMax + imageOffset);
   screenBounds.boundsMin -= 2.0f;
   screenBounds.boundsMax += 2.0f;
-  int     xMin = roundFloat(screenBounds.xMin());
-  int     yMin = roundFloat(screenBounds.yMin());
+  int     xMin = roundFloat(screenBounds.xMin()) + imageX0;
+  int     yMin = roundFloat(screenBounds.yMin()) + imageY0;
   int     zMin = roundFloat(screenBounds.zMin());
-  int     xMax = roundFloat(screenBounds.xMax());
-  int     yMax = roundFloat(screenBounds.yMax());
+  int     xMax = roundFloat(screenBounds.xMax()) + imageX0;
+  int     yMax = roundFloat(screenBounds.yMax()) + imageY0;
   int     zMax = roundFloat(screenBounds.zMax());
-  if (xMin >= width || xMax < 0 || yMin >= height || yMax < 0 ||
+  // in tiled mode, objects within the size of a tile outside the image are
+  // also included, because the tiles may extend outside the image
+  int     xMargin = (imageX0 == 0 && width == fullImageWidth ? 0 : width);
+  int     yMargin = (imageY0 == 0 && height == fullImageHeight ? 0 : height);
+  if (xMin >= (fullImageWidth + xMargin) || xMax < -xMargin ||
+      yMin >= (fullImageHeight + yMargin) || yMax < -yMargin ||
       zMin >= zRangeMax || zMax < 0)
   {
-    return -1;
+    return false;
   }
-  p.tileIndex = calculateTileIndex(calculateTileMask(xMin, yMin, xMax, yMax));
+  p.screenX0 = xMin;
+  p.screenY0 = yMin;
+  p.screenX1 = xMax;
+  p.screenY1 = yMax;
   p.z = roundFloat(screenBounds.zMin() * 64.0f);
-  return p.tileIndex;
+  return true;
 }
 
 unsigned int Renderer::getDefaultWorldID() const
@@ -291,7 +271,19 @@ unsigned int Renderer::getDefaultWorldID() const
   return 0x0000003CU;
 }
 
-void Renderer::addTerrainCell(const ESMFile::ESMRecord& r)
+void Renderer::updateEnvMapOffset()
+{
+  for (size_t i = 0; i < renderThreads.size(); i++)
+  {
+    renderThreads[i].renderer->setEnvMapOffset(
+        float(imageX0) - (float(fullImageWidth) * 0.5f),
+        float(imageY0) - (float(fullImageHeight) * 0.5f),
+        float(fullImageHeight) * reflectionZScale);
+  }
+}
+
+void Renderer::addTerrainCell(FoundObjects& objects,
+                              const ESMFile::ESMRecord& r)
 {
   if (!(r == "CELL" && landData))
     return;
@@ -347,17 +339,18 @@ void Renderer::addTerrainCell(const ESMFile::ESMRecord& r)
       tmp.model.t.y0 = (signed short) (y > 0 ? y : 0);
       tmp.model.t.x1 = (signed short) (x2 < w ? x2 : w);
       tmp.model.t.y1 = (signed short) (y2 < h ? y2 : h);
-      if (setScreenAreaUsed(tmp) >= 0)
+      if (calculateScreenArea(tmp, objects.worldBounds))
       {
         if (debugMode == 1)
           tmp.z = int(r.formID);
-        objectList.push_back(tmp);
+        objects.objectList.push_back(tmp);
       }
     }
   }
 }
 
-void Renderer::addWaterCell(const ESMFile::ESMRecord& r)
+void Renderer::addWaterCell(FoundObjects& objects,
+                            const ESMFile::ESMRecord& r)
 {
   if (!(r == "CELL"))
     return;
@@ -402,26 +395,36 @@ void Renderer::addWaterCell(const ESMFile::ESMRecord& r)
   tmp.modelTransform.offsX = float(cellX) * 4096.0f;
   tmp.modelTransform.offsY = float(cellY) * 4096.0f;
   tmp.modelTransform.offsZ = waterLevel;
-  if (setScreenAreaUsed(tmp) >= 0)
+  if (calculateScreenArea(tmp, objects.worldBounds))
   {
     if (debugMode == 1)
       tmp.z = int(r.formID);
     getWaterColor(tmp, r);
-    objectList.push_back(tmp);
+    objects.objectList.push_back(tmp);
   }
 }
 
 const Renderer::BaseObject * Renderer::readModelProperties(
     RenderObject& p, const ESMFile::ESMRecord& r)
 {
-  std::map< unsigned int, BaseObject >::const_iterator  i =
-      baseObjects.find(r.formID);
-  if (i == baseObjects.end())
+  const BaseObject  *o = (BaseObject *) 0;
+  {
+    std::lock_guard< std::mutex > baseObjectsLock(baseObjectsMutex);
+    std::map< unsigned int, BaseObject >::const_iterator  i =
+        baseObjects.find(r.formID);
+    if (i != baseObjects.end())
+      o = &(i->second);
+  }
+  if (!o)
   {
+    // the record is parsed without holding the lock, if another thread
+    // adds the same object in the meantime, its copy is used
     BaseObject  tmp;
+    std::string stringBuf;
     tmp.type = 0;
     tmp.flags = 0x0000;
     tmp.modelID = 0xFFFFFFFFU;
+    tmp.modelBatch = 0xFFFFFFFFU;
     tmp.mswpFormID = 0U;
     tmp.obndX0 = 0;
     tmp.obndY0 = 0;
@@ -464,7 +467,6 @@ const Renderer::BaseObject * Renderer::readModelProperties(
       bool    haveOBND = false;
       bool    isWater = (r == "PWAT");
       bool    isHDModel = false;
-      stringBuf.clear();
       ESMFile::ESMField f(esmFile, r);
       while (f.next())
       {
@@ -540,23 +542,28 @@ const Renderer::BaseObject * Renderer::readModelProperties(
       tmp.modelPath = stringBuf;
     }
     while (false);
-    i = baseObjects.insert(std::pair< unsigned int, BaseObject >(
-                               r.formID, tmp)).first;
+    std::lock_guard< std::mutex > baseObjectsLock(baseObjectsMutex);
+    o = &(baseObjects.insert(std::pair< unsigned int, BaseObject >(
+                                 r.formID, tmp)).first->second);
   }
-  if (!(i->second.flags & 7))
+  if (!(o->flags & 7))
     return (BaseObject *) 0;
-  p.flags = i->second.flags;
-  p.model.o = &(i->second);
-  p.mswpFormID = i->second.mswpFormID;
+  p.flags = o->flags;
+  p.model.o = o;
+  p.mswpFormID = o->mswpFormID;
   if (p.mswpFormID)
-  {
-    p.mswpFormID =
-        materialSwaps.loadMaterialSwap(ba2File, esmFile, p.mswpFormID);
-  }
-  return &(i->second);
+    p.mswpFormID = loadMaterialSwap(p.mswpFormID);
+  return o;
+}
+
+unsigned int Renderer::loadMaterialSwap(unsigned int formID)
+{
+  std::lock_guard< std::mutex > materialSwapsLock(materialSwapsMutex);
+  return materialSwaps.loadMaterialSwap(ba2File, esmFile, formID);
 }
 
-void Renderer::addSCOLObjects(const ESMFile::ESMRecord& r,
+void Renderer::addSCOLObjects(FoundObjects& objects,
+                              const ESMFile::ESMRecord& r,
                               float scale, float rX, float rY, float rZ,
                               float offsX, float offsY, float offsZ,
                               unsigned int refrMSWPFormID)
@@ -612,7 +619,7 @@ void Renderer::addSCOLObjects(const ESMFile::ESMRecord& r,
         tmp.modelTransform =
             NIFFile::NIFVertexTransform(scale, rX, rY, rZ, offsX, offsY, offsZ);
         tmp.modelTransform *= vt;
-        if (setScreenAreaUsed(tmp) >= 0)
+        if (calculateScreenArea(tmp, objects.worldBounds))
         {
           if (!tmp.mswpFormID)
           {
@@ -625,19 +632,17 @@ void Renderer::addSCOLObjects(const ESMFile::ESMRecord& r,
             else
               tmp.mswpFormID = o->mswpFormID;
             if (tmp.mswpFormID && tmp.mswpFormID != o->mswpFormID)
-            {
-              tmp.mswpFormID = materialSwaps.loadMaterialSwap(
-                                   ba2File, esmFile, tmp.mswpFormID);
-            }
+              tmp.mswpFormID = loadMaterialSwap(tmp.mswpFormID);
           }
-          objectList.push_back(tmp);
+          objects.objectList.push_back(tmp);
         }
       }
     }
   }
 }
 
-void Renderer::findObjects(unsigned int formID, int type, bool isRecursive)
+void Renderer::findObjects(FoundObjects& objects,
+                           unsigned int formID, int type, bool isRecursive)
 {
   const ESMFile::ESMRecord  *r = (ESMFile::ESMRecord *) 0;
   do
@@ -654,17 +659,15 @@ void Renderer::findObjects(unsigned int formID, int type, bool isRecursive)
               r2->formID == 1U))        // ignore starting cell at 0, 0
         {
           if (type == 0)
-            addTerrainCell(*r);
+            addTerrainCell(objects, *r);
           else
-            addWaterCell(*r);
+            addWaterCell(objects, *r);
         }
       }
-      if (!isRecursive)
-        break;
       if (*r == "GRUP" && r->children)
       {
         if (r->formID > 0U && r->formID < (!type ? 6U : 10U) && r->formID != 7U)
-          findObjects(r->children, type, true);
+          findObjects(objects, r->children, type, true);
       }
       continue;
     }
@@ -710,7 +713,7 @@ void Renderer::findObjects(unsigned int formID, int type, bool isRecursive)
       continue;
     if (*r2 == "SCOL" && !enableSCOL)
     {
-      addSCOLObjects(*r2, scale, rX, rY, rZ, offsX, offsY, offsZ,
+      addSCOLObjects(objects, *r2, scale, rX, rY, rZ, offsX, offsY, offsZ,
                      refrMSWPFormID);
       continue;
     }
@@ -722,7 +725,7 @@ void Renderer::findObjects(unsigned int formID, int type, bool isRecursive)
       continue;
     tmp.modelTransform = NIFFile::NIFVertexTransform(scale, rX, rY, rZ,
                                                      offsX, offsY, offsZ);
-    if (setScreenAreaUsed(tmp) < 0)
+    if (!calculateScreenArea(tmp, objects.worldBounds))
       continue;
     if (debugMode == 1)
       tmp.z = int(r->formID);
@@ -733,17 +736,40 @@ void Renderer::findObjects(unsigned int formID, int type, bool isRecursive)
     else if (refrMSWPFormID)
     {
       if (refrMSWPFormID != o->mswpFormID)
-      {
-        refrMSWPFormID =
-            materialSwaps.loadMaterialSwap(ba2File, esmFile, refrMSWPFormID);
-      }
+        refrMSWPFormID = loadMaterialSwap(refrMSWPFormID);
       tmp.mswpFormID = refrMSWPFormID;
     }
-    objectList.push_back(tmp);
+    objects.objectList.push_back(tmp);
   }
   while ((formID = r->next) != 0U && isRecursive);
 }
 
+void Renderer::addFindObjectsTasks(std::vector< ThreadPoolTask >& tasks,
+                                   unsigned int formID, int type)
+{
+  while (formID)
+  {
+    const ESMFile::ESMRecord  *r = esmFile.getRecordPtr(formID);
+    if (!r)
+      break;
+    if (*r == "GRUP" && (r->formID == 1U || r->formID == 4U))
+    {
+      addFindObjectsTasks(tasks, r->children, type);
+    }
+    else
+    {
+      ThreadPoolTask  tmp;
+      tmp.taskType = (unsigned int) type + 2U;
+      tmp.modelID = formID;
+      tmp.startPos = tasks.size();
+      tmp.endPos = 0;
+      tmp.tileIndexMask = 0ULL;
+      tasks.push_back(tmp);
+    }
+    formID = r->next;
+  }
+}
+
 void Renderer::findObjects(unsigned int formID, int type)
 {
   if (!formID)
@@ -751,8 +777,11 @@ void Renderer::findObjects(unsigned int formID, int type)
   const ESMFile::ESMRecord  *r = esmFile.getRecordPtr(formID);
   if (!r)
     return;
+  foundObjects.clear();
   if (*r == "WRLD")
   {
+    // the cell groups of the world are searched on multiple threads
+    std::vector< ThreadPoolTask > tasks;
     r = esmFile.getRecordPtr(0U);
     while (r && r->next)
     {
@@ -771,16 +800,19 @@ void Renderer::findObjects(unsigned int formID, int type)
               r2->children)
           {
             // world children
-            findObjects(r2->children, type, true);
+            addFindObjectsTasks(tasks, r2->children, type);
           }
           groupID = r2->next;
         }
       }
     }
+    foundObjects.resize(tasks.size());
+    runTaskQueue(tasks);
   }
   else if (*r == "CELL")
   {
-    findObjects(formID, type, false);
+    foundObjects.resize(1);
+    findObjects(foundObjects[0], formID, type, false);
     r = esmFile.getRecordPtr(0U);
     while (r)
     {
@@ -795,7 +827,7 @@ void Renderer::findObjects(unsigned int formID, int type)
                  r->children)
         {
           // cell children
-          findObjects(r->children, type, true);
+          findObjects(foundObjects[0], r->children, type, true);
         }
       }
       while (r && !r->next && r->parent)
@@ -807,11 +839,44 @@ void Renderer::findObjects(unsigned int formID, int type)
   }
   else if (!(*r == "GRUP"))
   {
-    findObjects(formID, type, false);
+    foundObjects.resize(1);
+    findObjects(foundObjects[0], formID, type, false);
   }
   else if (r->children)
   {
-    findObjects(r->children, type, true);
+    foundObjects.resize(1);
+    findObjects(foundObjects[0], r->children, type, true);
+  }
+  // merge the results in the original order of the records
+  for (size_t i = 0; i < foundObjects.size(); i++)
+  {
+    const FoundObjects& p = foundObjects[i];
+    objectList.insert(objectList.end(),
+                      p.objectList.begin(), p.objectList.end());
+    if (p.worldBounds.xMin() <= p.worldBounds.xMax())
+    {
+      worldBounds += p.worldBounds.boundsMin;
+      worldBounds += p.worldBounds.boundsMax;
+    }
+  }
+  foundObjects.clear();
+}
+
+void Renderer::filterObjectList(const std::vector< RenderObject >& objects)
+{
+  objectList.clear();
+  for (size_t i = 0; i < objects.size(); i++)
+  {
+    const RenderObject& p = objects[i];
+    int     x0 = p.screenX0 - imageX0;
+    int     y0 = p.screenY0 - imageY0;
+    int     x1 = p.screenX1 - imageX0;
+    int     y1 = p.screenY1 - imageY0;
+    if (x0 >= width || x1 < 0 || y0 >= height || y1 < 0)
+      continue;
+    objectList.push_back(p);
+    objectList.back().tileIndex =
+        calculateTileIndex(calculateTileMask(x0, y0, x1, y1));
   }
 }
 
@@ -840,22 +905,56 @@ void Renderer::sortObjectList()
     if (objectList[i].flags & 0x02)
       modelPathsUsed[objectList[i].model.o->modelPath] = 0U;
   }
+  // divide the models into batches that are loaded and rendered together,
+  // using the uncompressed file size as an estimate of the memory used
+  clear(0x20);
+  nifFiles.clear();
+  nifFiles.resize(modelPathsUsed.size());
+  modelBatches.clear();
+  modelBatches.push_back(0U);
+  size_t  batchSizeLimit =
+      modelCache.modelCacheSize / size_t(modelPrefetchCnt + 1);
+  size_t  batchDataSize = 0;
   unsigned int  n = 0U;
   for (std::map< std::string, unsigned int >::iterator
            i = modelPathsUsed.begin(); i != modelPathsUsed.end(); i++, n++)
   {
     i->second = n;
+    long    fileSize = ba2File.getFileSize(i->first);
+    size_t  dataSize = size_t(fileSize > 0L ? fileSize : 0L);
+    if (n > modelBatches.back() &&
+        ((n - modelBatches.back()) >= modelBatchMaxCnt ||
+         (batchDataSize + dataSize) > batchSizeLimit))
+    {
+      modelBatches.push_back(n);
+      batchDataSize = 0;
+    }
+    batchDataSize = batchDataSize + dataSize;
   }
+  modelBatches.push_back(n);
   for (std::map< unsigned int, BaseObject >::iterator
            i = baseObjects.begin(); i != baseObjects.end(); i++)
   {
     std::map< std::string, unsigned int >::const_iterator j =
         modelPathsUsed.find(i->second.modelPath);
     if (j == modelPathsUsed.end())
+    {
       i->second.modelID = 0xFFFFFFFFU;
+      i->second.modelBatch = 0xFFFFFFFFU;
+    }
     else
+    {
       i->second.modelID = j->second;
+      i->second.modelBatch = (unsigned int) (std::upper_bound(
+                                                 modelBatches.begin(),
+                                                 modelBatches.end(),
+                                                 j->second)
+                                             - modelBatches.begin()) - 1U;
+      nifFiles[j->second].o = &(i->second);
+    }
   }
+  modelBatchLoadsPending.clear();
+  modelBatchLoadsPending.resize(modelBatches.size(), 0U);
   std::sort(objectList.begin(), objectList.end());
 }
 
@@ -898,11 +997,23 @@ void Renderer::clear(unsigned int flags)
   }
   if (flags & 0x20)
   {
+    cancelBackgroundTasks();
     for (size_t i = 0; i < nifFiles.size(); i++)
-      nifFiles[i].clear();
+      nifFiles[i].clear(modelCache);
+    modelCache.shrinkModelCache();
   }
   if (flags & 0x40)
     textureCache.clear();
+  if (flags & 0x80)
+    modelCache.clear();
+  if (flags & 0x0100)
+  {
+    for (int i = 0; i < 2; i++)
+    {
+      imageObjects[i].clear();
+      imageObjectsFormIDs[i] = 0xFFFFFFFFU;
+    }
+  }
 }
 
 bool Renderer::isExcludedModel(const std::string& modelPath) const
@@ -925,63 +1036,171 @@ bool Renderer::isHighQualityModel(const std::string& modelPath) const
   return false;
 }
 
-void Renderer::loadModels(unsigned int t, unsigned long long modelIDMask)
+void Renderer::loadModel(size_t threadNum, unsigned int n)
 {
-  for (size_t n = 0; modelIDMask; modelIDMask = modelIDMask >> 1, n++)
+  nifFiles[n].clear(modelCache);
+  if (!nifFiles[n].o)
+    return;
+  const BaseObject& o = *(nifFiles[n].o);
+  if (o.modelID == 0xFFFFFFFFU || o.modelPath.empty())
+    return;
+  if (renderPass & 4)
   {
-    if (!(modelIDMask & 1U))
-      continue;
-    const BaseObject& o = *(nifFiles[n].o);
-    nifFiles[n].clear();
-    if (o.modelID == 0xFFFFFFFFU || o.modelPath.empty())
-      continue;
-    if (renderPass & 4)
+    if (std::strncmp(o.modelPath.c_str(), "meshes/sky/", 11) == 0 ||
+        std::strncmp(o.modelPath.c_str(), "meshes/effects/ambient/", 23) == 0)
     {
-      if (std::strncmp(o.modelPath.c_str(), "meshes/sky/", 11) == 0 ||
-          std::strncmp(o.modelPath.c_str(), "meshes/effects/ambient/", 23) == 0)
-      {
+      return;
+    }
+  }
+  try
+  {
+    bool    isHDModel = bool(o.flags & 0x0040);
+    nifFiles[n].model = modelCache.loadModel(
+                            ba2File, o.modelPath,
+                            renderThreads[threadNum].fileBuf,
+                            (unsigned int) (modelLOD > 0 && !isHDModel), true);
+    const std::vector< NIFFile::NIFTriShape >&  meshData =
+        nifFiles[n].model->meshData;
+    for (size_t i = 0; i < meshData.size(); i++)
+    {
+      const NIFFile::NIFTriShape& ts = meshData[i];
+      // the bounds include the meshes of both render passes, so that objects
+      // with visible alpha blended parts are not culled in the first pass,
+      // where renderObject() sets the alpha blending flag of the object
+      if ((((ts.m.flags >> 10) ^ renderPass) & 0x20U) || !ts.triangleCnt)
         continue;
-      }
+      ts.calculateBounds(nifFiles[n].modelBounds);
+      // check alpha blending (0x1000) flag
+      if (((ts.m.flags >> 10) ^ renderPass) & 0x04U)
+        continue;
+      nifFiles[n].totalTriangleCnt += size_t(ts.triangleCnt);
     }
-    try
+  }
+  catch (FO76UtilsError&)
+  {
+    nifFiles[n].clear(modelCache);
+  }
+}
+
+void Renderer::prefetchModelTextures(size_t threadNum, unsigned int n)
+{
+  const BaseObject  *o = nifFiles[n].o;
+  if (!enableTextures || !o || o->mswpFormID || !nifFiles[n].model)
+    return;
+  bool    isHDModel = bool(o->flags & 0x0040);
+  std::vector< unsigned char >& fileBuf = renderThreads[threadNum].fileBuf;
+  const std::vector< NIFFile::NIFTriShape >&  meshData =
+      nifFiles[n].model->meshData;
+  for (size_t i = 0; i < meshData.size(); i++)
+  {
+    const NIFFile::NIFTriShape& ts = meshData[i];
+    if ((((ts.m.flags >> 10) ^ renderPass) & 0x24U) ||
+        (ts.m.flags & BGSMFile::Flag_TSWater) || !ts.triangleCnt)
     {
-      ba2File.extractFile(nifFiles[t].fileBuf, o.modelPath);
-      nifFiles[n].nifFile = new NIFFile(&(nifFiles[t].fileBuf.front()),
-                                        nifFiles[t].fileBuf.size(), &ba2File);
-      bool    isHDModel = bool(o.flags & 0x0040);
-      nifFiles[n].nifFile->getMesh(nifFiles[n].meshData, 0U,
-                                   (unsigned int) (modelLOD > 0 && !isHDModel),
-                                   true);
-      size_t  meshCnt = nifFiles[n].meshData.size();
-      for (size_t i = 0; i < meshCnt; i++)
-      {
-        const NIFFile::NIFTriShape& ts = nifFiles[n].meshData[i];
-        // check hidden (0x8000) and alpha blending (0x1000) flags
-        if (((ts.m.flags >> 10) ^ renderPass) & 0x24U)
-          continue;
-        nifFiles[n].totalTriangleCnt += size_t(ts.triangleCnt);
-      }
+      continue;
     }
-    catch (FO76UtilsError&)
+    unsigned int  texturePathMask = ts.m.texturePathMask;
+    texturePathMask &= ((((unsigned int) ts.m.flags & 0x80U) >> 5)
+                        | (!isHDModel ? 0x0009U : 0x037BU));
+    if (!(texturePathMask & 0x0001U) ||
+        ts.texturePaths[0]->find("/temp_ground") != std::string::npos)
     {
-      nifFiles[n].clear();
+      continue;
+    }
+    for (unsigned int k = 0; texturePathMask; k++, texturePathMask >>= 1)
+    {
+      if (!(texturePathMask & 1U))
+        continue;
+      // textures already being loaded by another thread are skipped
+      bool    waitFlag = false;
+      (void) textureCache.loadTexture(ba2File, *(ts.texturePaths[k]), fileBuf,
+                                      (!(k == 3 || k == 4) ? textureMip : 0),
+                                      &waitFlag);
     }
   }
 }
 
-void Renderer::loadModelsThread(Renderer *p,
-                                unsigned int t, unsigned long long modelIDMask)
+bool Renderer::isObjectVisible(const RenderObject& p,
+                               const NIFFile::NIFVertexTransform& vt) const
 {
-  try
+  // the bounds of the loaded meshes are used instead of OBND, which may be
+  // missing or incorrect, and are extended by the same margins as in
+  // calculateScreenArea()
+  const NIFFile::NIFBounds& modelBounds =
+      nifFiles[p.model.o->modelID].modelBounds;
+  if (!(modelBounds.xMin() <= modelBounds.xMax()))
+    return false;                       // no visible meshes
+  FloatVector4  boundsMin(modelBounds.boundsMin);
+  FloatVector4  boundsMax(modelBounds.boundsMax);
+  boundsMin -= 2.0f;
+  boundsMax += 2.0f;
+  NIFFile::NIFBounds  b;
+  for (int i = 0; i < 8; i++)
   {
-    p->nifFiles[t].threadErrMsg.clear();
-    p->loadModels(t, modelIDMask);
+    FloatVector4  v((!(i & 1) ? boundsMin[0] : boundsMax[0]),
+                    (!(i & 2) ? boundsMin[1] : boundsMax[1]),
+                    (!(i & 4) ? boundsMin[2] : boundsMax[2]), 0.0f);
+    b += vt.transformXYZ(v);
+  }
+  int     x0 = roundFloat(b.xMin()) - 2;
+  int     y0 = roundFloat(b.yMin()) - 2;
+  int     x1 = roundFloat(b.xMax()) + 2;
+  int     y1 = roundFloat(b.yMax()) + 2;
+  if (x1 < 0 || y1 < 0 || x0 >= width || y0 >= height)
+    return false;
+  x0 = (x0 > 0 ? x0 : 0) / zBlockSize;
+  y0 = (y0 > 0 ? y0 : 0) / zBlockSize;
+  x1 = (x1 < (width - 1) ? x1 : (width - 1)) / zBlockSize;
+  y1 = (y1 < (height - 1) ? y1 : (height - 1)) / zBlockSize;
+  float   zMin = b.zMin() - 2.0f;
+  for (int y = y0; y <= y1; y++)
+  {
+    const float *zPtr = &(zBlockMax.front()) + (size_t(y) * size_t(zBlocksX));
+    for (int x = x0; x <= x1; x++)
+    {
+      if (zPtr[x] >= zMin)
+        return true;
+    }
   }
-  catch (std::exception& e)
-  {
-    p->nifFiles[t].threadErrMsg = e.what();
-    if (p->nifFiles[t].threadErrMsg.empty())
-      p->nifFiles[t].threadErrMsg = "unknown error in load model thread";
+  return false;
+}
+
+void Renderer::updateZBlockMax(int x0, int y0, int x1, int y1)
+{
+  if (x1 < x0)
+  {
+    zBlocksX = (width + (zBlockSize - 1)) / zBlockSize;
+    zBlocksY = (height + (zBlockSize - 1)) / zBlockSize;
+    zBlockMax.resize(size_t(zBlocksX) * size_t(zBlocksY));
+    x0 = 0;
+    y0 = 0;
+    x1 = zBlocksX - 1;
+    y1 = zBlocksY - 1;
+  }
+  for (int yb = y0; yb <= y1; yb++)
+  {
+    float   *blkPtr = &(zBlockMax.front()) + (size_t(yb) * size_t(zBlocksX));
+    int     yc0 = yb * zBlockSize;
+    int     yc1 = (yc0 + zBlockSize) < height ? (yc0 + zBlockSize) : height;
+    for (int xb = x0; xb <= x1; xb++)
+    {
+      int     xc0 = xb * zBlockSize;
+      int     xc1 = (xc0 + zBlockSize) < width ? (xc0 + zBlockSize) : width;
+      FloatVector4  zMax(0.0f);
+      float   tmp = 0.0f;
+      for (int y = yc0; y < yc1; y++)
+      {
+        const float *zPtr = outBufZ + (size_t(y) * size_t(width) + size_t(xc0));
+        int     w = xc1 - xc0;
+        for ( ; w >= 4; w = w - 4, zPtr = zPtr + 4)
+          zMax.maxValues(FloatVector4(zPtr));
+        for ( ; w > 0; w--, zPtr++)
+          tmp = (*zPtr > tmp ? *zPtr : tmp);
+      }
+      zMax.maxValues(FloatVector4(zMax[1], zMax[0], zMax[3], zMax[2]));
+      tmp = (zMax[0] > tmp ? zMax[0] : tmp);
+      blkPtr[xb] = (zMax[2] > tmp ? zMax[2] : tmp);
+    }
   }
 }
 
@@ -1009,7 +1228,9 @@ struct ThreadSortObject
 void Renderer::renderObjectList()
 {
   clear(0x30);
+  updateZBlockMax();
   std::vector< ThreadSortObject > threadSortBuf(64);
+  std::vector< ThreadPoolTask > tasks;
   if (landData)
   {
     for (size_t i = 0; i < renderThreads.size(); i++)
@@ -1018,7 +1239,8 @@ void Renderer::renderObjectList()
         renderThreads[i].terrainMesh = new TerrainMesh();
     }
   }
-  unsigned int  modelIDBase = 0xFFFFFFFFU;
+  unsigned int  modelBatch = 0xFFFFFFFFU;
+  unsigned int  batchesQueued = 0U;
   for (size_t i = 0; i < objectList.size(); )
   {
     for (size_t k = 0; k < 64; k++)
@@ -1027,50 +1249,34 @@ void Renderer::renderObjectList()
       threadSortBuf[k].triangleCnt = 0;
     }
     const RenderObject& o = objectList[i];
-    unsigned int  modelIDMask = modelBatchCnt - 1U;
-    if ((o.flags & 0x02) && (o.model.o->modelID & ~modelIDMask) != modelIDBase)
-    {
-      // load new set of models
-      modelIDBase = o.model.o->modelID & ~modelIDMask;
-      for (unsigned int n = 0; n < modelBatchCnt; n++)
-        nifFiles[n].clear();
-      unsigned long long  m = 0ULL;
-      for (size_t j = i; j < objectList.size(); j++)
-      {
-        const RenderObject& p = objectList[j];
-        if (!(p.flags & 0x02))
-          continue;
-        if ((p.model.o->modelID & ~modelIDMask) != modelIDBase)
-          break;
-        unsigned int  n = p.model.o->modelID & modelIDMask;
-        nifFiles[n].o = p.model.o;
-        m = m | (1ULL << n);
-      }
-      unsigned long long  tmp = 0ULL;
-      unsigned int  nThreads = (unsigned int) threadCnt;
-      nThreads = (nThreads < modelBatchCnt ? nThreads : modelBatchCnt);
-      for (unsigned int k = 0; k < modelBatchCnt; k = k + nThreads)
-        tmp = tmp | (1ULL << k);
-      for (unsigned int k = 0; k < nThreads; k++, tmp = tmp << 1)
-      {
-        nifFiles[k].loadThread =
-            new std::thread(loadModelsThread, this, k, m & tmp);
-      }
-      for (unsigned int k = 0; k < nThreads; k++)
+    if ((o.flags & 0x02) && o.model.o->modelBatch != modelBatch)
+    {
+      // free the previous batch of models, and start loading the next ones
+      unsigned int  n = o.model.o->modelBatch;
+      for ( ; modelBatch < n && modelBatch < batchesQueued; modelBatch++)
       {
-        nifFiles[k].loadThread->join();
-        delete nifFiles[k].loadThread;
-        nifFiles[k].loadThread = (std::thread *) 0;
+        waitForModelBatch(modelBatch);
+        for (unsigned int k = modelBatches[modelBatch];
+             k < modelBatches[modelBatch + 1U]; k++)
+        {
+          nifFiles[k].clear(modelCache);
+        }
       }
-      for (unsigned int k = 0; k < nThreads; k++)
+      modelCache.shrinkModelCache();
+      modelBatch = n;
+      if (batchesQueued <= n)
+        batchesQueued = n;
+      for ( ; batchesQueued < (modelBatches.size() - 1) &&
+              batchesQueued <= (n + (unsigned int) modelPrefetchCnt);
+            batchesQueued++)
       {
-        if (!nifFiles[k].threadErrMsg.empty())
-          throw FO76UtilsError(1, nifFiles[k].threadErrMsg.c_str());
+        queueModelBatch(batchesQueued);
       }
-      for (unsigned int n = 0; n < modelBatchCnt; n++)
+      waitForModelBatch(n);
+      for (unsigned int k = modelBatches[n]; k < modelBatches[n + 1U]; k++)
       {
-        if (!nifFiles[n].totalTriangleCnt)
-          nifFiles[n].totalTriangleCnt = 1;
+        if (!nifFiles[k].totalTriangleCnt)
+          nifFiles[k].totalTriangleCnt = 1;
       }
     }
     size_t  j = i;
@@ -1079,14 +1285,11 @@ void Renderer::renderObjectList()
       const RenderObject& p = objectList[j];
       if ((o.tileIndex ^ p.tileIndex) & ~63)
         break;
-      if ((p.flags & 2) && (p.model.o->modelID & ~modelIDMask) != modelIDBase)
+      if ((p.flags & 2) && p.model.o->modelBatch != modelBatch)
         break;
       size_t  triangleCnt = 2;
       if (p.flags & 0x02)
-      {
-        triangleCnt =
-            nifFiles[p.model.o->modelID & modelIDMask].totalTriangleCnt;
-      }
+        triangleCnt = nifFiles[p.model.o->modelID].totalTriangleCnt;
       else if ((p.flags & 0x01) && landData)
       {
         triangleCnt = size_t(landData->getCellResolution());
@@ -1099,44 +1302,42 @@ void Renderer::renderObjectList()
     }
     // sort in descending order by triangle count
     std::sort(threadSortBuf.begin(), threadSortBuf.end());
-    for (size_t k = size_t(threadCnt); k < threadSortBuf.size(); k++)
+    size_t  areaCnt = 0;
+    while (areaCnt < 64 && threadSortBuf[areaCnt].triangleCnt > 0)
+      areaCnt++;
+    // with a single thread, render all areas as one task
+    if (threadCnt <= 1)
     {
-      if (threadSortBuf[k].triangleCnt < 1)
-        break;
-      // find the thread with the lowest triangle count
-      size_t  n = 0;
-      for (size_t l = 1; l < size_t(threadCnt); l++)
-      {
-        if (threadSortBuf[l].triangleCnt < threadSortBuf[n].triangleCnt)
-          n = l;
-      }
-      // add the remaining area with the highest triangle count
-      threadSortBuf[n] += threadSortBuf[k];
+      for (size_t k = 1; k < areaCnt; k++)
+        threadSortBuf[0] += threadSortBuf[k];
+      areaCnt = (areaCnt < 1 ? areaCnt : 1);
     }
-    size_t  threadsUsed = size_t(threadCnt);
-    while (threadsUsed > 1 && threadSortBuf[threadsUsed - 1].triangleCnt < 1)
-      threadsUsed--;
-    for (size_t k = 1; k < threadsUsed; k++)
+    for (size_t k = 0; k < areaCnt; k++)
     {
-      renderThreads[k].t = new std::thread(threadFunction, this, k, i, j,
-                                           threadSortBuf[k].tileMask);
-    }
-    if (threadSortBuf[0].triangleCnt > 0)
-      renderThread(0, i, j, threadSortBuf[0].tileMask);
-    for (size_t k = 1; k < threadsUsed; k++)
-      renderThreads[k].join();
-    for (size_t k = 1; k < threadsUsed; k++)
-    {
-      if (!renderThreads[k].errMsg.empty())
-        throw FO76UtilsError(1, renderThreads[k].errMsg.c_str());
+      // each task renders one area, idle threads take the next largest one
+      ThreadPoolTask  tmp;
+      tmp.taskType = 1;
+      tmp.modelID = 0;
+      tmp.startPos = i;
+      tmp.endPos = j;
+      tmp.tileIndexMask = threadSortBuf[k].tileMask;
+      tasks.push_back(tmp);
     }
+    runTaskQueue(tasks);
     // render any remaining objects that were skipped due to incorrect bounds
-    for (size_t k = 0; k < threadsUsed; k++)
+    for (size_t k = 0; k < renderThreads.size(); k++)
     {
       for (size_t l = 0; l < renderThreads[k].objectsRemaining.size(); l++)
         renderObject(renderThreads[k], renderThreads[k].objectsRemaining[l]);
       renderThreads[k].objectsRemaining.clear();
     }
+    for (size_t k = 0; k < renderThreads.size(); k++)
+    {
+      const std::vector< int >& v = renderThreads[k].zBlocksUpdated;
+      for (size_t l = 0; (l + 3) < v.size(); l = l + 4)
+        updateZBlockMax(v[l], v[l + 1], v[l + 2], v[l + 3]);
+      renderThreads[k].zBlocksUpdated.clear();
+    }
     i = j;
     textureCache.shrinkTextureCache();
     if (verboseMode)
@@ -1159,12 +1360,20 @@ bool Renderer::renderObject(RenderThread& t, size_t i,
   {
     NIFFile::NIFVertexTransform vt(p.modelTransform);
     vt *= viewTransform;
-    size_t  n = p.model.o->modelID & (modelBatchCnt - 1U);
+    if (!nifFiles[p.model.o->modelID].model || !isObjectVisible(p, vt))
+      return true;
+    const std::vector< NIFFile::NIFTriShape >&  meshData =
+        nifFiles[p.model.o->modelID].model->meshData;
     t.sortBuf.clear();
-    t.sortBuf.reserve(nifFiles[n].meshData.size());
-    for (size_t j = 0; j < nifFiles[n].meshData.size(); j++)
+    t.sortBuf.reserve(meshData.size());
+    int     xMinDrawn = width;
+    int     yMinDrawn = height;
+    int     xMaxDrawn = 0;
+    int     yMaxDrawn = 0;
+    unsigned char depthPassMode = t.renderer->getDepthPassMode();
+    for (size_t j = 0; j < meshData.size(); j++)
     {
-      const NIFFile::NIFTriShape& ts = nifFiles[n].meshData[j];
+      const NIFFile::NIFTriShape& ts = meshData[j];
       // check hidden (0x8000) and alpha blending (0x1000) flags
       if (((ts.m.flags >> 10) ^ renderPass) & 0x24U)
       {
@@ -1204,20 +1413,69 @@ bool Renderer::renderObject(RenderThread& t, size_t i,
         float   tmp = (zMax[0] > zMax[2] ? zMax[0] : zMax[2]);
         for ( ; w > 0; w--, zPtr++)
           tmp = (*zPtr > tmp ? *zPtr : tmp);
-        if (tmp < b.zMin())
+        // after a depth prepass, the mesh itself may be at the same depth
+        if (tmp < (b.zMin() - float(int(depthPassMode & 2))))
           continue;
         isVisible = true;
         break;
       }
       if (!isVisible)
         continue;
+      xMinDrawn = (x0 < xMinDrawn ? x0 : xMinDrawn);
+      yMinDrawn = (y0 < yMinDrawn ? y0 : yMinDrawn);
+      xMaxDrawn = (x1 > xMaxDrawn ? x1 : xMaxDrawn);
+      yMaxDrawn = (y1 > yMaxDrawn ? y1 : yMaxDrawn);
       t.sortBuf.push_back(TriShapeSortObject(ts, b.zMin()));
       if (BRANCH_UNLIKELY(ts.m.flags & BGSMFile::Flag_TSOrdered))
-        TriShapeSortObject::orderedNodeFix(t.sortBuf, nifFiles[n].meshData);
+        TriShapeSortObject::orderedNodeFix(t.sortBuf, meshData);
     }
     if (t.sortBuf.size() < 1)
       return true;
     std::stable_sort(t.sortBuf.begin(), t.sortBuf.end());
+    if (BRANCH_UNLIKELY(depthPassMode & 1))
+    {
+      // depth prepass: material swaps may change the alpha flags
+      if (p.mswpFormID || p.model.o->mswpFormID)
+        return true;
+      for (size_t j = 0; j < t.sortBuf.size(); j++)
+      {
+        *(t.renderer) = *(t.sortBuf[j].ts);
+        // only opaque meshes are drawn in this pass
+        if ((t.renderer->m.flags
+             & (BGSMFile::Flag_TSWater | BGSMFile::Flag_IsEffect)) ||
+            t.renderer->m.getAlphaThreshold() > 0.0f)
+        {
+          continue;
+        }
+        const DDSTexture  *textures[1];
+        textures[0] = &whiteTexture;
+        if (enableTextures)
+        {
+          // meshes are not drawn if the diffuse texture is missing, the
+          // texture is loaded at the normal mip level because the cache does
+          // not store mip levels separately, and the second pass uses it
+          if (!(t.renderer->m.texturePathMask & 0x0001U) ||
+              t.renderer->texturePaths[0]->find("/temp_ground")
+              != std::string::npos)
+          {
+            continue;
+          }
+          textures[0] = textureCache.loadTexture(
+                            ba2File, *(t.renderer->texturePaths[0]),
+                            t.fileBuf, textureMip);
+          if (!textures[0])
+            continue;
+        }
+        t.renderer->drawTriShape(
+            p.modelTransform, viewTransform, lightX, lightY, lightZ,
+            textures, 1U);
+      }
+      return true;
+    }
+    t.zBlocksUpdated.push_back(xMinDrawn / zBlockSize);
+    t.zBlocksUpdated.push_back(yMinDrawn / zBlockSize);
+    t.zBlocksUpdated.push_back((xMaxDrawn - 1) / zBlockSize);
+    t.zBlocksUpdated.push_back((yMaxDrawn - 1) / zBlockSize);
     bool    isHDModel = bool(p.flags & 0x40);
     for (size_t j = 0; j < t.sortBuf.size(); j++)
     {
@@ -1392,64 +1650,286 @@ void Renderer::renderThread(size_t threadNum, size_t startPos, size_t endPos,
   if (!t.renderer)
     return;
   unsigned long long  tileMask = 0ULL;
-  for (size_t i = startPos; i < endPos; i++)
+  // with depth prepass enabled, opaque objects are rendered in two passes
+  unsigned char depthPassMode = (depthPrepass && renderPass == 2 ? 1 : 0);
+  do
   {
-    int     tileIndex = objectList[i].tileIndex;
-    if (tileIndex < 0 ||
-        !((1ULL << (unsigned int) (tileIndex & 63)) & tileIndexMask) ||
-        ((1ULL << (unsigned int) (tileIndex & 63)) & ~tileIndexMask))
+    t.renderer->setDepthPassMode(depthPassMode);
+    for (size_t i = startPos; i < endPos; i++)
     {
-      continue;
-    }
-    if (BRANCH_UNLIKELY(!tileMask))
-    {
-      // calculate mask of areas this thread is allowed to access
-      if (tileIndex < 64 || tileIndexMask == ~0ULL)
+      int     tileIndex = objectList[i].tileIndex;
+      if (tileIndex < 0 ||
+          !((1ULL << (unsigned int) (tileIndex & 63)) & tileIndexMask) ||
+          ((1ULL << (unsigned int) (tileIndex & 63)) & ~tileIndexMask))
       {
-        tileMask = tileIndexMask;
+        continue;
       }
-      else if (tileIndex < 1344)
+      if (BRANCH_UNLIKELY(!tileMask))
       {
-        for (int l = 0; l < 64; l++)
+        // calculate mask of areas this thread is allowed to access
+        if (tileIndex < 64 || tileIndexMask == ~0ULL)
         {
-          if (!(tileIndexMask & (1ULL << (unsigned int) l)))
-            continue;
-          int     n = (tileIndex & ~63) + l - (tileIndex < 320 ? 64 : 320);
-          int     x0 = (n & 6) + ((n >> 6) & (tileIndex < 320 ? 1 : 3));
-          int     y0 = ((n >> 3) & 6) + ((n >> (tileIndex < 320 ? 7 : 8)) & 3);
-          n = (tileIndex < 320 ? 2 : 4);
-          for (int j = 0; j < n && (y0 + j) < 8; j++)
+          tileMask = tileIndexMask;
+        }
+        else if (tileIndex < 1344)
+        {
+          for (int l = 0; l < 64; l++)
           {
-            for (int k = 0; k < n && (x0 + k) < 8; k++)
-              tileMask = tileMask | (1ULL << (unsigned int) ((j << 3) | k));
+            if (!(tileIndexMask & (1ULL << (unsigned int) l)))
+              continue;
+            int     n = (tileIndex & ~63) + l - (tileIndex < 320 ? 64 : 320);
+            int     x0 = (n & 6) + ((n >> 6) & (tileIndex < 320 ? 1 : 3));
+            int     y0 = ((n >> 3) & 6)
+                         + ((n >> (tileIndex < 320 ? 7 : 8)) & 3);
+            n = (tileIndex < 320 ? 2 : 4);
+            for (int j = 0; j < n && (y0 + j) < 8; j++)
+            {
+              for (int k = 0; k < n && (x0 + k) < 8; k++)
+              {
+                tileMask = tileMask
+                           | (1ULL << (unsigned int) (((y0 + j) << 3)
+                                                      | (x0 + k)));
+              }
+            }
           }
         }
+        else
+        {
+          tileMask = ~0ULL;
+        }
+      }
+      if (!renderObject(t, i, tileMask) && depthPassMode != 1)
+        t.objectsRemaining.push_back((unsigned int) i);
+    }
+    depthPassMode = (depthPassMode == 1 ? 2 : 0);
+  }
+  while (depthPassMode);
+  t.renderer->setDepthPassMode(0);
+}
+
+void Renderer::runTask(size_t threadNum, const ThreadPoolTask& task)
+{
+  try
+  {
+    if (task.taskType == 0)
+    {
+      loadModel(threadNum, task.modelID);
+    }
+    else if (task.taskType == 1)
+    {
+      renderThread(threadNum, task.startPos, task.endPos, task.tileIndexMask);
+    }
+    else
+    {
+      findObjects(foundObjects[task.startPos], task.modelID,
+                  int(task.taskType - 2U), false);
+    }
+  }
+  catch (std::exception& e)
+  {
+    RenderThread& t = renderThreads[threadNum];
+    t.errMsg = e.what();
+    if (t.errMsg.empty())
+      t.errMsg = "unknown error in render thread";
+    // skip the remaining tasks
+    std::lock_guard< std::mutex > poolLock(threadPoolMutex);
+    taskQueuePos = taskQueue.size();
+  }
+}
+
+void Renderer::threadFunction(Renderer *p, size_t threadNum)
+{
+  std::unique_lock< std::mutex >  poolLock(p->threadPoolMutex);
+  while (!p->threadPoolStopFlag)
+  {
+    if (p->taskQueuePos >= p->taskQueue.size())
+    {
+      // models are loaded only if there are no rendering tasks
+      if (p->backgroundTaskPos < p->backgroundTasks.size())
+        p->runBackgroundTask(poolLock, threadNum);
+      else
+        p->threadPoolCond.wait(poolLock);
+      continue;
+    }
+    const ThreadPoolTask& task = p->taskQueue[p->taskQueuePos];
+    p->taskQueuePos++;
+    p->tasksRunning++;
+    poolLock.unlock();
+    p->runTask(threadNum, task);
+    poolLock.lock();
+    if (!(--(p->tasksRunning)))
+      p->tasksDoneCond.notify_all();
+  }
+}
+
+void Renderer::runTaskQueue(std::vector< ThreadPoolTask >& tasks)
+{
+  if (tasks.size() < 1)
+    return;
+  if (tasks.size() > 1)
+    startThreadPool();
+  for (size_t i = 0; i < renderThreads.size(); i++)
+    renderThreads[i].errMsg.clear();
+  {
+    std::unique_lock< std::mutex >  poolLock(threadPoolMutex);
+    taskQueue.swap(tasks);
+    taskQueuePos = 0;
+    threadPoolCond.notify_all();
+    // the main thread also runs tasks while waiting
+    while (true)
+    {
+      if (taskQueuePos < taskQueue.size())
+      {
+        const ThreadPoolTask& task = taskQueue[taskQueuePos];
+        taskQueuePos++;
+        tasksRunning++;
+        poolLock.unlock();
+        runTask(0, task);
+        poolLock.lock();
+        tasksRunning--;
+      }
+      else if (tasksRunning)
+      {
+        tasksDoneCond.wait(poolLock);
       }
       else
       {
-        tileMask = ~0ULL;
+        break;
       }
     }
-    if (!renderObject(t, i, tileMask))
-      t.objectsRemaining.push_back((unsigned int) i);
+    taskQueue.swap(tasks);
+    taskQueuePos = 0;
+  }
+  tasks.clear();
+  for (size_t i = 0; i < renderThreads.size(); i++)
+  {
+    if (!renderThreads[i].errMsg.empty())
+      throw FO76UtilsError(1, renderThreads[i].errMsg.c_str());
   }
 }
 
-void Renderer::threadFunction(Renderer *p, size_t threadNum,
-                              size_t startPos, size_t endPos,
-                              unsigned long long tileIndexMask)
+void Renderer::startThreadPool()
 {
+  for (size_t i = 1; i < renderThreads.size(); i++)
+  {
+    if (!renderThreads[i].t)
+      renderThreads[i].t = new std::thread(threadFunction, this, i);
+  }
+}
+
+void Renderer::stopThreadPool()
+{
+  cancelBackgroundTasks();
+  {
+    std::lock_guard< std::mutex > poolLock(threadPoolMutex);
+    threadPoolStopFlag = true;
+    threadPoolCond.notify_all();
+  }
+  for (size_t i = 0; i < renderThreads.size(); i++)
+  {
+    if (renderThreads[i].t)
+    {
+      renderThreads[i].t->join();
+      delete renderThreads[i].t;
+      renderThreads[i].t = (std::thread *) 0;
+    }
+  }
+  threadPoolStopFlag = false;
+}
+
+void Renderer::runBackgroundTask(std::unique_lock< std::mutex >& poolLock,
+                                 size_t threadNum)
+{
+  ThreadPoolTask  task = backgroundTasks[backgroundTaskPos];
+  backgroundTaskPos++;
+  backgroundTasksRunning++;
+  poolLock.unlock();
   try
   {
-    p->renderThreads[threadNum].errMsg.clear();
-    p->renderThread(threadNum, startPos, endPos, tileIndexMask);
+    loadModel(threadNum, task.modelID);
+    prefetchModelTextures(threadNum, task.modelID);
   }
   catch (std::exception& e)
   {
-    p->renderThreads[threadNum].errMsg = e.what();
-    if (p->renderThreads[threadNum].errMsg.empty())
-      p->renderThreads[threadNum].errMsg = "unknown error in render thread";
+    poolLock.lock();
+    if (backgroundErrMsg.empty())
+    {
+      backgroundErrMsg = e.what();
+      if (backgroundErrMsg.empty())
+        backgroundErrMsg = "unknown error in render thread";
+    }
+    poolLock.unlock();
+  }
+  poolLock.lock();
+  backgroundTasksRunning--;
+  modelBatchLoadsPending[nifFiles[task.modelID].o->modelBatch]--;
+  if (backgroundTaskPos >= backgroundTasks.size() && !backgroundTasksRunning)
+  {
+    backgroundTasks.clear();
+    backgroundTaskPos = 0;
+  }
+  tasksDoneCond.notify_all();
+}
+
+void Renderer::queueModelBatch(unsigned int n)
+{
+  // largest files are loaded first
+  std::vector< std::pair< long, unsigned int > >  modelFileSizes;
+  for (unsigned int i = modelBatches[n]; i < modelBatches[n + 1U]; i++)
+  {
+    long    fileSize = ba2File.getFileSize(nifFiles[i].o->modelPath);
+    modelFileSizes.push_back(std::pair< long, unsigned int >(-fileSize, i));
+  }
+  std::sort(modelFileSizes.begin(), modelFileSizes.end());
+  if (threadCnt > 1)
+    startThreadPool();
+  std::lock_guard< std::mutex > poolLock(threadPoolMutex);
+  for (size_t i = 0; i < modelFileSizes.size(); i++)
+  {
+    ThreadPoolTask  tmp;
+    tmp.taskType = 0;
+    tmp.modelID = modelFileSizes[i].second;
+    tmp.startPos = 0;
+    tmp.endPos = 0;
+    tmp.tileIndexMask = 0ULL;
+    backgroundTasks.push_back(tmp);
+  }
+  modelBatchLoadsPending[n] += (unsigned int) modelFileSizes.size();
+  threadPoolCond.notify_all();
+}
+
+void Renderer::waitForModelBatch(unsigned int n)
+{
+  std::string errMsg;
+  {
+    std::unique_lock< std::mutex >  poolLock(threadPoolMutex);
+    while (modelBatchLoadsPending[n])
+    {
+      if (backgroundTaskPos < backgroundTasks.size())
+        runBackgroundTask(poolLock, 0);
+      else
+        tasksDoneCond.wait(poolLock);
+    }
+    if (backgroundErrMsg.empty())
+      return;
+    errMsg = backgroundErrMsg;
   }
+  cancelBackgroundTasks();
+  throw FO76UtilsError(1, errMsg.c_str());
+}
+
+void Renderer::cancelBackgroundTasks()
+{
+  std::unique_lock< std::mutex >  poolLock(threadPoolMutex);
+  // skip the tasks not started yet, and wait for the running ones to finish
+  backgroundTaskPos = backgroundTasks.size();
+  while (backgroundTasksRunning)
+    tasksDoneCond.wait(poolLock);
+  backgroundTasks.clear();
+  backgroundTaskPos = 0;
+  backgroundErrMsg.clear();
+  for (size_t i = 0; i < modelBatchLoadsPending.size(); i++)
+    modelBatchLoadsPending[i] = 0U;
 }
 
 Renderer::Renderer(int imageWidth, int imageHeight,
@@ -1459,6 +1939,10 @@ Renderer::Renderer(int imageWidth, int imageHeight,
     outBufZ(bufZ),
     width(imageWidth),
     height(imageHeight),
+    imageX0(0),
+    imageY0(0),
+    fullImageWidth(imageWidth),
+    fullImageHeight(imageHeight),
     ba2File(archiveFiles),
     esmFile(masterFiles),
     viewTransform(0.0625f, 3.14159265f, 0.0f, 0.0f,
@@ -1480,12 +1964,23 @@ Renderer::Renderer(int imageWidth, int imageHeight,
     enableSCOL(false),
     enableAllObjects(false),
     enableTextures(true),
+    depthPrepass(false),
     renderMode((unsigned char) ((masterFiles.getESMVersion() >> 4) & 0x0CU)),
     debugMode(0),
     renderPass(0),
     threadCnt(0),
+    landTexturesRemoved(0),
+    zBlocksX(0),
+    zBlocksY(0),
+    taskQueuePos(0),
+    tasksRunning(0),
+    threadPoolStopFlag(false),
+    backgroundTaskPos(0),
+    backgroundTasksRunning(0),
+    modelPrefetchCnt(2),
     waterColor(0xFFFFFFFFU),
     waterReflectionLevel(1.0f),
+    reflectionZScale(1.0f),
     zRangeMax(zMax),
     verboseMode(true),
     useESMWaterColors(true),
@@ -1499,15 +1994,17 @@ Renderer::Renderer(int imageWidth, int imageHeight,
     outBufRGBA = new std::uint32_t[imageDataSize];
   if (bufAllocFlags & 0x02)
     outBufZ = new float[imageDataSize];
+  imageObjectsFormIDs[0] = 0xFFFFFFFFU;
+  imageObjectsFormIDs[1] = 0xFFFFFFFFU;
   clear(bufAllocFlags);
-  renderThreads.reserve(16);
-  nifFiles.resize(modelBatchCnt);
+  renderThreads.reserve(64);
   setThreadCount(-1);
 }
 
 Renderer::~Renderer()
 {
-  clear(0x7C);
+  stopThreadPool();
+  clear(0xFC);
   deallocateBuffers(0x03);
 }
 
@@ -1536,7 +2033,7 @@ unsigned int Renderer::findParentWorld(ESMFile& esmFile, unsigned int formID)
 
 void Renderer::clear()
 {
-  clear(0x7C);
+  clear(0x01FC);
   baseObjects.clear();
 }
 
@@ -1565,8 +2062,10 @@ void Renderer::setViewTransform(
     float offsetX, float offsetY, float offsetZ)
 {
   NIFFile::NIFVertexTransform t(scale, rotationX, rotationY, rotationZ,
-                                offsetX, offsetY, offsetZ);
+                                offsetX - float(imageX0),
+                                offsetY - float(imageY0), offsetZ);
   viewTransform = t;
+  clear(0x0100);
 }
 
 void Renderer::setLightDirection(float rotationY, float rotationZ)
@@ -1578,6 +2077,17 @@ void Renderer::setLightDirection(float rotationY, float rotationZ)
   lightZ = t.rotateZZ;
 }
 
+void Renderer::setImageTile(int x0, int y0, int fullWidth, int fullHeight)
+{
+  viewTransform.offsX = viewTransform.offsX + float(imageX0 - x0);
+  viewTransform.offsY = viewTransform.offsY + float(imageY0 - y0);
+  imageX0 = x0;
+  imageY0 = y0;
+  fullImageWidth = fullWidth;
+  fullImageHeight = fullHeight;
+  updateEnvMapOffset();
+}
+
 void Renderer::setThreadCount(int n)
 {
   if (n <= 0)
@@ -1586,6 +2096,7 @@ void Renderer::setThreadCount(int n)
   n = (n > 1 ? (n < maxThreads ? n : maxThreads) : 1);
   if (n == threadCnt)
     return;
+  stopThreadPool();
   threadCnt = n;
   renderThreads.resize(size_t(n));
   for (size_t i = 0; i < renderThreads.size(); i++)
@@ -1664,11 +2175,10 @@ void Renderer::setRenderParameters(
   for (size_t i = 0; i < renderThreads.size(); i++)
   {
     renderThreads[i].renderer->setLighting(c, a, e, l[2]);
-    renderThreads[i].renderer->setEnvMapOffset(
-        float(width) * -0.5f, float(height) * -0.5f,
-        float(height) * reflZScale);
     renderThreads[i].renderer->setWaterUVScale(1.0f / float(waterUVScale));
   }
+  reflectionZScale = reflZScale;
+  updateEnvMapOffset();
 }
 
 static int calculateLandTxtMip(long fileSize)
@@ -1684,7 +2194,7 @@ void Renderer::loadTerrain(const char *btdFileName,
                            unsigned int worldID, unsigned int defTxtID,
                            int mipLevel, int xMin, int yMin, int xMax, int yMax)
 {
-  clear(0x44);
+  clear(0x0144);
   if (verboseMode)
     std::fprintf(stderr, "Loading terrain data\n");
   landData = new LandscapeData(&esmFile, btdFileName, &ba2File, 0x0B, worldID,
@@ -1697,6 +2207,17 @@ void Renderer::loadTerrain(const char *btdFileName,
     if (r && *r == "WATR")
       waterColor = Renderer_Base::getWaterColor(esmFile, *r, waterColor);
   }
+}
+
+void Renderer::loadLandTextures()
+{
+  // the textures are reloaded only if any texture has been removed from the
+  // texture cache since the last call
+  if (landTextures.size() == landData->getTextureCount() &&
+      landTexturesRemoved == textureCache.texturesRemoved)
+  {
+    return;
+  }
   if (verboseMode)
     std::fprintf(stderr, "Loading landscape textures\n");
   landTextures.resize(landData->getTextureCount(), (DDSTexture *) 0);
@@ -1728,17 +2249,26 @@ void Renderer::loadTerrain(const char *btdFileName,
                              mipLevelN);
     }
   }
+  landTexturesRemoved = textureCache.texturesRemoved;
 }
 
 void Renderer::renderTerrain(unsigned int worldID)
 {
+  if (landData)
+    loadLandTextures();
   if (verboseMode)
     std::fprintf(stderr, "Rendering terrain\n");
   if (!worldID)
     worldID = getDefaultWorldID();
   clear(0x38);
   renderPass = 1;
-  findObjects(worldID, 0);
+  if (imageObjectsFormIDs[0] != worldID)
+  {
+    findObjects(worldID, 0);
+    objectList.swap(imageObjects[0]);
+    imageObjectsFormIDs[0] = worldID;
+  }
+  filterObjectList(imageObjects[0]);
   sortObjectList();
   renderObjectList();
 }
@@ -1753,8 +2283,15 @@ void Renderer::renderObjects(unsigned int formID)
     waterColor = 0xC0302010U;           // default water color
   clear(0x38);
   renderPass = 2;
-  baseObjects.clear();
-  findObjects(formID, 1);
+  if (imageObjectsFormIDs[1] != formID)
+  {
+    imageObjects[1].clear();
+    baseObjects.clear();
+    findObjects(formID, 1);
+    objectList.swap(imageObjects[1]);
+    imageObjectsFormIDs[1] = formID;
+  }
+  filterObjectList(imageObjects[1]);
   sortObjectList();
   renderObjectList();
   if (verboseMode)
@@ -1779,7 +2316,13 @@ static const char *usageStrings[] =
   "    -a                  render all object types",
   "    -textures BOOL      make all diffuse textures white if false",
   "    -txtcache INT       texture cache size in megabytes",
+  "    -txtbc BOOL         keep BC1-BC5 textures compressed in memory",
+  "    -mcache INT         model cache size in megabytes",
+  "    -prefetch INT       number of model batches to load in advance",
   "    -ssaa BOOL          render at double resolution and downsample",
+  "    -zprepass BOOL      draw the depth of opaque objects before shading",
+  "    -tile INT           render the image in tiles of INT * INT pixels,",
+  "                        allows image sizes up to 65536 * 65536",
   "    -f INT              output format, 0: RGB24, 1: A8R8G8B8, 2: RGB10A2",
   "    -q                  do not print messages other than errors",
   "",
@@ -1828,10 +2371,15 @@ int main(int argc, char **argv)
     std::vector< const char * > args;
     int     threadCnt = -1;
     int     textureCacheSize = 1024;
+    bool    compressedTextures = false;
+    int     modelCacheSize = 256;
+    int     modelPrefetchCnt = 2;
     bool    verboseMode = true;
     bool    distantObjectsOnly = false;
     bool    noDisabledObjects = true;
     bool    enableDownscale = false;
+    bool    depthPrepass = false;
+    int     tileSize = 0;
     bool    enableSCOL = false;
     bool    enableAllObjects = false;
     bool    enableTextures = true;
@@ -1905,7 +2453,15 @@ int main(int argc, char **argv)
         std::printf("-scol %d\n", int(enableSCOL));
         std::printf("-textures %d\n", int(enableTextures));
         std::printf("-txtcache %d\n", textureCacheSize);
+        std::printf("-txtbc %d\n", int(compressedTextures));
+        std::printf("-mcache %d\n", modelCacheSize);
+        std::printf("-prefetch %d\n", modelPrefetchCnt);
         std::printf("-ssaa %d\n", int(enableDownscale));
+        std::printf("-zprepass %d\n", int(depthPrepass));
+        std::printf("-tile %d", tileSize);
+        if (!tileSize)
+          std::printf(" (disabled)");
+        std::printf("\n");
         std::printf("-f %d\n", outputFormat);
         std::printf("-w 0x%08X", formID);
         if (!formID)
@@ -1969,7 +2525,7 @@ int main(int argc, char **argv)
         if (++i >= argc)
           throw FO76UtilsError("missing argument for %s", argv[i - 1]);
         threadCnt = int(parseInteger(argv[i], 10, "invalid number of threads",
-                                     1, 16));
+                                     1, 64));
       }
       else if (std::strcmp(argv[i], "-debug") == 0)
       {
@@ -2005,6 +2561,30 @@ int main(int argc, char **argv)
             int(parseInteger(argv[i], 0, "invalid texture cache size",
                              256, 4095));
       }
+      else if (std::strcmp(argv[i], "-txtbc") == 0)
+      {
+        if (++i >= argc)
+          throw FO76UtilsError("missing argument for %s", argv[i - 1]);
+        compressedTextures =
+            bool(parseInteger(argv[i], 0, "invalid argument for -txtbc",
+                              0, 1));
+      }
+      else if (std::strcmp(argv[i], "-mcache") == 0)
+      {
+        if (++i >= argc)
+          throw FO76UtilsError("missing argument for %s", argv[i - 1]);
+        modelCacheSize =
+            int(parseInteger(argv[i], 0, "invalid model cache size",
+                             16, 4095));
+      }
+      else if (std::strcmp(argv[i], "-prefetch") == 0)
+      {
+        if (++i >= argc)
+          throw FO76UtilsError("missing argument for %s", argv[i - 1]);
+        modelPrefetchCnt =
+            int(parseInteger(argv[i], 10, "invalid model prefetch count",
+                             0, 16));
+      }
       else if (std::strcmp(argv[i], "-ssaa") == 0)
       {
         if (++i >= argc)
@@ -2012,6 +2592,23 @@ int main(int argc, char **argv)
         enableDownscale =
             bool(parseInteger(argv[i], 0, "invalid argument for -ssaa", 0, 1));
       }
+      else if (std::strcmp(argv[i], "-zprepass") == 0)
+      {
+        if (++i >= argc)
+          throw FO76UtilsError("missing argument for %s", argv[i - 1]);
+        depthPrepass =
+            bool(parseInteger(argv[i], 0, "invalid argument for -zprepass",
+                              0, 1));
+      }
+      else if (std::strcmp(argv[i], "-tile") == 0)
+      {
+        if (++i >= argc)
+          throw FO76UtilsError("missing argument for %s", argv[i - 1]);
+        tileSize = int(parseInteger(argv[i], 0, "invalid tile size",
+                                    0, 16384));
+        if (tileSize > 0 && tileSize < 64)
+          errorMessage("invalid tile size");
+      }
       else if (std::strcmp(argv[i], "-f") == 0)
       {
         if (++i >= argc)
@@ -2289,10 +2886,11 @@ int main(int argc, char **argv)
         waterColor + (waterColor & 0x7F000000U) + ((waterColor >> 30) << 24);
     if (!(waterColor & 0xFF000000U))
       waterColor = 0U;
-    int     width =
-        int(parseInteger(args[2], 0, "invalid image width", 2, 32768));
-    int     height =
-        int(parseInteger(args[3], 0, "invalid image height", 2, 32768));
+    int     maxImageSize = (!tileSize ? 32768 : 65536);
+    int     width = int(parseInteger(args[2], 0, "invalid image width",
+                                     2, maxImageSize));
+    int     height = int(parseInteger(args[3], 0, "invalid image height",
+                                      2, maxImageSize));
     viewOffsX = viewOffsX + (float(width) * 0.5f);
     viewOffsY = viewOffsY + (float(height - 2) * 0.5f);
     viewOffsZ = viewOffsZ - float(zMin);
@@ -2315,17 +2913,33 @@ int main(int argc, char **argv)
     if (worldID == 0xFFFFFFFFU)
       errorMessage("form ID not found in ESM, or invalid record type");
 
-    Renderer  renderer(width, height, ba2File, esmFile,
+    // in tiled mode, the buffers of the renderer are only allocated for one
+    // tile, plus a border for the downsampling filter
+    int     tileWidth = width;
+    int     tileHeight = height;
+    int     tileBorder = 0;
+    if (tileSize > 0)
+    {
+      tileWidth = std::min(tileSize << int(enableDownscale), width);
+      tileHeight = std::min(tileSize << int(enableDownscale), height);
+      tileBorder = (enableDownscale ? 8 : 0);
+    }
+    Renderer  renderer(tileWidth + (tileBorder * 2),
+                       tileHeight + (tileBorder * 2), ba2File, esmFile,
                        (std::uint32_t *) 0, (float *) 0, zMax);
     if (threadCnt > 0)
       renderer.setThreadCount(threadCnt);
     renderer.setTextureCacheSize(size_t(textureCacheSize) << 20);
+    renderer.setTextureCompression(compressedTextures);
+    renderer.setModelCacheSize(size_t(modelCacheSize) << 20);
+    renderer.setModelPrefetchCount(modelPrefetchCnt);
     renderer.setVerboseMode(verboseMode);
     renderer.setDistantObjectsOnly(distantObjectsOnly);
     renderer.setNoDisabledObjects(noDisabledObjects);
     renderer.setEnableSCOL(enableSCOL);
     renderer.setEnableAllObjects(enableAllObjects);
     renderer.setEnableTextures(enableTextures);
+    renderer.setDepthPrepass(depthPrepass);
     renderer.setDebugMode(debugMode);
     renderer.setLandDefaultColor(ltxtDefColor);
     renderer.setLandTxtResolution(ltxtResolution);
@@ -2358,14 +2972,84 @@ int main(int argc, char **argv)
         renderer.addExcludeModelPattern(std::string(excludeModelPatterns[i]));
     }
 
-    if (worldID)
+    int     pixelFormat = DDSInputFile::pixelFormatRGB24;
+    if (outputFormat == 1)
+      pixelFormat = DDSInputFile::pixelFormatRGBA32;
+    else if (outputFormat == 2)
+      pixelFormat = DDSInputFile::pixelFormatA2R10G10B10;
+    unsigned char downsampleFlags =
+        (unsigned char) ((outputFormat & 2) | USE_PIXELFMT_RGB10A2);
+    if (!tileSize)
     {
-      renderer.loadTerrain(btdPath, worldID, defTxtID,
-                           btdLOD, terrainX0, terrainY0, terrainX1, terrainY1);
-      renderer.renderTerrain(worldID);
-      renderer.clear();
+      if (worldID)
+      {
+        renderer.loadTerrain(btdPath, worldID, defTxtID, btdLOD,
+                             terrainX0, terrainY0, terrainX1, terrainY1);
+        renderer.renderTerrain(worldID);
+        renderer.clear();
+      }
+      renderer.renderObjects(formID);
+    }
+    else
+    {
+      // render the image in tiles, and write each row of tiles to the
+      // output file as soon as it is finished
+      int     s = int(enableDownscale);
+      DDSOutputFile outFile(args[1], width >> s, height >> s, pixelFormat);
+      std::vector< std::uint32_t >  rowBuf(size_t(width >> s)
+                                           * size_t(tileHeight >> s));
+      std::vector< std::uint32_t >  downsampleBuf;
+      if (enableDownscale)
+      {
+        downsampleBuf.resize(size_t(renderer.getWidth() >> 1)
+                             * size_t(renderer.getHeight() >> 1));
+      }
+      if (worldID)
+      {
+        renderer.loadTerrain(btdPath, worldID, defTxtID, btdLOD,
+                             terrainX0, terrainY0, terrainX1, terrainY1);
+      }
+      for (int y0 = 0; y0 < height; y0 = y0 + tileHeight)
+      {
+        int     h = std::min(tileHeight, height - y0) >> s;
+        for (int x0 = 0; x0 < width; x0 = x0 + tileWidth)
+        {
+          if (verboseMode)
+          {
+            std::fprintf(stderr, "Tile %d, %d (%d * %d pixels)\n",
+                         x0 >> s, y0 >> s, tileWidth >> s, tileHeight >> s);
+          }
+          renderer.setImageTile(x0 - tileBorder, y0 - tileBorder,
+                                width, height);
+          renderer.clearImage();
+          if (worldID)
+            renderer.renderTerrain(worldID);
+          renderer.renderObjects(formID);
+          const std::uint32_t *imageDataPtr = renderer.getImageData();
+          int     pitch = renderer.getWidth();
+          if (enableDownscale)
+          {
+            downsample2xFilter(&(downsampleBuf.front()), imageDataPtr,
+                               renderer.getWidth(), renderer.getHeight(),
+                               renderer.getWidth() >> 1, downsampleFlags);
+            imageDataPtr = &(downsampleBuf.front());
+            pitch = pitch >> 1;
+          }
+          int     w = std::min(tileWidth, width - x0) >> s;
+          int     b = tileBorder >> s;
+          for (int y = 0; y < h; y++)
+          {
+            std::memcpy(&(rowBuf.front()) + (size_t(y) * size_t(width >> s)
+                                             + size_t(x0 >> s)),
+                        imageDataPtr + (size_t(y + b) * size_t(pitch)
+                                        + size_t(b)),
+                        sizeof(std::uint32_t) * size_t(w));
+          }
+        }
+        outFile.writeImageData(&(rowBuf.front()),
+                               size_t(width >> s) * size_t(h), pixelFormat);
+      }
     }
-    renderer.renderObjects(formID);
     if (verboseMode)
     {
       const NIFFile::NIFBounds& b = renderer.getBounds();
@@ -2378,30 +3062,27 @@ int main(int argc, char **argv)
                      b.xMax() * scale, b.yMax() * scale, b.zMax() * scale);
       }
     }
-    renderer.clear();
-    renderer.deallocateBuffers(0x02);
-
-    width = width >> int(enableDownscale);
-    height = height >> int(enableDownscale);
-    const std::uint32_t *imageDataPtr = renderer.getImageData();
-    size_t  imageDataSize = size_t(width) * size_t(height);
-    std::vector< std::uint32_t >  downsampleBuf;
-    if (enableDownscale)
+    if (!tileSize)
     {
-      downsampleBuf.resize(imageDataSize);
-      downsample2xFilter(
-          &(downsampleBuf.front()), imageDataPtr, width << 1, height << 1,
-          width, (unsigned char) ((outputFormat & 2) | USE_PIXELFMT_RGB10A2));
-      imageDataPtr = &(downsampleBuf.front());
+      renderer.clear();
+      renderer.deallocateBuffers(0x02);
+
+      width = width >> int(enableDownscale);
+      height = height >> int(enableDownscale);
+      const std::uint32_t *imageDataPtr = renderer.getImageData();
+      size_t  imageDataSize = size_t(width) * size_t(height);
+      std::vector< std::uint32_t >  downsampleBuf;
+      if (enableDownscale)
+      {
+        downsampleBuf.resize(imageDataSize);
+        downsample2xFilter(
+            &(downsampleBuf.front()), imageDataPtr, width << 1, height << 1,
+            width, downsampleFlags);
+        imageDataPtr = &(downsampleBuf.front());
+      }
+      DDSOutputFile outFile(args[1], width, height, pixelFormat);
+      outFile.writeImageData(imageDataPtr, imageDataSize, pixelFormat);
     }
-    if (!outputFormat)
-      outputFormat = DDSInputFile::pixelFormatRGB24;
-    else if (outputFormat == 1)
-      outputFormat = DDSInputFile::pixelFormatRGBA32;
-    else
-      outputFormat = DDSInputFile::pixelFormatA2R10G10B10;
-    DDSOutputFile outFile(args[1], width, height, outputFormat);
-    outFile.writeImageData(imageDataPtr, imageDataSize, outputFormat);
     err = 0;
   }
   catch (std::exception& e)
@@ -17,17 +17,21 @@
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 
 class Renderer : protected Renderer_Base
 {
  protected:
-  // maximum number of NIF files to keep loaded (must be power of two and <= 64)
-  static const unsigned int modelBatchCnt = 16U;
+  // maximum number of NIF files in a batch of models that are loaded and
+  // rendered together, the number of models is also limited by the size of
+  // the model cache
+  static const unsigned int modelBatchMaxCnt = 64U;
   struct BaseObject
   {
     unsigned short  type;               // first 2 characters, or 0 if excluded
     unsigned short  flags;              // same as RenderObject flags
     unsigned int  modelID;
+    unsigned int  modelBatch;
     unsigned int  mswpFormID;
     signed short  obndX0;
     signed short  obndY0;
@@ -53,6 +57,11 @@ class Renderer : protected Renderer_Base
     // 1344:        8*8 tiles
     signed short  tileIndex;
     int     z;                  // Z coordinate for sorting / debugMode 1 formID
+    // area used on the full image in pixels, including a margin of 2 pixels
+    int     screenX0;
+    int     screenY0;
+    int     screenX1;
+    int     screenY1;
     union
     {
       const BaseObject  *o;     // valid if flags & 2 is set
@@ -72,38 +81,61 @@ class Renderer : protected Renderer_Base
     NIFFile::NIFVertexTransform modelTransform;
     bool operator<(const RenderObject& r) const;
   };
+  // objects found by a single findObjects() task
+  struct FoundObjects
+  {
+    std::vector< RenderObject > objectList;
+    // bounds of all objects in screen space, including those not visible
+    NIFFile::NIFBounds  worldBounds;
+  };
   struct ModelData
   {
-    NIFFile *nifFile;
+    ModelCache::CachedModel *model;     // NULL if not loaded
     size_t  totalTriangleCnt;
-    std::vector< NIFFile::NIFTriShape > meshData;
     const BaseObject  *o;
-    std::thread *loadThread;
-    std::string threadErrMsg;
-    std::vector< unsigned char >  fileBuf;
+    // bounds of the visible meshes of all render passes in model space
+    NIFFile::NIFBounds  modelBounds;
     ModelData();
-    ~ModelData();
-    void clear();
+    void clear(ModelCache& modelCache);
   };
   struct RenderThread
   {
+    // worker thread of the pool, NULL for the main thread (0)
     std::thread *t;
     std::string errMsg;
     TerrainMesh *terrainMesh;
     Plot3D_TriShape *renderer;
     // objects not rendered due to incorrect bounds
     std::vector< unsigned int > objectsRemaining;
+    // areas of outBufZ written by the thread as x0, y0, x1, y1 in blocks
+    std::vector< int >  zBlocksUpdated;
     std::vector< unsigned char >  fileBuf;
     std::vector< Renderer_Base::TriShapeSortObject >  sortBuf;
     RenderThread();
     ~RenderThread();
-    void join();
     void clear();
   };
+  struct ThreadPoolTask
+  {
+    // 0: load model N, 1: render objects in the tile areas of tileIndexMask
+    // 2, 3: find terrain (2) or objects (3) in the record modelID, and store
+    // them in foundObjects[startPos]
+    // model loading tasks are run in the background, with lower priority
+    unsigned int  taskType;
+    unsigned int  modelID;
+    size_t  startPos;
+    size_t  endPos;
+    unsigned long long  tileIndexMask;
+  };
   std::uint32_t *outBufRGBA;
   float   *outBufZ;
   int     width;
   int     height;
+  // position and size of the full image if it is rendered in tiles
+  int     imageX0;
+  int     imageY0;
+  int     fullImageWidth;
+  int     fullImageHeight;
   const BA2File&  ba2File;
   ESMFile&  esmFile;
   NIFFile::NIFVertexTransform viewTransform;
@@ -123,25 +155,66 @@ class Renderer : protected Renderer_Base
   bool    enableSCOL;
   bool    enableAllObjects;
   bool    enableTextures;
+  bool    depthPrepass;
   unsigned char renderMode;
   unsigned char debugMode;
   // 1: terrain, 2: objects, 4: objects with alpha blending
   unsigned char renderPass;
   int     threadCnt;
   TextureCache  textureCache;
+  // parsed models are kept loaded between batches and render passes
+  ModelCache  modelCache;
   std::vector< const DDSTexture * > landTextures;
   std::vector< const DDSTexture * > landTexturesN;
   std::vector< RenderObject > objectList;
+  // objects found in the full image by renderTerrain() (0) and
+  // renderObjects() (1), objectList is filtered from these for each tile
+  std::vector< RenderObject > imageObjects[2];
+  // form ID searched for imageObjects, 0xFFFFFFFF if not valid
+  unsigned int  imageObjectsFormIDs[2];
+  // value of textureCache.texturesRemoved when landTextures were loaded
+  size_t  landTexturesRemoved;
   std::vector< std::string >  excludeModelPatterns;
   std::vector< std::string >  hdModelNamePatterns;
   std::string defaultEnvMap;
   std::string defaultWaterTexture;
   std::vector< ModelData >    nifFiles;
+  // maximum of outBufZ in each block of zBlockSize * zBlockSize pixels,
+  // updated between groups of objects, and may be greater than the actual
+  // value while rendering
+  static const int  zBlockSize = 16;
+  std::vector< float >  zBlockMax;
+  int     zBlocksX;
+  int     zBlocksY;
   MaterialSwaps materialSwaps;
+  // baseObjects and materialSwaps are locked while searching for objects
+  // on multiple threads
+  std::mutex  baseObjectsMutex;
+  std::mutex  materialSwapsMutex;
+  std::vector< FoundObjects > foundObjects;
   std::vector< RenderThread > renderThreads;
-  std::string stringBuf;
+  // tasks are taken from the queue in order by the worker threads and the
+  // main thread, the queue is sorted by decreasing estimated cost
+  std::vector< ThreadPoolTask > taskQueue;
+  size_t  taskQueuePos;
+  size_t  tasksRunning;
+  bool    threadPoolStopFlag;
+  std::mutex  threadPoolMutex;
+  std::condition_variable threadPoolCond;       // new tasks or stop request
+  std::condition_variable tasksDoneCond;
+  std::vector< ThreadPoolTask > backgroundTasks;
+  size_t  backgroundTaskPos;
+  size_t  backgroundTasksRunning;
+  std::string backgroundErrMsg;
+  // first model ID of each batch, and the end of the last batch
+  std::vector< unsigned int > modelBatches;
+  // number of models not loaded yet in each batch that has been queued
+  std::vector< unsigned int > modelBatchLoadsPending;
+  // number of model batches to load in advance while rendering
+  int     modelPrefetchCnt;
   std::uint32_t waterColor;
   float   waterReflectionLevel;
+  float   reflectionZScale;
   int     zRangeMax;
   bool    verboseMode;
   bool    useESMWaterColors;
@@ -154,10 +227,14 @@ class Renderer : protected Renderer_Base
   // in the top left corner
   unsigned long long calculateTileMask(int x0, int y0, int x1, int y1) const;
   static signed short calculateTileIndex(unsigned long long screenAreasUsed);
-  int setScreenAreaUsed(RenderObject& p);
+  // calculate the area of p on the full image, and add its screen space
+  // bounds to bounds, returns false if the object is not visible
+  bool calculateScreenArea(RenderObject& p, NIFFile::NIFBounds& bounds);
   unsigned int getDefaultWorldID() const;
-  void addTerrainCell(const ESMFile::ESMRecord& r);
-  void addWaterCell(const ESMFile::ESMRecord& r);
+  void updateEnvMapOffset();
+  void loadLandTextures();
+  void addTerrainCell(FoundObjects& objects, const ESMFile::ESMRecord& r);
+  void addWaterCell(FoundObjects& objects, const ESMFile::ESMRecord& r);
   inline void getWaterColor(RenderObject& p, const ESMFile::ESMRecord& r)
   {
     if (!useESMWaterColors)
@@ -168,35 +245,71 @@ class Renderer : protected Renderer_Base
   // returns NULL on excluded model or invalid object
   const BaseObject *readModelProperties(RenderObject& p,
                                         const ESMFile::ESMRecord& r);
-  void addSCOLObjects(const ESMFile::ESMRecord& r,      // SCOL
+  // materialSwaps.loadMaterialSwap() with materialSwapsMutex locked
+  unsigned int loadMaterialSwap(unsigned int formID);
+  void addSCOLObjects(FoundObjects& objects,
+                      const ESMFile::ESMRecord& r,      // SCOL
                       float scale, float rX, float rY, float rZ,
                       float offsX, float offsY, float offsZ,
                       unsigned int refrMSWPFormID);
   // type = 0: terrain, type = 1: objects
-  void findObjects(unsigned int formID, int type, bool isRecursive);
+  // if isRecursive is false, only formID is searched, or its contents if it
+  // is a group
+  void findObjects(FoundObjects& objects,
+                   unsigned int formID, int type, bool isRecursive);
+  // add a task for each cell group in the list of records starting at
+  // formID, world children and exterior cell blocks are split further
+  void addFindObjectsTasks(std::vector< ThreadPoolTask >& tasks,
+                           unsigned int formID, int type);
   void findObjects(unsigned int formID, int type);
+  // copy the objects that overlap with the current tile to objectList,
+  // and calculate their tile indices
+  void filterObjectList(const std::vector< RenderObject >& objects);
   void sortObjectList();
   // 0x0001: clear image data
   // 0x0002: clear Z buffer
   // 0x0004: clear landscape data
   // 0x0008: clear object list and model paths
   // 0x0010: clear threads
-  // 0x0020: clear model cache
+  // 0x0020: release loaded models
   // 0x0040: clear texture cache
+  // 0x0080: clear model cache
+  // 0x0100: clear the objects found in the full image
   void clear(unsigned int flags);
   bool isExcludedModel(const std::string& modelPath) const;
   bool isHighQualityModel(const std::string& modelPath) const;
-  void loadModels(unsigned int t, unsigned long long modelIDMask);
-  static void loadModelsThread(Renderer *p,
-                               unsigned int t, unsigned long long modelIDMask);
+  void loadModel(size_t threadNum, unsigned int n);
+  // load the textures used by a model before it is rendered
+  void prefetchModelTextures(size_t threadNum, unsigned int n);
   void renderObjectList();
   bool renderObject(RenderThread& t, size_t i,
                     unsigned long long tileMask = ~0ULL);
+  // returns false if the bounds of the meshes of a model are hidden behind
+  // already drawn geometry according to zBlockMax
+  bool isObjectVisible(const RenderObject& p,
+                       const NIFFile::NIFVertexTransform& vt) const;
+  // recalculate zBlockMax for the blocks in the specified area, or for the
+  // whole image if x1 < x0
+  void updateZBlockMax(int x0 = 0, int y0 = 0, int x1 = -1, int y1 = -1);
   void renderThread(size_t threadNum, size_t startPos, size_t endPos,
                     unsigned long long tileIndexMask);
-  static void threadFunction(Renderer *p, size_t threadNum,
-                             size_t startPos, size_t endPos,
-                             unsigned long long tileIndexMask);
+  void runTask(size_t threadNum, const ThreadPoolTask& task);
+  static void threadFunction(Renderer *p, size_t threadNum);
+  // run all tasks using the thread pool, and wait until they are finished,
+  // the worker threads are started on first use, tasks is cleared on return
+  void runTaskQueue(std::vector< ThreadPoolTask >& tasks);
+  void startThreadPool();
+  void stopThreadPool();
+  // runs the next background task, poolLock must be locked on entry
+  void runBackgroundTask(std::unique_lock< std::mutex >& poolLock,
+                         size_t threadNum);
+  // start loading the models of batch n in the background
+  void queueModelBatch(unsigned int n);
+  // wait until all models of batch n are loaded, the main thread also loads
+  // models while waiting
+  void waitForModelBatch(unsigned int n);
+  // stop any model loading that is still in progress
+  void cancelBackgroundTasks();
  public:
   Renderer(int imageWidth, int imageHeight,
            const BA2File& archiveFiles, ESMFile& masterFiles,
@@ -228,12 +341,32 @@ class Renderer : protected Renderer_Base
                         float rotationX, float rotationY, float rotationZ,
                         float offsetX, float offsetY, float offsetZ);
   void setLightDirection(float rotationY, float rotationZ);
-  // default to std::thread::hardware_concurrency() if n <= 0
+  // Render a tile of a larger image of fullWidth * fullHeight pixels, with
+  // the top left corner of the tile at x0, y0. The view transform is
+  // relative to the full image. The objects are only searched when rendering
+  // the first tile, until clear(), setViewTransform() or loadTerrain() is
+  // called.
+  void setImageTile(int x0, int y0, int fullWidth, int fullHeight);
+  // default to std::thread::hardware_concurrency() if n <= 0, the maximum
+  // is 64
   void setThreadCount(int n);
   void setTextureCacheSize(size_t n)
   {
     textureCache.textureCacheSize = n;
   }
+  // keep BC1 to BC5 textures in compressed format, and decode on demand
+  void setTextureCompression(bool n)
+  {
+    textureCache.blockCompressed = n;
+  }
+  void setModelCacheSize(size_t n)
+  {
+    modelCache.modelCacheSize = n;      // approximate size in bytes
+  }
+  void setModelPrefetchCount(int n)
+  {
+    modelPrefetchCnt = n;       // number of model batches to load in advance
+  }
   void setTextureMipLevel(int n)
   {
     textureMip = n;             // base mip level for all textures
@@ -278,6 +411,10 @@ class Renderer : protected Renderer_Base
   {
     enableTextures = n;         // if false, make all diffuse textures white
   }
+  void setDepthPrepass(bool n)
+  {
+    depthPrepass = n;           // draw the depth of opaque objects first
+  }
   void setDebugMode(unsigned char n)
   {
     // n = 0: default mode (disable debug)
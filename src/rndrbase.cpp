@@ -7,8 +7,16 @@ size_t Renderer_Base::TextureCache::getTextureDataSize(const DDSTexture *t)
 {
   if (!t)
     return 0;
-  size_t  n = size_t(t->getWidth()) * size_t(t->getHeight());
-  return (size_t((n * 1431655765ULL) >> 30) * sizeof(std::uint32_t) + 1024U);
+  return (t->getDataSize() + 1024U);
+}
+
+size_t Renderer_Base::TextureCache::getShardIndex(const std::string& fileName)
+{
+  // FNV-1a hash
+  std::uint32_t h = 0x811C9DC5U;
+  for (size_t i = 0; i < fileName.length(); i++)
+    h = (h ^ (unsigned char) fileName[i]) * 0x01000193U;
+  return (size_t(h ^ (h >> 16)) & (textureCacheShardCnt - 1));
 }
 
 Renderer_Base::TextureCache::~TextureCache()
@@ -22,10 +30,11 @@ const DDSTexture * Renderer_Base::TextureCache::loadTexture(
 {
   if (fileName.empty())
     return (DDSTexture *) 0;
-  textureCacheMutex.lock();
+  TextureCacheShard&  cacheShard = textureCacheShards[getShardIndex(fileName)];
+  cacheShard.textureCacheMutex.lock();
   std::map< std::string, CachedTexture >::iterator  i =
-      textureCache.find(fileName);
-  if (i != textureCache.end())
+      cacheShard.textureCache.find(fileName);
+  if (i != cacheShard.textureCache.end())
   {
     CachedTexture *cachedTexture = &(i->second);
     if (cachedTexture->nxt)
@@ -33,20 +42,37 @@ const DDSTexture * Renderer_Base::TextureCache::loadTexture(
       if (cachedTexture->prv)
         cachedTexture->prv->nxt = cachedTexture->nxt;
       else
-        firstTexture = cachedTexture->nxt;
+        cacheShard.firstTexture = cachedTexture->nxt;
       cachedTexture->nxt->prv = cachedTexture->prv;
-      lastTexture->nxt = cachedTexture;
-      cachedTexture->prv = lastTexture;
+      cacheShard.lastTexture->nxt = cachedTexture;
+      cachedTexture->prv = cacheShard.lastTexture;
       cachedTexture->nxt = (CachedTexture *) 0;
-      lastTexture = cachedTexture;
+      cacheShard.lastTexture = cachedTexture;
+    }
+    const DDSTexture  *t = (DDSTexture *) 0;
+    if (cachedTexture->textureLoadMutex->try_lock())
+    {
+      t = cachedTexture->texture;
+      cachedTexture->textureLoadMutex->unlock();
+      cacheShard.textureCacheMutex.unlock();
+      return t;
     }
-    textureCacheMutex.unlock();
-    if (!waitFlag)
-      cachedTexture->textureLoadMutex->lock();
-    else if ((*waitFlag = !cachedTexture->textureLoadMutex->try_lock()) == true)
-      return (DDSTexture *) 0;
-    const DDSTexture  *t = cachedTexture->texture;
+    if (waitFlag)
+    {
+      cacheShard.textureCacheMutex.unlock();
+      *waitFlag = true;
+      return t;
+    }
+    // the texture is being loaded by another thread, prevent it from being
+    // removed by shrinkTextureCache() while waiting
+    cachedTexture->waitCnt++;
+    cacheShard.textureCacheMutex.unlock();
+    cachedTexture->textureLoadMutex->lock();
+    t = cachedTexture->texture;
     cachedTexture->textureLoadMutex->unlock();
+    cacheShard.textureCacheMutex.lock();
+    cachedTexture->waitCnt--;
+    cacheShard.textureCacheMutex.unlock();
     return t;
   }
 
@@ -57,42 +83,47 @@ const DDSTexture * Renderer_Base::TextureCache::loadTexture(
     {
       CachedTexture tmp;
       tmp.texture = (DDSTexture *) 0;
-      tmp.i = textureCache.end();
+      tmp.i = cacheShard.textureCache.end();
       tmp.prv = (CachedTexture *) 0;
       tmp.nxt = (CachedTexture *) 0;
       tmp.textureLoadMutex = textureLoadMutex;
-      i = textureCache.insert(std::pair< std::string, CachedTexture >(
-                                  fileName, tmp)).first;
+      tmp.waitCnt = 0;
+      i = cacheShard.textureCache.insert(
+              std::pair< std::string, CachedTexture >(fileName, tmp)).first;
     }
     textureLoadMutex = (std::mutex *) 0;
     cachedTexture = &(i->second);
     cachedTexture->i = i;
-    if (lastTexture)
-      lastTexture->nxt = cachedTexture;
+    if (cacheShard.lastTexture)
+      cacheShard.lastTexture->nxt = cachedTexture;
     else
-      firstTexture = cachedTexture;
-    cachedTexture->prv = lastTexture;
+      cacheShard.firstTexture = cachedTexture;
+    cachedTexture->prv = cacheShard.lastTexture;
     cachedTexture->nxt = (CachedTexture *) 0;
-    lastTexture = cachedTexture;
+    cacheShard.lastTexture = cachedTexture;
   }
   catch (...)
   {
-    textureCacheMutex.unlock();
+    cacheShard.textureCacheMutex.unlock();
     delete textureLoadMutex;
     throw;
   }
 
   DDSTexture  *t = (DDSTexture *) 0;
   cachedTexture->textureLoadMutex->lock();
-  textureCacheMutex.unlock();
+  cacheShard.textureCacheMutex.unlock();
   try
   {
-    mipLevel = ba2File.extractTexture(fileBuf, fileName, mipLevel);
-    t = new DDSTexture(&(fileBuf.front()), fileBuf.size(), mipLevel);
+    const unsigned char *fileData = (unsigned char *) 0;
+    size_t  fileSize = 0;
+    mipLevel = ba2File.extractTexture(fileData, fileSize, fileBuf, fileName,
+                                      mipLevel);
+    t = new DDSTexture(fileData, fileSize, mipLevel, blockCompressed);
     cachedTexture->texture = t;
-    textureCacheMutex.lock();
-    textureDataSize = textureDataSize + getTextureDataSize(t);
-    textureCacheMutex.unlock();
+    cacheShard.textureCacheMutex.lock();
+    cacheShard.textureDataSize =
+        cacheShard.textureDataSize + getTextureDataSize(t);
+    cacheShard.textureCacheMutex.unlock();
   }
   catch (FO76UtilsError&)
   {
@@ -108,37 +139,237 @@ const DDSTexture * Renderer_Base::TextureCache::loadTexture(
 
 void Renderer_Base::TextureCache::shrinkTextureCache()
 {
-  while (textureDataSize > textureCacheSize && firstTexture)
+  size_t  shardDataSizes[textureCacheShardCnt];
+  size_t  totalDataSize = 0;
+  for (size_t n = 0; n < textureCacheShardCnt; n++)
   {
-    size_t  dataSize = getTextureDataSize(firstTexture->texture);
-    if (firstTexture->texture)
-      delete firstTexture->texture;
-    delete firstTexture->textureLoadMutex;
-    std::map< std::string, CachedTexture >::iterator  i = firstTexture->i;
-    if (firstTexture->nxt)
-      firstTexture->nxt->prv = (CachedTexture *) 0;
-    else
-      lastTexture = (CachedTexture *) 0;
-    firstTexture = firstTexture->nxt;
-    textureCache.erase(i);
-    textureDataSize = textureDataSize - dataSize;
+    TextureCacheShard&  cacheShard = textureCacheShards[n];
+    cacheShard.textureCacheMutex.lock();
+    shardDataSizes[n] = cacheShard.textureDataSize;
+    cacheShard.textureCacheMutex.unlock();
+    totalDataSize = totalDataSize + shardDataSizes[n];
+  }
+  if (totalDataSize <= textureCacheSize)
+    return;
+  // the shards are locked and shrunk one at a time, each to a share of the
+  // cache size proportional to its current size, the textures are deleted
+  // after unlocking the shard
+  double  sizeScale = double(textureCacheSize) / double(totalDataSize);
+  std::vector< DDSTexture * > deletedTextures;
+  std::vector< std::mutex * > deletedMutexes;
+  for (size_t n = 0; n < textureCacheShardCnt; n++)
+  {
+    TextureCacheShard&  cacheShard = textureCacheShards[n];
+    size_t  sizeLimit = size_t(double(shardDataSizes[n]) * sizeScale);
+    cacheShard.textureCacheMutex.lock();
+    try
+    {
+      // each shard is in least recently used first order
+      CachedTexture *p = cacheShard.firstTexture;
+      while (p && cacheShard.textureDataSize > sizeLimit)
+      {
+        CachedTexture *nxt = p->nxt;
+        // textures that are still being loaded are not removed
+        if (p->waitCnt || !p->textureLoadMutex->try_lock())
+        {
+          p = nxt;
+          continue;
+        }
+        p->textureLoadMutex->unlock();
+        size_t  dataSize = getTextureDataSize(p->texture);
+        deletedTextures.push_back(p->texture);
+        deletedMutexes.push_back(p->textureLoadMutex);
+        if (p->prv)
+          p->prv->nxt = nxt;
+        else
+          cacheShard.firstTexture = nxt;
+        if (nxt)
+          nxt->prv = p->prv;
+        else
+          cacheShard.lastTexture = p->prv;
+        cacheShard.textureCache.erase(p->i);
+        cacheShard.textureDataSize = cacheShard.textureDataSize - dataSize;
+        if (!cacheShard.firstTexture)
+          cacheShard.textureDataSize = 0;
+        texturesRemoved++;
+        p = nxt;
+      }
+    }
+    catch (...)
+    {
+      cacheShard.textureCacheMutex.unlock();
+      throw;
+    }
+    cacheShard.textureCacheMutex.unlock();
+    for (size_t i = 0; i < deletedTextures.size(); i++)
+    {
+      if (deletedTextures[i])
+        delete deletedTextures[i];
+      delete deletedMutexes[i];
+    }
+    deletedTextures.clear();
+    deletedMutexes.clear();
   }
-  if (!firstTexture)
-    textureDataSize = 0;
 }
 
 void Renderer_Base::TextureCache::clear()
 {
-  for (CachedTexture *p = firstTexture; p; p = p->nxt)
+  for (size_t n = 0; n < textureCacheShardCnt; n++)
+  {
+    TextureCacheShard&  cacheShard = textureCacheShards[n];
+    for (CachedTexture *p = cacheShard.firstTexture; p; p = p->nxt)
+    {
+      if (p->texture)
+        delete p->texture;
+      delete p->textureLoadMutex;
+      texturesRemoved++;
+    }
+    cacheShard.textureDataSize = 0;
+    cacheShard.firstTexture = (CachedTexture *) 0;
+    cacheShard.lastTexture = (CachedTexture *) 0;
+    cacheShard.textureCache.clear();
+  }
+}
+
+Renderer_Base::ModelCache::~ModelCache()
+{
+  clear();
+}
+
+void Renderer_Base::ModelCache::unlinkModel(CachedModel *m)
+{
+  if (m->prv)
+    m->prv->nxt = m->nxt;
+  else
+    firstModel = m->nxt;
+  if (m->nxt)
+    m->nxt->prv = m->prv;
+  else
+    lastModel = m->prv;
+  m->prv = (CachedModel *) 0;
+  m->nxt = (CachedModel *) 0;
+}
+
+void Renderer_Base::ModelCache::linkModel(CachedModel *m)
+{
+  m->prv = lastModel;
+  m->nxt = (CachedModel *) 0;
+  if (lastModel)
+    lastModel->nxt = m;
+  else
+    firstModel = m;
+  lastModel = m;
+}
+
+Renderer_Base::ModelCache::CachedModel *
+    Renderer_Base::ModelCache::loadModel(
+        const BA2File& ba2File, const std::string& fileName,
+        std::vector< unsigned char >& fileBuf,
+        unsigned int switchActive, bool noRootNodeTransform)
+{
+  std::pair< std::string, unsigned int >  k(
+      fileName, switchActive | (!noRootNodeTransform ? 0U : 0x80000000U));
+  std::unique_lock< std::mutex >  cacheLock(modelCacheMutex);
+  std::map< std::pair< std::string, unsigned int >,
+            CachedModel >::iterator i;
+  while ((i = modelCache.find(k)) != modelCache.end())
+  {
+    CachedModel *m = &(i->second);
+    if (!m->isLoading)
+    {
+      m->refCnt++;
+      unlinkModel(m);
+      linkModel(m);
+      return m;
+    }
+    // the model is being loaded by another thread, which removes it from the
+    // cache on failure
+    modelLoadCond.wait(cacheLock);
+  }
+  {
+    CachedModel tmp;
+    tmp.nifFile = (NIFFile *) 0;
+    tmp.dataSize = 0;
+    tmp.refCnt = 1U;
+    tmp.isLoading = true;
+    tmp.i = modelCache.end();
+    tmp.prv = (CachedModel *) 0;
+    tmp.nxt = (CachedModel *) 0;
+    i = modelCache.insert(std::pair< std::pair< std::string, unsigned int >,
+                                     CachedModel >(k, tmp)).first;
+  }
+  CachedModel *m = &(i->second);
+  m->i = i;
+  linkModel(m);
+  cacheLock.unlock();
+  try
+  {
+    const unsigned char *fileData = (unsigned char *) 0;
+    size_t  fileSize = ba2File.extractFile(fileData, fileBuf, fileName);
+    m->nifFile = new NIFFile(fileData, fileSize, &ba2File);
+    m->nifFile->getMesh(m->meshData, 0U, switchActive, noRootNodeTransform);
+    m->dataSize = fileSize;
+  }
+  catch (...)
+  {
+    cacheLock.lock();
+    m->meshData.clear();
+    if (m->nifFile)
+      delete m->nifFile;
+    unlinkModel(m);
+    modelCache.erase(m->i);
+    modelLoadCond.notify_all();
+    throw;
+  }
+  cacheLock.lock();
+  m->isLoading = false;
+  modelDataSize = modelDataSize + m->dataSize;
+  modelLoadCond.notify_all();
+  return m;
+}
+
+void Renderer_Base::ModelCache::releaseModel(CachedModel *m)
+{
+  if (!m)
+    return;
+  std::lock_guard< std::mutex > cacheLock(modelCacheMutex);
+  if (m->refCnt > 0U)
+    m->refCnt--;
+}
+
+void Renderer_Base::ModelCache::shrinkModelCache()
+{
+  std::lock_guard< std::mutex > cacheLock(modelCacheMutex);
+  CachedModel *p = firstModel;
+  while (modelDataSize > modelCacheSize && p)
+  {
+    CachedModel *nxt = p->nxt;
+    if (!p->refCnt)
+    {
+      modelDataSize = modelDataSize - p->dataSize;
+      p->meshData.clear();
+      if (p->nifFile)
+        delete p->nifFile;
+      unlinkModel(p);
+      modelCache.erase(p->i);
+    }
+    p = nxt;
+  }
+}
+
+void Renderer_Base::ModelCache::clear()
+{
+  std::lock_guard< std::mutex > cacheLock(modelCacheMutex);
+  for (CachedModel *p = firstModel; p; p = p->nxt)
   {
-    if (p->texture)
-      delete p->texture;
-    delete p->textureLoadMutex;
+    p->meshData.clear();
+    if (p->nifFile)
+      delete p->nifFile;
   }
-  textureDataSize = 0;
-  firstTexture = (CachedTexture *) 0;
-  lastTexture = (CachedTexture *) 0;
-  textureCache.clear();
+  modelDataSize = 0;
+  firstModel = (CachedModel *) 0;
+  lastModel = (CachedModel *) 0;
+  modelCache.clear();
 }
 
 unsigned int Renderer_Base::MaterialSwaps::loadMaterialSwap(
@@ -222,8 +453,9 @@ unsigned int Renderer_Base::MaterialSwaps::loadMaterialSwap(
           try
           {
             MaterialSwap& m = v[bnamPath];
-            ba2File.extractFile(fileBuf, snamPath);
-            FileBuffer  tmp(&(fileBuf.front()), fileBuf.size());
+            const unsigned char *fileData = (unsigned char *) 0;
+            size_t  fileSize = ba2File.extractFile(fileData, fileBuf, snamPath);
+            FileBuffer  tmp(fileData, fileSize);
             m.bgsmFile.loadBGSMFile(m.texturePaths, tmp);
             if (gradientMapV >= 0)
               m.bgsmFile.gradientMapV = (unsigned char) gradientMapV;
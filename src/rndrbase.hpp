@@ -13,6 +13,7 @@
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 
 struct Renderer_Base
 {
@@ -25,24 +26,47 @@ struct Renderer_Base
       CachedTexture *prv;
       CachedTexture *nxt;
       std::mutex    *textureLoadMutex;
+      // number of threads waiting for the texture to be loaded
+      unsigned int  waitCnt;
     };
-    size_t  textureDataSize;
+    // textures are partitioned by the hash of the file name into shards
+    // that are locked separately, each shard has its own list of textures
+    // in least recently used first order
+    struct TextureCacheShard
+    {
+      size_t  textureDataSize;
+      CachedTexture *firstTexture;
+      CachedTexture *lastTexture;
+      std::mutex  textureCacheMutex;
+      std::map< std::string, CachedTexture >  textureCache;
+      TextureCacheShard()
+        : textureDataSize(0),
+          firstTexture((CachedTexture *) 0),
+          lastTexture((CachedTexture *) 0)
+      {
+      }
+    };
+    static const size_t textureCacheShardCnt = 16;
     size_t  textureCacheSize;
-    CachedTexture *firstTexture;
-    CachedTexture *lastTexture;
-    std::mutex  textureCacheMutex;
-    std::map< std::string, CachedTexture >  textureCache;
+    // store BC1 to BC5 textures in compressed format if true
+    bool    blockCompressed;
+    // number of textures removed from the cache, the pointers returned by
+    // loadTexture() remain valid while this does not change
+    size_t  texturesRemoved;
+    TextureCacheShard textureCacheShards[textureCacheShardCnt];
     static size_t getTextureDataSize(const DDSTexture *t);
+    static size_t getShardIndex(const std::string& fileName);
     TextureCache(size_t n = 0x40000000)
-      : textureDataSize(0),
-        textureCacheSize(n),
-        firstTexture((CachedTexture *) 0),
-        lastTexture((CachedTexture *) 0)
+      : textureCacheSize(n),
+        blockCompressed(false),
+        texturesRemoved(0)
     {
     }
     ~TextureCache();
     // returns NULL on failure
     // *waitFlag is set to true if the texture is locked by another thread
+    // textures may be loaded while shrinkTextureCache() is running on another
+    // thread, but the pointers returned are only valid until it is called
     const DDSTexture *loadTexture(const BA2File& ba2File,
                                   const std::string& fileName,
                                   std::vector< unsigned char >& fileBuf,
@@ -50,6 +74,57 @@ struct Renderer_Base
     void shrinkTextureCache();
     void clear();
   };
+  struct ModelCache
+  {
+    struct CachedModel
+    {
+      NIFFile *nifFile;
+      std::vector< NIFFile::NIFTriShape > meshData;
+      // estimated memory usage (the size of the NIF file)
+      size_t  dataSize;
+      // the model can only be removed from the cache if refCnt is zero
+      unsigned int  refCnt;
+      bool    isLoading;
+      // key: model path, switchActive | (noRootNodeTransform << 31)
+      std::map< std::pair< std::string, unsigned int >,
+                CachedModel >::iterator i;
+      CachedModel *prv;
+      CachedModel *nxt;
+    };
+    size_t  modelDataSize;
+    size_t  modelCacheSize;
+    // list of models in least recently used first order
+    CachedModel *firstModel;
+    CachedModel *lastModel;
+    std::mutex  modelCacheMutex;
+    std::condition_variable modelLoadCond;
+    std::map< std::pair< std::string, unsigned int >, CachedModel >
+        modelCache;
+    void unlinkModel(CachedModel *m);
+    void linkModel(CachedModel *m);
+    ModelCache(size_t n = 0x10000000)
+      : modelDataSize(0),
+        modelCacheSize(n),
+        firstModel((CachedModel *) 0),
+        lastModel((CachedModel *) 0)
+    {
+    }
+    ~ModelCache();
+    // returns a parsed model, switchActive and noRootNodeTransform are passed
+    // to NIFFile::getMesh(), the model must be released with releaseModel()
+    // when it is no longer used
+    // throws FO76UtilsError if the file is missing or invalid
+    CachedModel *loadModel(const BA2File& ba2File,
+                           const std::string& fileName,
+                           std::vector< unsigned char >& fileBuf,
+                           unsigned int switchActive = 0U,
+                           bool noRootNodeTransform = false);
+    void releaseModel(CachedModel *m);
+    // remove unused models until the total size is at most modelCacheSize
+    void shrinkModelCache();
+    // all models must be released before calling clear()
+    void clear();
+  };
   struct MaterialSwaps
   {
     struct MaterialSwap
@@ -51,9 +51,7 @@ bool StringDB::loadFile(const char *fileName, const char *stringsPrefix)
     }
     if (tmpName.empty())
       continue;
-    ba2File.extractFile(buf, tmpName);
-    fileBuf = &(buf.front());
-    fileBufSize = buf.size();
+    fileBufSize = ba2File.extractFile(fileBuf, buf, tmpName);
     filePos = 0;
     size_t  stringCnt = readUInt32();
     size_t  dataSize = readUInt32();
@@ -3,6 +3,8 @@
 #include "zlib.hpp"
 #include "fp32vec4.hpp"
 
+bool ZLibDecompressor::fastDecoderEnabled = true;
+
 std::uint32_t ZLibDecompressor::readU32LE()
 {
   std::uint32_t w = readU16LE();
@@ -488,6 +490,383 @@ unsigned char * ZLibDecompressor::decompressZLibBlock(
   return wp;
 }
 
+void ZLibDecompressor::huffmanBuildFastTable(
+    std::uint32_t *fastTable, const unsigned int *huffTable,
+    unsigned int tableBits, bool isDistTable)
+{
+  // codes of length N are stored in the first 2^N elements of the table,
+  // which is doubled in size by copying before adding the next length
+  fastTable[0] = 0U;
+  size_t  curSize = 1;
+  unsigned int  r = 0;
+  for (unsigned int l = 1; l <= tableBits; l++)
+  {
+    if (huffTable[l + 255] == 0xFFFFFFFFU)
+      break;
+    std::memcpy(fastTable + curSize, fastTable,
+                curSize * sizeof(std::uint32_t));
+    curSize = curSize << 1;
+    for ( ; r < huffTable[l + 255]; r++)
+    {
+      unsigned int  c = huffTable[huffTable[l + 287] + r];
+      std::uint32_t e = 0U;
+      if (isDistTable)
+      {
+        if (c < 4)
+        {
+          e = (l | 0x0100U | (l << 12)) + ((c + 1U) << 16);
+        }
+        else if (c < 30)
+        {
+          unsigned int  nBits = (c - 2) >> 1;
+          e = ((l + nBits) | 0x0100U | (l << 12))
+              + ((((((c - 2) & 1U) | 2U) << nBits) + 1U) << 16);
+        }
+      }
+      else if (c < 256)
+      {
+        e = (l | 0x0100U | (l << 12)) + (c << 16);
+      }
+      else if (c == 256)
+      {
+        e = l | 0x0800U | (l << 12);
+      }
+      else if (c < 265)
+      {
+        e = (l | 0x0400U | (l << 12)) + ((c - 254U) << 16);
+      }
+      else if (c < 285)
+      {
+        unsigned int  nBits = (c - 261) >> 2;
+        e = ((l + nBits) | 0x0400U | (l << 12))
+            + ((((((c - 261) & 3U) | 4U) << nBits) + 3U) << 16);
+      }
+      else if (c == 285)
+      {
+        e = (l | 0x0400U | (l << 12)) + (258U << 16);
+      }
+      // reverse the bit order of the code
+      unsigned int  n = ((r & 0x5555U) << 1) | ((r >> 1) & 0x5555U);
+      n = ((n & 0x3333U) << 2) | ((n >> 2) & 0x3333U);
+      n = ((n & 0x0F0FU) << 4) | ((n >> 4) & 0x0F0FU);
+      n = ((n & 0x00FFU) << 8) | ((n >> 8) & 0x00FFU);
+      fastTable[n >> (16 - l)] = e;
+    }
+    r = r << 1;
+  }
+  for ( ; curSize < (size_t(1) << tableBits); curSize = curSize << 1)
+  {
+    std::memcpy(fastTable + curSize, fastTable,
+                curSize * sizeof(std::uint32_t));
+  }
+}
+
+void ZLibDecompressor::huffmanBuildFastTables()
+{
+  huffmanBuildFastTable(fastTableL, getHuffTable(2), 11, false);
+  huffmanBuildFastTable(fastTableD, getHuffTable(1), 10, true);
+}
+
+static inline std::uint64_t readUInt64LEFast(const unsigned char *p)
+{
+#if defined(__i386__) || defined(__x86_64__) || defined(__x86_64)
+  return *(reinterpret_cast< const std::uint64_t * >(p));
+#else
+  std::uint64_t w = 0U;
+  for (int i = 8; i-- > 0; )
+    w = (w << 8) | p[i];
+  return w;
+#endif
+}
+
+// returns the number of valid bits in a bit buffer with a stop bit
+static inline unsigned int srBitCnt(unsigned long long sr)
+{
+  unsigned int  n = 0;
+  for ( ; sr >= 0x00010000ULL; sr = sr >> 16)
+    n = n + 16;
+  return (n + (unsigned int) FloatVector4::log2Int(int(sr)));
+}
+
+unsigned char * ZLibDecompressor::decompressZLibFastLoop(
+    unsigned long long& srRef, unsigned char *wp,
+    unsigned char *buf, unsigned char *bufEnd)
+{
+  const unsigned int  *huffTableD = getHuffTable(1);
+  unsigned long long  sr = srRef;
+  if (BRANCH_LIKELY((inBufEnd - inPtr) >= 16 && (bufEnd - wp) >= 288))
+  {
+    // fast loop without bounds checking: the stop bit is removed from the
+    // bit buffer, and the number of valid bits is stored in bitCnt
+    unsigned int  bitCnt = srBitCnt(sr);
+    unsigned long long  bitBuf = sr ^ (1ULL << bitCnt);
+    do
+    {
+      // refill the bit buffer to at least 56 bits, the bits above bitCnt
+      // are either zero or already contain the same input data
+      bitBuf = bitBuf | (readUInt64LEFast(inPtr) << bitCnt);
+      inPtr = inPtr + ((63 - bitCnt) >> 3);
+      bitCnt = bitCnt | 56;
+      std::uint32_t e = fastTableL[bitBuf & 0x07FF];
+      if (e & 0x0100U)
+      {
+        // decode up to four literals (44 bits) without refilling the buffer
+        unsigned int  n = 4;
+        do
+        {
+          bitBuf = bitBuf >> (e & 0x3FU);
+          bitCnt = bitCnt - (e & 0x3FU);
+          *(wp++) = (unsigned char) (e >> 16);
+          e = fastTableL[bitBuf & 0x07FF];
+        }
+        while ((e & 0x0100U) && --n);
+        if (e & 0x0100U)
+          continue;
+        // at least 12 bits are left, refill for the length and distance
+        bitBuf = bitBuf | (readUInt64LEFast(inPtr) << bitCnt);
+        inPtr = inPtr + ((63 - bitCnt) >> 3);
+        bitCnt = bitCnt | 56;
+      }
+      if (BRANCH_UNLIKELY(!(e & 0x0400U)))
+        break;                // end of block, or code longer than 11 bits
+      // length: up to 11 + 5 bits
+      unsigned int  nBits = e & 0x3FU;
+      unsigned int  b = (unsigned int) bitBuf & ((1U << nBits) - 1U);
+      size_t  lzLen = size_t((e >> 16) + (b >> ((e >> 12) & 15U)));
+      bitBuf = bitBuf >> nBits;
+      bitCnt = bitCnt - nBits;
+      // distance: up to 10 + 13 bits, or 15 + 13 with huffmanDecode()
+      e = fastTableD[bitBuf & 0x03FF];
+      size_t  offs;
+      if (BRANCH_LIKELY(e & 0x0100U))
+      {
+        nBits = e & 0x3FU;
+        b = (unsigned int) bitBuf & ((1U << nBits) - 1U);
+        offs = size_t((e >> 16) + (b >> ((e >> 12) & 15U)));
+        bitBuf = bitBuf >> nBits;
+        bitCnt = bitCnt - nBits;
+      }
+      else
+      {
+        sr = (bitBuf & ((1ULL << bitCnt) - 1ULL)) | (1ULL << bitCnt);
+        offs = huffmanDecode(sr, huffTableD);
+        if (offs >= 4)
+        {
+          if (offs >= 30)
+          {
+            errorMessage("invalid or corrupt ZLib compressed data");
+          }
+          offs = offs - 2;
+          offs = readBitsRR(sr, (unsigned char) (offs >> 1),
+                            (unsigned int) ((offs & 1) | 2));
+        }
+        offs++;
+        bitCnt = srBitCnt(sr);
+        bitBuf = sr ^ (1ULL << bitCnt);
+      }
+      if (BRANCH_UNLIKELY(offs > size_t(wp - buf)))
+      {
+        errorMessage("invalid LZ77 offset in ZLib compressed data");
+      }
+      // copy LZ77 sequence in 16 or 8 byte blocks, this may write up to 15
+      // bytes past the end of the sequence, but not past the end of buf
+      const unsigned char *rp = wp - offs;
+      unsigned char *wpEnd = wp + lzLen;
+      if (BRANCH_LIKELY(offs >= 16))
+      {
+        do
+        {
+          std::memcpy(wp, rp, 16);
+          wp = wp + 16;
+          rp = rp + 16;
+        }
+        while (wp < wpEnd);
+      }
+      else if (offs >= 8)
+      {
+        do
+        {
+          std::memcpy(wp, rp, 8);
+          wp = wp + 8;
+          rp = rp + 8;
+        }
+        while (wp < wpEnd);
+      }
+      else if (offs == 1)
+      {
+        std::memset(wp, *rp, lzLen);
+      }
+      else
+      {
+        do
+        {
+          *(wp++) = *(rp++);
+        }
+        while (wp < wpEnd);
+      }
+      wp = wpEnd;
+    }
+    while (BRANCH_LIKELY((inBufEnd - inPtr) >= 16 && (bufEnd - wp) >= 288));
+    sr = (bitBuf & ((1ULL << bitCnt) - 1ULL)) | (1ULL << bitCnt);
+  }
+  srRef = sr;
+  return wp;
+}
+
+inline size_t ZLibDecompressor::decodeLZ77Sequence(unsigned long long& sr,
+                                                  unsigned int c, size_t& offs)
+{
+  size_t  lzLen = c - 254;
+  if (!(lzLen >= 3 && lzLen <= 10))
+  {
+    if (!(lzLen >= 11 && lzLen <= 30))
+    {
+      if (lzLen == 31)
+        lzLen = 258;
+      else
+        errorMessage("invalid or corrupt ZLib compressed data");
+    }
+    else
+    {
+      lzLen = lzLen - 7;
+      unsigned char nBits = (unsigned char) (lzLen >> 2);
+      lzLen = readBitsRR(sr, nBits, (unsigned int) ((lzLen & 3) | 4)) + 3;
+    }
+  }
+  offs = huffmanDecode(sr, getHuffTable(1));
+  if (offs >= 4)
+  {
+    if (offs >= 30)
+    {
+      errorMessage("invalid or corrupt ZLib compressed data");
+    }
+    offs = offs - 2;
+    unsigned char nBits = (unsigned char) (offs >> 1);
+    offs = readBitsRR(sr, nBits, (unsigned int) ((offs & 1) | 2));
+  }
+  offs++;
+  return lzLen;
+}
+
+unsigned char * ZLibDecompressor::decompressZLibBlockFast(
+    unsigned long long& srRef, unsigned char *wp,
+    unsigned char *buf, unsigned char *bufEnd)
+{
+  const unsigned int  *huffTableL = getHuffTable(2);
+  unsigned long long  sr = srRef;
+  while (true)
+  {
+    wp = decompressZLibFastLoop(sr, wp, buf, bufEnd);
+    // decode a single symbol with bounds checking
+    unsigned int  c = huffmanDecode(sr, huffTableL);
+    if (c < 256)                        // literal byte
+    {
+      if (wp >= bufEnd)
+      {
+        errorMessage("uncompressed ZLib data larger than output buffer");
+      }
+      *(wp++) = (unsigned char) c;
+      continue;
+    }
+    if (c == 256)                       // end of block
+      break;
+    size_t  offs;
+    size_t  lzLen = decodeLZ77Sequence(sr, c, offs);
+    if (offs > size_t(wp - buf))
+    {
+      errorMessage("invalid LZ77 offset in ZLib compressed data");
+    }
+    const unsigned char *rp = wp - offs;
+    if ((wp + lzLen) > bufEnd)
+    {
+      errorMessage("uncompressed ZLib data larger than output buffer");
+    }
+    do
+    {
+      *(wp++) = *(rp++);
+    }
+    while (--lzLen);
+  }
+  srRef = sr;
+  return wp;
+}
+
+void ZLibDecompressor::updateAdler32(unsigned int& a1, unsigned int& a2,
+                                     const unsigned char *p, size_t n)
+{
+  unsigned int  s1 = a1;
+  unsigned int  s2 = a2;
+  while (n > 0)
+  {
+    // 5552 is the largest number of bytes that cannot overflow s2
+    size_t  k = (n < 5552 ? n : 5552);
+    n = n - k;
+#if ENABLE_X86_64_AVX
+    if (k >= 16)
+    {
+      static const XMM_UInt8  weightTbl =
+      {
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1
+      };
+      static const XMM_UInt16 onesTbl = { 1, 1, 1, 1, 1, 1, 1, 1 };
+      XMM_UInt32  sumBytes = { 0U, 0U, 0U, 0U };
+      XMM_UInt32  sumWeighted = { 0U, 0U, 0U, 0U };
+      XMM_UInt32  sumPrv = { 0U, 0U, 0U, 0U };
+      XMM_UInt32  zeroVec = { 0U, 0U, 0U, 0U };
+      size_t  blockCnt = k >> 4;
+      k = k & 15;
+      s2 = s2 + s1 * (unsigned int) (blockCnt << 4);
+      for ( ; blockCnt; blockCnt--, p = p + 16)
+      {
+        XMM_UInt32  tmp1, tmp2;
+        __asm__ ("vpaddd %1, %0, %0" : "+x" (sumPrv) : "x" (sumBytes));
+        __asm__ ("vmovdqu %1, %0" : "=x" (tmp1) : "m" (*p));
+        __asm__ ("vpsadbw %2, %1, %0"
+                 : "=x" (tmp2) : "x" (tmp1), "x" (zeroVec));
+        __asm__ ("vpaddd %1, %0, %0" : "+x" (sumBytes) : "x" (tmp2));
+        __asm__ ("vpmaddubsw %1, %0, %0" : "+x" (tmp1) : "xm" (weightTbl));
+        __asm__ ("vpmaddwd %1, %0, %0" : "+x" (tmp1) : "xm" (onesTbl));
+        __asm__ ("vpaddd %1, %0, %0" : "+x" (sumWeighted) : "x" (tmp1));
+      }
+      s1 = s1 + (sumBytes[0] + sumBytes[2]);
+      s2 = s2 + ((sumPrv[0] + sumPrv[2]) % 65521U) * 16U;
+      s2 = s2 + (sumWeighted[0] + sumWeighted[1]
+                 + sumWeighted[2] + sumWeighted[3]);
+      s2 = s2 % 65521U;
+    }
+#else
+    for ( ; k >= 8; k = k - 8, p = p + 8)
+    {
+      s1 = s1 + p[0];
+      s2 = s2 + s1;
+      s1 = s1 + p[1];
+      s2 = s2 + s1;
+      s1 = s1 + p[2];
+      s2 = s2 + s1;
+      s1 = s1 + p[3];
+      s2 = s2 + s1;
+      s1 = s1 + p[4];
+      s2 = s2 + s1;
+      s1 = s1 + p[5];
+      s2 = s2 + s1;
+      s1 = s1 + p[6];
+      s2 = s2 + s1;
+      s1 = s1 + p[7];
+      s2 = s2 + s1;
+    }
+#endif
+    for ( ; k; k--, p++)
+    {
+      s1 = s1 + *p;
+      s2 = s2 + s1;
+    }
+    s1 = s1 % 65521U;
+    s2 = s2 % 65521U;
+  }
+  a1 = s1;
+  a2 = s2;
+}
+
 size_t ZLibDecompressor::decompressZLib(unsigned char *buf,
                                         size_t uncompressedSize)
 {
@@ -512,6 +891,16 @@ size_t ZLibDecompressor::decompressZLib(unsigned char *buf,
       {
         errorMessage("uncompressed ZLib data larger than output buffer");
       }
+      if (fastDecoderEnabled)
+      {
+        if (len > size_t(inBufEnd - inPtr))
+          errorMessage("end of ZLib compressed data");
+        std::memcpy(wp, inPtr, len);
+        inPtr = inPtr + len;
+        updateAdler32(s1, s2, wp, len);
+        wp = wp + len;
+        len = 0;
+      }
       for ( ; len; wp++, len--)
       {
         *wp = readU8();
@@ -532,7 +921,17 @@ size_t ZLibDecompressor::decompressZLib(unsigned char *buf,
     else                                // compressed block
     {
       sr = huffmanInit(sr, !(bhdr & 4));
-      wp = decompressZLibBlock(sr, wp, buf, bufEnd, s1, s2);
+      if (!fastDecoderEnabled)
+      {
+        wp = decompressZLibBlock(sr, wp, buf, bufEnd, s1, s2);
+      }
+      else
+      {
+        huffmanBuildFastTables();
+        unsigned char *blockStart = wp;
+        wp = decompressZLibBlockFast(sr, wp, buf, bufEnd);
+        updateAdler32(s1, s2, blockStart, size_t(wp - blockStart));
+      }
     }
     s1 = s1 % 65521U;
     s2 = s2 % 65521U;
@@ -567,3 +966,179 @@ size_t ZLibDecompressor::decompressData(unsigned char *buf,
   return zlibDecompressor.decompressZLib(buf, uncompressedSize);
 }
 
+ZLibStreamDecompressor::ZLibStreamDecompressor(const unsigned char *inBuf,
+                                               size_t compressedSize,
+                                               size_t uncompressedSize)
+  : ZLibDecompressor(inBuf, compressedSize),
+    winPos(0),
+    bytesLeft(uncompressedSize),
+    copyLen(0),
+    lzOffs(0),
+    sr(1),
+    s1(1),
+    s2(0),
+    streamState(0),
+    finalBlock(false)
+{
+  // CMF, FLG
+  std::uint16_t h = readU16BE();
+  if (h == 0x0422)
+  {
+    windowBuf.resize(uncompressedSize + 1);
+    windowBuf.resize(decompressLZ4(&(windowBuf.front()), uncompressedSize));
+    streamState = 5;
+    return;
+  }
+  if ((h & 0x8F20) != 0x0800 || (h % 31) != 0)
+    errorMessage("invalid or unsupported ZLib compression method");
+  // 32 KB of history and up to 32 KB of new data, or less for small files
+  windowBuf.resize(std::min(uncompressedSize, size_t(65536)) + 1);
+}
+
+unsigned char * ZLibStreamDecompressor::decompressBlocks(
+    unsigned char *wp, unsigned char *bufEnd, bool isSizeLimit)
+{
+  unsigned char *buf = &(windowBuf.front());
+  const unsigned int  *huffTableL = getHuffTable(2);
+  // returns when bufEnd is reached, or at the end of the final block
+  while (streamState < 3)
+  {
+    if (streamState == 0)
+    {
+      // read Deflate block header
+      if (finalBlock)
+      {
+        streamState = 3;
+        break;
+      }
+      unsigned char bhdr = (unsigned char) readBitsRR(sr, 3);
+      finalBlock = bool(bhdr & 1);
+      if (!(bhdr & 6))                  // no compression
+      {
+        srReset(sr);
+        copyLen = readU16LE();
+        if ((copyLen ^ readU16LE()) != 0xFFFF)
+          errorMessage("invalid or corrupt ZLib compressed data");
+        streamState = 1;
+      }
+      else if ((bhdr & 6) == 6)         // reserved (invalid)
+      {
+        errorMessage("invalid Deflate block type in ZLib compressed data");
+      }
+      else                              // compressed block
+      {
+        sr = huffmanInit(sr, !(bhdr & 4));
+        huffmanBuildFastTables();
+        streamState = 2;
+      }
+      continue;
+    }
+    if (copyLen)
+    {
+      // stored block data, or LZ77 sequence that did not fit in the buffer
+      if (wp >= bufEnd)
+      {
+        if (isSizeLimit)
+          errorMessage("uncompressed ZLib data larger than output buffer");
+        break;
+      }
+      size_t  n = std::min(copyLen, size_t(bufEnd - wp));
+      copyLen = copyLen - n;
+      if (streamState == 1)
+      {
+        if (n > size_t(inBufEnd - inPtr))
+          errorMessage("end of ZLib compressed data");
+        std::memcpy(wp, inPtr, n);
+        inPtr = inPtr + n;
+        wp = wp + n;
+      }
+      else
+      {
+        const unsigned char *rp = wp - lzOffs;
+        do
+        {
+          *(wp++) = *(rp++);
+        }
+        while (--n);
+      }
+      continue;
+    }
+    if (streamState == 1)
+    {
+      streamState = 0;
+      continue;
+    }
+    if (wp >= bufEnd && !isSizeLimit)
+      break;
+    wp = decompressZLibFastLoop(sr, wp, buf, bufEnd);
+    if (wp >= bufEnd && !isSizeLimit)
+      break;
+    // decode a single symbol with bounds checking
+    unsigned int  c = huffmanDecode(sr, huffTableL);
+    if (c < 256)                        // literal byte
+    {
+      if (wp >= bufEnd)
+        errorMessage("uncompressed ZLib data larger than output buffer");
+      *(wp++) = (unsigned char) c;
+    }
+    else if (c == 256)                  // end of block
+    {
+      streamState = 0;
+    }
+    else
+    {
+      copyLen = decodeLZ77Sequence(sr, c, lzOffs);
+      if (lzOffs > size_t(wp - buf))
+        errorMessage("invalid LZ77 offset in ZLib compressed data");
+    }
+  }
+  return wp;
+}
+
+size_t ZLibStreamDecompressor::decompressChunk(const unsigned char*& dataPtr)
+{
+  if (streamState == 5)
+  {
+    size_t  n = std::min(windowBuf.size() - winPos, size_t(32768));
+    dataPtr = &(windowBuf.front()) + winPos;
+    winPos = winPos + n;
+    return n;
+  }
+  unsigned char *windowStart = &(windowBuf.front());
+  size_t  windowSize = windowBuf.size() - 1;
+  while (streamState < 4)
+  {
+    if (winPos >= windowSize && winPos > 32768)
+    {
+      // keep the last 32 KB for LZ77 references
+      std::memmove(windowStart, windowStart + (winPos - 32768), 32768);
+      winPos = 32768;
+    }
+    unsigned char *buf = windowStart + winPos;
+    unsigned char *bufEnd = windowStart + windowSize;
+    bool    isSizeLimit = (bytesLeft <= windowSize - winPos);
+    if (isSizeLimit)
+      bufEnd = buf + bytesLeft;
+    unsigned char *wp = decompressBlocks(buf, bufEnd, isSizeLimit);
+    size_t  n = size_t(wp - buf);
+    updateAdler32(s1, s2, buf, n);
+    s1 = s1 % 65521U;
+    s2 = s2 % 65521U;
+    winPos = winPos + n;
+    bytesLeft = bytesLeft - n;
+    if (streamState == 3)
+    {
+      srReset(sr);
+      // verify Adler-32 checksum
+      if (readU32BE() != ((s2 << 16) | s1))
+        errorMessage("checksum error in ZLib compressed data");
+      streamState = 4;
+    }
+    if (n)
+    {
+      dataPtr = buf;
+      return n;
+    }
+  }
+  return 0;
+}
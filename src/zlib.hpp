@@ -10,6 +10,16 @@ class ZLibDecompressor
   const unsigned char *inPtr;
   const unsigned char *inBufEnd;
   unsigned int  tableBuf[1312];         // 320 * 3 + 32 + 32 + 288
+  // tables used by decompressZLibBlockFast(), indexed with 11 (literals and
+  // lengths) or 10 (distances) bits of input, the format of the elements is:
+  //     bits 0 to 5:   total number of bits (code length + extra bits)
+  //     bits 8 to 11:  1: literal or distance, 4: length, 8: end of block,
+  //                    0: not decoded (code is too long or invalid)
+  //     bits 12 to 15: code length
+  //     bits 16 to 31: literal, or base length or distance
+  std::uint32_t fastTableL[2048];
+  std::uint32_t fastTableD[1024];
+  static bool   fastDecoderEnabled;
   // huffTable[N] (0 <= N <= 255):
   //     fast decode table for code lengths <= 8, contains length | (C << 8),
   //     where C is the decoded symbol, or N bit reversed if length > 8
@@ -62,6 +72,28 @@ class ZLibDecompressor
                                      unsigned char *wp,
                                      unsigned char *buf, unsigned char *bufEnd,
                                      unsigned int& a1, unsigned int& a2);
+  // build fastTableL and fastTableD from the tables created by huffmanInit()
+  static void huffmanBuildFastTable(std::uint32_t *fastTable,
+                                    const unsigned int *huffTable,
+                                    unsigned int tableBits, bool isDistTable);
+  void huffmanBuildFastTables();
+  // decodes symbols while at least 16 bytes of input and 288 bytes of output
+  // space are left, returns before the end of block or any code that is not
+  // in the fast tables
+  unsigned char *decompressZLibFastLoop(unsigned long long& srRef,
+                                        unsigned char *wp, unsigned char *buf,
+                                        unsigned char *bufEnd);
+  // decodes the length (returned) and distance (offs) of an LZ77 sequence
+  // after length symbol c (257 to 285)
+  inline size_t decodeLZ77Sequence(unsigned long long& sr, unsigned int c,
+                                   size_t& offs);
+  // faster version of decompressZLibBlock() using the tables above, the
+  // Adler-32 checksum is not updated
+  unsigned char *decompressZLibBlockFast(unsigned long long& srRef,
+                                         unsigned char *wp, unsigned char *buf,
+                                         unsigned char *bufEnd);
+  static void updateAdler32(unsigned int& a1, unsigned int& a2,
+                            const unsigned char *p, size_t n);
   size_t decompressZLib(unsigned char *buf, size_t uncompressedSize);
   ZLibDecompressor(const unsigned char *inBuf, size_t compressedSize)
     : inPtr(inBuf),
@@ -69,10 +101,51 @@ class ZLibDecompressor
   {
   }
  public:
+  // The table driven decoder is used by default, setFastDecoder(false)
+  // selects the original implementation. Both produce identical output.
+  static inline void setFastDecoder(bool isEnabled)
+  {
+    fastDecoderEnabled = isEnabled;
+  }
   static size_t decompressData(unsigned char *buf, size_t uncompressedSize,
                                const unsigned char *inBuf,
                                size_t compressedSize);
 };
 
+// Decompresses a ZLib stream incrementally, in chunks of up to 32 KB that are
+// returned in an internal window buffer. The compressed data must remain
+// valid while the object is in use. LZ4 compressed data is decompressed
+// in a single step on construction, and is then returned in chunks.
+
+class ZLibStreamDecompressor : protected ZLibDecompressor
+{
+ protected:
+  std::vector< unsigned char >  windowBuf;
+  // end of the decompressed data in windowBuf
+  size_t  winPos;
+  // maximum number of bytes that can still be decompressed
+  size_t  bytesLeft;
+  // remaining length of a stored block, or of an incomplete LZ77 sequence
+  size_t  copyLen;
+  size_t  lzOffs;
+  unsigned long long  sr;
+  unsigned int  s1;                     // Adler-32 checksum
+  unsigned int  s2;
+  // 0: block header, 1: stored block, 2: compressed block,
+  // 3: checksum, 4: end of stream, 5: LZ4 data in windowBuf
+  unsigned char streamState;
+  bool    finalBlock;
+  unsigned char *decompressBlocks(unsigned char *wp, unsigned char *bufEnd,
+                                  bool isSizeLimit);
+ public:
+  // uncompressedSize is the maximum size of the decompressed data
+  ZLibStreamDecompressor(const unsigned char *inBuf, size_t compressedSize,
+                         size_t uncompressedSize);
+  // Decompresses the next chunk of data, and sets dataPtr to point to it.
+  // The data remains valid until the next call or the object is destroyed.
+  // Returns the size of the chunk, or 0 at the end of the stream.
+  size_t decompressChunk(const unsigned char*& dataPtr);
+};
+
 #endif
 